@@ -26,20 +26,37 @@ struct cmd_arguments
 {
     std::filesystem::path bam_file{};
     std::filesystem::path fasta_file{};
+    std::filesystem::path targets_file{};
 
     std::filesystem::path output_file_single_reads{"output_single_read_info.bed"};
     std::filesystem::path output_file_entropy{"output_entropy.bed"};
     std::filesystem::path output_file_pdr{"output_pdr.bed"};
+    std::filesystem::path cache_file{};
+    std::filesystem::path partial_file{};
+    std::filesystem::path checkpoint_file{};
 
     uint32_t verbosity = 0;
     uint32_t mapq_filter = 30;
     uint32_t coverage_filter = 10;
+    uint32_t threads = 1;
+    uint32_t workers = 0;
+    uint64_t shard_size = 0;
+    uint32_t checkpoint_interval = 600;
+    uint64_t flush_interval = 100000;
+    uint32_t stop_after_checkpoints = 0;
 
     bool rrbs = false;
+    bool sharded = false;
+    bool collated = false;
+    bool sort_single_read = false;
+    bool index = false;
+    bool resume = false;
 
     std::string mode;
     std::string score = "single_read";
     std::string aligner = "bsmap";
+    std::string region{};
+    std::string log_prefix{};
 };
 
 // Function to initialize the argument parser
@@ -59,9 +76,9 @@ void initialise_argument_parser(sharg::parser & parser, cmd_arguments & args)
     parser.add_option(args.fasta_file,
                       sharg::config{.short_id    = 'r',
                                     .long_id     = "reference",
-                                    .description = "Reference genome used to align the BAM file.",
+                                    .description = "Reference genome used to align the BAM file, or a reference index created with 'RLM index'.",
                                     .required    = true,
-                                    .validator   = sharg::input_file_validator{{"fa", "fasta"}}});
+                                    .validator   = sharg::input_file_validator{{"fa", "fasta", "rlm"}}});
 
     parser.add_option(args.mode,
                       sharg::config{.short_id    = 'm',
@@ -95,6 +112,114 @@ void initialise_argument_parser(sharg::parser & parser, cmd_arguments & args)
                                     .description = "Minimum mapping quality required to consider a read.",
                                     .validator   = sharg::arithmetic_range_validator{0, 255}});
 
+    parser.add_option(args.threads,
+                      sharg::config{.short_id    = 't',
+                                    .long_id     = "threads",
+                                    .description =
+                                    "Number of threads used to decompress the BAM file. Blocks are read ahead and inflated in the background. "
+                                    "With --sharded, the number of shards processed in parallel. Output compressed with BGZF (ending in .gz) "
+                                    "is compressed on this many threads.",
+                                    .validator   = sharg::arithmetic_range_validator{1, 256}});
+
+    parser.add_option(args.workers,
+                      sharg::config{.long_id     = "workers",
+                                    .description =
+                                    "Number of threads processing reads while the BAM file is read by another thread. The output is identical. "
+                                    "0 processes the reads on the reading thread. Can not be combined with --sharded.",
+                                    .validator   = sharg::arithmetic_range_validator{0, 256}});
+
+    parser.add_option(args.region,
+                      sharg::config{.long_id     = "region",
+                                    .description =
+                                    "Only process reads overlapping this region, given as chr, chr:start or chr:start-end (1-based, inclusive). "
+                                    "If the BAM file is indexed (.bai or .csi), only the overlapping parts of the file are read."});
+
+    parser.add_option(args.targets_file,
+                      sharg::config{.long_id     = "targets",
+                                    .description =
+                                    "BED file with target regions. Only reads overlapping a target are processed. "
+                                    "If the BAM file is indexed (.bai or .csi), only the overlapping parts of the file are read.",
+                                    .validator   = sharg::input_file_validator{{"bed"}}});
+
+    parser.add_flag(args.sharded,
+                    sharg::config{.long_id     = "sharded",
+                                  .description =
+                                  "Process the reference sequences in parallel using --threads workers and merge the results in reference order. "
+                                  "The output is identical to processing the file at once. Requires an indexed BAM file (.bai or .csi)."});
+
+    parser.add_flag(args.collated,
+                    sharg::config{.long_id     = "collated",
+                                  .description =
+                                  "Mates are adjacent in the BAM file, e.g. sorted by read name or the output of 'samtools collate'. "
+                                  "In 'PE' mode, only the last read is kept until its mate is read. Can not be combined with --sharded."});
+
+    parser.add_flag(args.sort_single_read,
+                    sharg::config{.long_id     = "sort_single_read",
+                                  .description =
+                                  "Sort the 'single_read' output by reference sequence, start position and read name instead of writing it in "
+                                  "the order in which reads are processed. Requires a BAM file sorted by position."});
+
+    parser.add_option(args.cache_file,
+                      sharg::config{.long_id     = "cache",
+                                    .description =
+                                    "Also write the CpG pattern of every read with at least 3 CpGs to this file, from which 'RLM rescore' computes "
+                                    "the 'pdr' and 'entropy' outputs again (e.g. with another --coverage) without reading the BAM file. "
+                                    "Can not be combined with --sharded.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"rlme"}}});
+
+    parser.add_option(args.partial_file,
+                      sharg::config{.long_id     = "emit_partial",
+                                    .description =
+                                    "Write the raw counts of the 'pdr' and 'entropy' scores to this file instead of the 'pdr' and 'entropy' "
+                                    "outputs. 'RLM merge' sums the counts of several such files, e.g. of parts of the reads processed on "
+                                    "different machines, and writes the outputs.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"rlmp"}}});
+
+    parser.add_option(args.checkpoint_file,
+                      sharg::config{.long_id     = "checkpoint",
+                                    .description =
+                                    "Regularly write the state of the run to this file, from which --resume continues the run if it is "
+                                    "interrupted. Requires a BAM file sorted by position with an index (.bai or .csi) and uncompressed text "
+                                    "outputs. Can not be combined with --sharded or --sort_single_read.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {}}});
+
+    parser.add_option(args.checkpoint_interval,
+                      sharg::config{.long_id     = "checkpoint_interval",
+                                    .description = "Minimum number of seconds between two checkpoints.",
+                                    .validator   = sharg::arithmetic_range_validator{0, 86400}});
+
+    parser.add_flag(args.resume,
+                    sharg::config{.long_id     = "resume",
+                                  .description =
+                                  "Continue an interrupted run from the file given by --checkpoint, or start from the beginning if there is "
+                                  "none. All other options must be the same as for the interrupted run."});
+
+    // Options for testing checkpoints on small inputs
+    parser.add_option(args.flush_interval,
+                      sharg::config{.long_id     = "flush_interval",
+                                    .description = "Number of bp between two points at which final counts are written.",
+                                    .hidden      = true,
+                                    .validator   = sharg::arithmetic_range_validator{1, 1000000000}});
+
+    parser.add_option(args.stop_after_checkpoints,
+                      sharg::config{.long_id     = "stop_after_checkpoints",
+                                    .description =
+                                    "Stop the run like an interruption at the flush point after this many checkpoints, once the outputs "
+                                    "are written beyond the last checkpoint. 0 never stops.",
+                                    .hidden      = true});
+
+    parser.add_flag(args.index,
+                    sharg::config{.long_id     = "index",
+                                  .description =
+                                  "Write a tabix index (.tbi, or .csi for reference sequences longer than 512 Mbp) for every output compressed "
+                                  "with BGZF (ending in .gz). The 'single_read' output is only indexed with --sort_single_read."});
+
+    parser.add_option(args.shard_size,
+                      sharg::config{.long_id     = "shard_size",
+                                    .description =
+                                    "With --sharded, split reference sequences into shards of this many bp to balance the workload. "
+                                    "0 processes every reference sequence as one shard."});
+
     parser.add_flag(args.rrbs,
                     sharg::config{.short_id    = 'd',
                                   .long_id     = "rrbs",
@@ -105,14 +230,16 @@ void initialise_argument_parser(sharg::parser & parser, cmd_arguments & args)
     parser.add_option(args.output_file_single_reads,
                       sharg::config{.short_id    = 'o',
                                     .long_id     = "output_single_read",
-                                    .description = "Output file with DNA methylation information for every single read with at least 3 CpGs.",
-                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt"}}});
+                                    .description =
+                                    "Output file with DNA methylation information for every single read with at least 3 CpGs. "
+                                    "Files ending in .rlmc are written in a compact binary format, which is converted to text by 'RLM view'.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz", "rlmc"}}});
 
     parser.add_option(args.output_file_entropy,
                       sharg::config{.short_id    = 'e',
                                     .long_id     = "output_entropy",
                                     .description = "Output file with entropy, epipolymorphism and epiallele information for every 4-mer spanned by complete reads.",
-                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt"}}});
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz"}}});
 
     parser.add_option(args.output_file_pdr,
                       sharg::config{.short_id    = 'p',
@@ -120,5 +247,336 @@ void initialise_argument_parser(sharg::parser & parser, cmd_arguments & args)
                                     .description =
                                     "Output file with read-transition score and percent discordant reads for every CpG spanned by complete reads. "
                                     "Only reads that cover at least 3 CpGs are considered.",
-                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt"}}});
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz"}}});
+}
+
+// Struct that stores command line arguments of 'RLM index'
+struct index_arguments
+{
+    std::filesystem::path fasta_file{};
+    std::filesystem::path index_file{};
+};
+
+// Function to initialize the argument parser of 'RLM index'
+void initialise_index_argument_parser(sharg::parser & parser, index_arguments & args)
+{
+    parser.info.author = "Sara Hetzel";
+    parser.info.short_description = "Create a binary reference index with the packed reference genome and the positions of all CpGs. "
+                                    "Pass it to RLM with -r instead of the FASTA file.";
+    parser.info.version = "1.2.0";
+
+    parser.add_option(args.fasta_file,
+                      sharg::config{.short_id    = 'r',
+                                    .long_id     = "reference",
+                                    .description = "Reference genome used to align the BAM files.",
+                                    .required    = true,
+                                    .validator   = sharg::input_file_validator{{"fa", "fasta"}}});
+
+    parser.add_option(args.index_file,
+                      sharg::config{.short_id    = 'o',
+                                    .long_id     = "output",
+                                    .description = "Output file for the reference index. Defaults to the reference genome file with the extension .rlm appended.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"rlm"}}});
+}
+
+// Struct that stores command line arguments of 'RLM view'
+struct view_arguments
+{
+    std::filesystem::path input_file{};
+    std::filesystem::path output_file{};
+    std::string region{};
+};
+
+// Function to initialize the argument parser of 'RLM view'
+void initialise_view_argument_parser(sharg::parser & parser, view_arguments & args)
+{
+    parser.info.author = "Sara Hetzel";
+    parser.info.short_description = "Convert a single read output in the binary format (.rlmc) to the single read output in text format.";
+    parser.info.version = "1.2.0";
+
+    parser.add_option(args.input_file,
+                      sharg::config{.short_id    = 'i',
+                                    .long_id     = "input",
+                                    .description = "Single read output in the binary format.",
+                                    .required    = true,
+                                    .validator   = sharg::input_file_validator{{"rlmc"}}});
+
+    parser.add_option(args.output_file,
+                      sharg::config{.short_id    = 'o',
+                                    .long_id     = "output",
+                                    .description = "Output file for the single read output in text format. Written to the standard output if not given.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz"}}});
+
+    parser.add_option(args.region,
+                      sharg::config{.long_id     = "region",
+                                    .description =
+                                    "Only write reads overlapping this region, given as chr, chr:start or chr:start-end (1-based, inclusive). "
+                                    "Only the blocks of the file that can contain such reads are read."});
+}
+
+// Struct that stores command line arguments of 'RLM rescore'
+struct rescore_arguments
+{
+    std::filesystem::path cache_file{};
+    std::filesystem::path fasta_file{};
+    std::filesystem::path output_file_entropy{"output_entropy.bed"};
+    std::filesystem::path output_file_pdr{"output_pdr.bed"};
+
+    uint32_t coverage_filter = 10;
+    uint32_t threads = 1;
+
+    bool index = false;
+
+    std::string score = "all";
+};
+
+// Function to initialize the argument parser of 'RLM rescore'
+void initialise_rescore_argument_parser(sharg::parser & parser, rescore_arguments & args)
+{
+    parser.info.author = "Sara Hetzel";
+    parser.info.short_description = "Compute the 'pdr' and 'entropy' outputs from the epiallele cache written with --cache instead of the BAM file.";
+    parser.info.version = "1.2.0";
+
+    parser.add_option(args.cache_file,
+                      sharg::config{.short_id    = 'i',
+                                    .long_id     = "input",
+                                    .description = "Epiallele cache written with --cache.",
+                                    .required    = true,
+                                    .validator   = sharg::input_file_validator{{"rlme"}}});
+
+    parser.add_option(args.fasta_file,
+                      sharg::config{.short_id    = 'r',
+                                    .long_id     = "reference",
+                                    .description = "Reference genome used to align the BAM file, or a reference index created with 'RLM index'.",
+                                    .required    = true,
+                                    .validator   = sharg::input_file_validator{{"fa", "fasta", "rlm"}}});
+
+    parser.add_option(args.score,
+                      sharg::config{.short_id    = 's',
+                                    .long_id     = "score",
+                                    .description = "The score(s) to compute.",
+                                    .validator   = sharg::value_list_validator{"entropy", "pdr", "all"}});
+
+    parser.add_option(args.coverage_filter,
+                      sharg::config{.short_id    = 'c',
+                                    .long_id     = "coverage",
+                                    .description = "Minimum number of reads required to report a CpG or kmer.",
+                                    .validator   = sharg::arithmetic_range_validator{1, 1000}});
+
+    parser.add_option(args.threads,
+                      sharg::config{.short_id    = 't',
+                                    .long_id     = "threads",
+                                    .description = "Number of threads compressing output compressed with BGZF (ending in .gz).",
+                                    .validator   = sharg::arithmetic_range_validator{1, 256}});
+
+    parser.add_flag(args.index,
+                    sharg::config{.long_id     = "index",
+                                  .description = "Write a tabix index for every output compressed with BGZF (ending in .gz)."});
+
+    parser.add_option(args.output_file_entropy,
+                      sharg::config{.short_id    = 'e',
+                                    .long_id     = "output_entropy",
+                                    .description = "Output file with entropy, epipolymorphism and epiallele information for every 4-mer spanned by complete reads.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz"}}});
+
+    parser.add_option(args.output_file_pdr,
+                      sharg::config{.short_id    = 'p',
+                                    .long_id     = "output_pdr",
+                                    .description = "Output file with read-transition score and percent discordant reads for every CpG spanned by complete reads.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz"}}});
+}
+
+// Struct that stores command line arguments of 'RLM merge'
+struct merge_arguments
+{
+    std::vector<std::filesystem::path> partial_files{};
+    std::filesystem::path output_file_entropy{"output_entropy.bed"};
+    std::filesystem::path output_file_pdr{"output_pdr.bed"};
+
+    uint32_t coverage_filter = 10;
+    uint32_t threads = 1;
+
+    bool index = false;
+
+    std::string score = "all";
+};
+
+// Function to initialize the argument parser of 'RLM merge'
+void initialise_merge_argument_parser(sharg::parser & parser, merge_arguments & args)
+{
+    parser.info.author = "Sara Hetzel";
+    parser.info.short_description = "Sum the counts written with --emit_partial and write the 'pdr' and 'entropy' outputs.";
+    parser.info.version = "1.2.0";
+
+    parser.add_option(args.partial_files,
+                      sharg::config{.short_id    = 'i',
+                                    .long_id     = "input",
+                                    .description = "Partial counts written with --emit_partial. Give this option once for every file.",
+                                    .required    = true,
+                                    .validator   = sharg::input_file_validator{{"rlmp"}}});
+
+    parser.add_option(args.score,
+                      sharg::config{.short_id    = 's',
+                                    .long_id     = "score",
+                                    .description = "The score(s) to compute.",
+                                    .validator   = sharg::value_list_validator{"entropy", "pdr", "all"}});
+
+    parser.add_option(args.coverage_filter,
+                      sharg::config{.short_id    = 'c',
+                                    .long_id     = "coverage",
+                                    .description = "Minimum number of reads required to report a CpG or kmer.",
+                                    .validator   = sharg::arithmetic_range_validator{1, 1000}});
+
+    parser.add_option(args.threads,
+                      sharg::config{.short_id    = 't',
+                                    .long_id     = "threads",
+                                    .description = "Number of threads merging the counts of the reference sequences and compressing output compressed "
+                                                   "with BGZF (ending in .gz).",
+                                    .validator   = sharg::arithmetic_range_validator{1, 256}});
+
+    parser.add_flag(args.index,
+                    sharg::config{.long_id     = "index",
+                                  .description = "Write a tabix index for every output compressed with BGZF (ending in .gz)."});
+
+    parser.add_option(args.output_file_entropy,
+                      sharg::config{.short_id    = 'e',
+                                    .long_id     = "output_entropy",
+                                    .description = "Output file with entropy, epipolymorphism and epiallele information for every 4-mer spanned by complete reads.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz"}}});
+
+    parser.add_option(args.output_file_pdr,
+                      sharg::config{.short_id    = 'p',
+                                    .long_id     = "output_pdr",
+                                    .description = "Output file with read-transition score and percent discordant reads for every CpG spanned by complete reads.",
+                                    .validator   = sharg::output_file_validator{sharg::output_file_open_options::open_or_create, {"bed", "tsv", "txt", "bed.gz", "tsv.gz", "txt.gz"}}});
+}
+
+// Struct that stores command line arguments of 'RLM batch'. The arguments shared by all samples are stored like those
+// of a single BAM file, whose input and output files are set per sample.
+struct batch_arguments
+{
+    std::filesystem::path sample_sheet{};
+
+    uint32_t threads = 1;
+    uint32_t jobs = 1;
+    uint64_t memory = 0;
+
+    bool compress = false;
+
+    cmd_arguments sample{};
+};
+
+// Function to initialize the argument parser of 'RLM batch'
+void initialise_batch_argument_parser(sharg::parser & parser, batch_arguments & args)
+{
+    parser.info.author = "Sara Hetzel";
+    parser.info.short_description = "Process the BAM files of several samples with one reference genome, which is only opened once.";
+    parser.info.version = "1.2.0";
+
+    parser.add_option(args.sample_sheet,
+                      sharg::config{.short_id    = 'i',
+                                    .long_id     = "input",
+                                    .description =
+                                    "Sample sheet with one sample per line: the BAM or SAM file and, separated by a tab, the prefix of its output "
+                                    "files (the BAM file without its extension if not given). The outputs are written to <prefix>_single_read_info.bed, "
+                                    "<prefix>_pdr.bed and <prefix>_entropy.bed.",
+                                    .required    = true,
+                                    .validator   = sharg::input_file_validator{{"tsv", "txt"}}});
+
+    parser.add_option(args.sample.fasta_file,
+                      sharg::config{.short_id    = 'r',
+                                    .long_id     = "reference",
+                                    .description = "Reference genome used to align the BAM files, or a reference index created with 'RLM index'.",
+                                    .required    = true,
+                                    .validator   = sharg::input_file_validator{{"fa", "fasta", "rlm"}}});
+
+    parser.add_option(args.sample.mode,
+                      sharg::config{.short_id    = 'm',
+                                    .long_id     = "mode",
+                                    .description = "Sequencing mode.",
+                                    .required    = true,
+                                    .validator   = sharg::value_list_validator{"SE", "PE"}});
+
+    parser.add_option(args.sample.score,
+                      sharg::config{.short_id    = 's',
+                                    .long_id     = "score",
+                                    .description = "The score(s) to compute. For 'entropy', 'pdr' and 'all' the single read output is always computed.",
+                                    .required    = true,
+                                    .validator   = sharg::value_list_validator{"single_read", "entropy", "pdr", "all"}});
+
+    parser.add_option(args.sample.aligner,
+                      sharg::config{.short_id    = 'a',
+                                    .long_id     = "aligner",
+                                    .description = "The alignment tool used to create the BAM files.",
+                                    .validator   = sharg::value_list_validator{"bsmap", "bismark", "segemehl", "gem"}});
+
+    parser.add_option(args.sample.coverage_filter,
+                      sharg::config{.short_id    = 'c',
+                                    .long_id     = "coverage",
+                                    .description = "Minimum number of reads required to report a CpG or kmer for 'pdr' and 'entropy' mode.",
+                                    .validator   = sharg::arithmetic_range_validator{1, 1000}});
+
+    parser.add_option(args.sample.mapq_filter,
+                      sharg::config{.short_id    = 'q',
+                                    .long_id     = "mapping_quality",
+                                    .description = "Minimum mapping quality required to consider a read.",
+                                    .validator   = sharg::arithmetic_range_validator{0, 255}});
+
+    parser.add_option(args.jobs,
+                      sharg::config{.short_id    = 'j',
+                                    .long_id     = "jobs",
+                                    .description = "Number of samples processed at once.",
+                                    .validator   = sharg::arithmetic_range_validator{1, 256}});
+
+    parser.add_option(args.memory,
+                      sharg::config{.long_id     = "memory",
+                                    .description =
+                                    "Memory budget in MB. A sample is only started while the estimated memory of all running samples stays within "
+                                    "the budget, but one sample always runs. 0 only limits the number of samples by --jobs. The estimate covers the "
+                                    "CpG and kmer counts, not reads waiting for their mate or single read lines waiting to be sorted."});
+
+    parser.add_option(args.threads,
+                      sharg::config{.short_id    = 't',
+                                    .long_id     = "threads",
+                                    .description =
+                                    "Number of threads shared by all samples processed at once. Every sample gets --threads / --jobs of them, "
+                                    "which decompress its BAM file and compress its outputs with --compress, or process its reads with --workers. "
+                                    "Must be at least --jobs * (1 + --workers).",
+                                    .validator   = sharg::arithmetic_range_validator{1, 256}});
+
+    parser.add_option(args.sample.workers,
+                      sharg::config{.long_id     = "workers",
+                                    .description =
+                                    "Number of threads processing the reads of every sample while its BAM file is read by another thread. They are "
+                                    "part of the threads of the sample.",
+                                    .validator   = sharg::arithmetic_range_validator{0, 256}});
+
+    parser.add_option(args.sample.region,
+                      sharg::config{.long_id     = "region",
+                                    .description =
+                                    "Only process reads overlapping this region, given as chr, chr:start or chr:start-end (1-based, inclusive)."});
+
+    parser.add_option(args.sample.targets_file,
+                      sharg::config{.long_id     = "targets",
+                                    .description = "BED file with target regions. Only reads overlapping a target are processed.",
+                                    .validator   = sharg::input_file_validator{{"bed"}}});
+
+    parser.add_flag(args.sample.collated,
+                    sharg::config{.long_id     = "collated",
+                                  .description = "Mates are adjacent in all BAM files, e.g. sorted by read name or collated."});
+
+    parser.add_flag(args.sample.sort_single_read,
+                    sharg::config{.long_id     = "sort_single_read",
+                                  .description = "Sort the 'single_read' outputs by position. Requires BAM files sorted by position."});
+
+    parser.add_flag(args.compress,
+                    sharg::config{.long_id     = "compress",
+                                  .description = "Compress the outputs with BGZF, their names end in .bed.gz."});
+
+    parser.add_flag(args.sample.rrbs,
+                    sharg::config{.short_id    = 'd',
+                                  .long_id     = "rrbs",
+                                  .description =
+                                  "If the BAM files contain reads from an RRBS experiment and reads should be trimmed in order to avoid bias of "
+                                  "artifical CpGs. Do NOT use if you already accounted for this problem during trimming."});
 }
@@ -0,0 +1,224 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Output written to a file by a background thread
+// ==========================================================================
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Stream buffer whose content is written to another stream by a background thread, so slow storage does not block
+// the thread producing the output. Filled buffers are passed to the background thread through a queue of at most
+// max_buffers buffers. If the queue is full, the producing thread waits for the background thread; the time it
+// waited is reported by stall_seconds.
+class async_output_buffer : public std::streambuf
+{
+public:
+    async_output_buffer(std::ostream & output,
+                        std::filesystem::path file,
+                        size_t const buffer_size = 1 << 20,
+                        size_t const max_buffers = 4) :
+        output{output},
+        file{std::move(file)},
+        buffer_size{buffer_size},
+        max_buffers{max_buffers}
+    {
+        next_buffer();
+    }
+
+    async_output_buffer(async_output_buffer const &) = delete;
+    async_output_buffer & operator=(async_output_buffer const &) = delete;
+
+    ~async_output_buffer()
+    {
+        if (writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                closed = true;
+            }
+            buffer_queued.notify_all();
+            writer.join();
+        }
+    }
+
+    // Write all remaining output and wait until it is written
+    void finish()
+    {
+        push();
+
+        if (writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                closed = true;
+            }
+            buffer_queued.notify_all();
+            writer.join();
+        }
+
+        if (failed)
+            throw std::runtime_error("ERROR: Could not write output file " + file.string() + ".");
+    }
+
+    // Wait until all output so far is written
+    void wait()
+    {
+        push();
+
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            buffer_written.wait(lock, [this] () { return num_written == num_queued; });
+        }
+
+        if (failed)
+            throw std::runtime_error("ERROR: Could not write output file " + file.string() + ".");
+    }
+
+    // Time the producing thread waited for the background thread because the queue was full
+    double stall_seconds() const
+    {
+        return stall_time.count();
+    }
+
+protected:
+    int_type overflow(int_type const c) override
+    {
+        push();
+
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        push();
+        return 0;
+    }
+
+private:
+    std::ostream & output;
+    std::filesystem::path file;
+    size_t buffer_size;
+    size_t max_buffers;
+
+    // Buffers are only filled up to their size, which is passed with them
+    std::vector<char> current{};
+    std::deque<std::pair<std::vector<char>, size_t> > queue{};
+    std::vector<std::vector<char> > free_buffers{};   // Written buffers that are reused
+
+    std::mutex mutex;
+    std::condition_variable buffer_queued;
+    std::condition_variable buffer_written;
+    bool closed = false;
+    bool failed = false;
+    uint64_t num_queued = 0;
+    uint64_t num_written = 0;
+    std::chrono::duration<double> stall_time{0};
+    std::thread writer;
+
+    // Pass the current buffer to the background thread and continue with an empty one
+    void push()
+    {
+        size_t const n = pptr() - pbase();
+        if (n == 0)
+            return;
+
+        if (!writer.joinable())
+            writer = std::thread{[this] () { run_writer(); }};
+
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+
+            if (queue.size() >= max_buffers)
+            {
+                auto start = std::chrono::steady_clock::now();
+                buffer_written.wait(lock, [this] () { return queue.size() < max_buffers; });
+                stall_time += std::chrono::steady_clock::now() - start;
+            }
+
+            queue.emplace_back(std::move(current), n);
+            num_queued++;
+
+            current.clear();
+            if (!free_buffers.empty())
+            {
+                current = std::move(free_buffers.back());
+                free_buffers.pop_back();
+            }
+        }
+        buffer_queued.notify_one();
+
+        next_buffer();
+    }
+
+    void next_buffer()
+    {
+        current.resize(buffer_size);
+        setp(current.data(), current.data() + current.size());
+    }
+
+    void run_writer()
+    {
+        while (true)
+        {
+            std::pair<std::vector<char>, size_t> buffer;
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                buffer_queued.wait(lock, [this] () { return closed || !queue.empty(); });
+
+                if (queue.empty())
+                    return;
+
+                buffer = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            // After a failed write the remaining output is dropped, the error is reported by finish
+            if (!failed)
+            {
+                output.write(buffer.first.data(), buffer.second);
+                if (!output)
+                    failed = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                free_buffers.push_back(std::move(buffer.first));
+                num_written++;
+            }
+            buffer_written.notify_one();
+        }
+    }
+};
@@ -0,0 +1,659 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Region restricted BAM access through BAI/CSI indexes
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <zlib.h>
+
+// Region on a reference sequence given by its name (0-based, half-open)
+struct named_region
+{
+    std::string chr;
+    uint64_t start;
+    uint64_t end;
+};
+
+// Interval on a reference sequence (0-based, half-open)
+struct genome_interval
+{
+    uint64_t start;
+    uint64_t end;
+};
+
+// Range of virtual file offsets (compressed block offset << 16 | offset within uncompressed block)
+struct bgzf_chunk
+{
+    uint64_t begin;
+    uint64_t end;
+};
+
+// Parse a region in samtools notation: 'chr', 'chr:start' or 'chr:start-end' (1-based, inclusive)
+inline named_region parse_region(std::string const & region)
+{
+    named_region result{region, 0, std::numeric_limits<uint64_t>::max()};
+
+    size_t colon = region.rfind(':');
+    if (colon == std::string::npos)
+        return result;
+
+    std::string coordinates = region.substr(colon + 1);
+    coordinates.erase(std::remove(coordinates.begin(), coordinates.end(), ','), coordinates.end());
+    result.chr = region.substr(0, colon);
+
+    try
+    {
+        size_t dash = coordinates.find('-');
+        uint64_t start = std::stoull(coordinates.substr(0, dash));
+        if (start == 0)
+            throw std::invalid_argument("start");
+        result.start = start - 1;
+
+        if (dash != std::string::npos)
+            result.end = std::stoull(coordinates.substr(dash + 1));
+    }
+    catch (std::logic_error const &)
+    {
+        throw std::runtime_error("Invalid region '" + region + "'. Expected format: chr:start-end.");
+    }
+
+    if (result.chr.empty() || result.end <= result.start)
+        throw std::runtime_error("Invalid region '" + region + "'. Expected format: chr:start-end.");
+
+    return result;
+}
+
+// Read target regions from a BED file
+inline std::vector<named_region> read_target_bed(std::filesystem::path const & bed_file)
+{
+    std::ifstream input_stream{bed_file};
+    if (!input_stream.is_open())
+        throw std::runtime_error("Could not open target file " + bed_file.string() + ".");
+
+    std::vector<named_region> targets;
+    std::string line;
+    while (std::getline(input_stream, line))
+    {
+        if (line.empty() || line[0] == '#' || line.rfind("track", 0) == 0 || line.rfind("browser", 0) == 0)
+            continue;
+
+        std::istringstream line_stream{line};
+        named_region target;
+        if (!(line_stream >> target.chr >> target.start >> target.end) || target.end < target.start)
+            throw std::runtime_error("Invalid line in target file " + bed_file.string() + ": " + line);
+
+        targets.push_back(std::move(target));
+    }
+
+    return targets;
+}
+
+// Sorted and merged target intervals per reference sequence
+class target_regions
+{
+public:
+    target_regions() = default;
+
+    target_regions(std::vector<named_region> const & regions, std::deque<std::string> const & ref_ids) :
+        intervals(ref_ids.size()),
+        is_active{true}
+    {
+        std::unordered_map<std::string, size_t> ref_id_map;
+        for (size_t i = 0; i < ref_ids.size(); i++)
+            ref_id_map[ref_ids[i]] = i;
+
+        size_t num_unknown = 0;
+        for (auto const & region : regions)
+        {
+            auto it = ref_id_map.find(region.chr);
+            if (it == ref_id_map.end())
+            {
+                num_unknown++;
+                continue;
+            }
+            if (region.end > region.start)
+                intervals[it->second].push_back(genome_interval{region.start, region.end});
+        }
+
+        if (num_unknown > 0)
+            std::cerr << "Warning: " << num_unknown << " target region(s) on sequences not present in the BAM file are ignored." << std::endl;
+
+        for (auto & ref_intervals : intervals)
+        {
+            std::sort(ref_intervals.begin(), ref_intervals.end(), [] (auto const & a, auto const & b)
+            {
+                return a.start < b.start;
+            });
+
+            std::vector<genome_interval> merged;
+            for (auto const & interval : ref_intervals)
+            {
+                if (!merged.empty() && interval.start <= merged.back().end)
+                    merged.back().end = std::max(merged.back().end, interval.end);
+                else
+                    merged.push_back(interval);
+            }
+            ref_intervals = std::move(merged);
+        }
+    }
+
+    // Whether reads should be restricted to the targets at all
+    bool active() const
+    {
+        return is_active;
+    }
+
+    // Check if [start, end) on a reference sequence overlaps any target
+    bool overlaps(size_t ref_id, uint64_t start, uint64_t end) const
+    {
+        if (!is_active)
+            return true;
+        if (ref_id >= intervals.size())
+            return false;
+
+        auto const & ref_intervals = intervals[ref_id];
+        auto it = std::partition_point(ref_intervals.begin(), ref_intervals.end(), [end] (auto const & interval)
+        {
+            return interval.start < end;
+        });
+
+        return it != ref_intervals.begin() && std::prev(it)->end > start;
+    }
+
+    std::vector<std::vector<genome_interval> > const & by_reference() const
+    {
+        return intervals;
+    }
+
+private:
+    std::vector<std::vector<genome_interval> > intervals;
+    bool is_active = false;
+};
+
+// Reader for BGZF compressed files with random access through virtual file offsets
+class bgzf_reader
+{
+public:
+    explicit bgzf_reader(std::filesystem::path const & path) :
+        file{path, std::ios::binary}
+    {
+        if (!file.is_open())
+            throw std::runtime_error("Could not open " + path.string() + ".");
+    }
+
+    // Move to a virtual file offset
+    void seek(uint64_t voffset)
+    {
+        if (voffset >> 16 != block_coffset || block.empty())
+            load_block(voffset >> 16);
+        block_pos = voffset & 0xFFFF;
+    }
+
+    // Current virtual file offset
+    uint64_t tell() const
+    {
+        return (block_coffset << 16) | block_pos;
+    }
+
+    // Make sure the current block has unread data, returns false at the end of the file
+    bool fill()
+    {
+        while (block_pos >= block.size())
+        {
+            if (at_eof)
+                return false;
+            load_block(next_coffset);
+        }
+        return true;
+    }
+
+    // Read exactly n bytes
+    void read(char * destination, size_t n)
+    {
+        while (n > 0)
+        {
+            if (!fill())
+                throw std::runtime_error("Unexpected end of BGZF file.");
+            size_t count = std::min(n, block.size() - block_pos);
+            std::memcpy(destination, block.data() + block_pos, count);
+            block_pos += count;
+            destination += count;
+            n -= count;
+        }
+    }
+
+    template <typename value_t>
+    value_t read()
+    {
+        value_t value;
+        read(reinterpret_cast<char *>(&value), sizeof(value_t));
+        return value;
+    }
+
+    // Access to the uncompressed data of the current block
+    char * block_data()
+    {
+        return block.data();
+    }
+
+    size_t block_size() const
+    {
+        return block.size();
+    }
+
+    size_t block_offset() const
+    {
+        return block_pos;
+    }
+
+    uint64_t block_address() const
+    {
+        return block_coffset;
+    }
+
+    void skip(size_t n)
+    {
+        block_pos += n;
+    }
+
+private:
+    // Read and inflate the block starting at the given compressed offset
+    void load_block(uint64_t coffset)
+    {
+        block.clear();
+        block_pos = 0;
+        block_coffset = coffset;
+        next_coffset = coffset;
+
+        file.clear();
+        file.seekg(coffset);
+
+        std::array<uint8_t, 18> header;
+        file.read(reinterpret_cast<char *>(header.data()), header.size());
+        if (file.gcount() == 0)
+        {
+            at_eof = true;
+            return;
+        }
+        at_eof = false;
+
+        if (file.gcount() != static_cast<std::streamsize>(header.size()) ||
+            header[0] != 31 || header[1] != 139 || header[2] != 8 || !(header[3] & 4) ||
+            header[12] != 'B' || header[13] != 'C')
+            throw std::runtime_error("Invalid BGZF block header.");
+
+        uint16_t extra_length = header[10] | (header[11] << 8);
+        uint32_t block_length = (header[16] | (header[17] << 8)) + 1;
+
+        compressed.resize(block_length);
+        std::memcpy(compressed.data(), header.data(), header.size());
+        file.read(reinterpret_cast<char *>(compressed.data()) + header.size(), block_length - header.size());
+        if (static_cast<size_t>(file.gcount()) != block_length - header.size())
+            throw std::runtime_error("Truncated BGZF block.");
+
+        uint32_t uncompressed_length;
+        std::memcpy(&uncompressed_length, compressed.data() + block_length - 4, 4);
+        block.resize(uncompressed_length);
+
+        z_stream zs{};
+        zs.next_in = compressed.data() + 12 + extra_length;
+        zs.avail_in = block_length - 12 - extra_length - 8;
+        zs.next_out = reinterpret_cast<Bytef *>(block.data());
+        zs.avail_out = uncompressed_length;
+
+        if (inflateInit2(&zs, -15) != Z_OK)
+            throw std::runtime_error("Could not initialise BGZF decompression.");
+        int status = inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+        if (status != Z_STREAM_END)
+            throw std::runtime_error("Could not decompress BGZF block.");
+
+        next_coffset = coffset + block_length;
+    }
+
+    std::ifstream file;
+    std::vector<uint8_t> compressed;
+    std::vector<char> block;
+    size_t block_pos = 0;
+    uint64_t block_coffset = 0;
+    uint64_t next_coffset = 0;
+    bool at_eof = false;
+};
+
+// Parse the BAM header to get the reference names and the virtual offset of the first record
+inline std::deque<std::string> read_bam_header(bgzf_reader & reader, uint64_t & header_end)
+{
+    reader.seek(0);
+
+    char magic[4];
+    reader.read(magic, 4);
+    if (std::memcmp(magic, "BAM\1", 4) != 0)
+        throw std::runtime_error("Invalid BAM file.");
+
+    std::string text(reader.read<int32_t>(), '\0');
+    reader.read(text.data(), text.size());
+
+    std::deque<std::string> ref_ids;
+    int32_t n_ref = reader.read<int32_t>();
+    for (int32_t i = 0; i < n_ref; i++)
+    {
+        std::string name(reader.read<int32_t>(), '\0');
+        reader.read(name.data(), name.size());
+        name.resize(std::strlen(name.c_str()));
+        reader.read<uint32_t>();
+        ref_ids.push_back(std::move(name));
+    }
+
+    header_end = reader.tell();
+    return ref_ids;
+}
+
+// Binning index of a BAM file (BAI or CSI)
+class bam_index
+{
+public:
+    // Look for an index next to the BAM file
+    static std::optional<std::filesystem::path> find(std::filesystem::path const & bam_file)
+    {
+        std::filesystem::path without_extension = bam_file;
+        without_extension.replace_extension();
+
+        for (auto const & candidate : {std::filesystem::path{bam_file.string() + ".bai"},
+                                       std::filesystem::path{without_extension.string() + ".bai"},
+                                       std::filesystem::path{bam_file.string() + ".csi"}})
+        {
+            if (std::filesystem::exists(candidate))
+                return candidate;
+        }
+
+        return std::nullopt;
+    }
+
+    explicit bam_index(std::filesystem::path const & index_file)
+    {
+        std::string data = read_index_file(index_file);
+        size_t pos = 0;
+
+        auto read_bytes = [&] (void * destination, size_t n)
+        {
+            if (pos + n > data.size())
+                throw std::runtime_error("Truncated index file " + index_file.string() + ".");
+            std::memcpy(destination, data.data() + pos, n);
+            pos += n;
+        };
+        auto read_int = [&] <typename value_t> (value_t)
+        {
+            value_t value;
+            read_bytes(&value, sizeof(value_t));
+            return value;
+        };
+
+        char magic[4];
+        read_bytes(magic, 4);
+
+        if (std::memcmp(magic, "BAI\1", 4) == 0)
+        {
+            is_csi = false;
+            min_shift = 14;
+            depth = 5;
+        }
+        else if (std::memcmp(magic, "CSI\1", 4) == 0)
+        {
+            is_csi = true;
+            min_shift = read_int(int32_t{});
+            depth = read_int(int32_t{});
+            pos += read_int(int32_t{});
+        }
+        else
+        {
+            throw std::runtime_error("Unknown index format of " + index_file.string() + ".");
+        }
+
+        // The pseudo-bin stores metadata and no alignments
+        uint32_t pseudo_bin = ((1u << (3 * depth + 3)) - 1) / 7 + 1;
+
+        references.resize(read_int(int32_t{}));
+        for (auto & reference : references)
+        {
+            int32_t n_bin = read_int(int32_t{});
+            for (int32_t i = 0; i < n_bin; i++)
+            {
+                uint32_t bin_id = read_int(uint32_t{});
+                uint64_t loffset = is_csi ? read_int(uint64_t{}) : 0;
+                std::vector<bgzf_chunk> chunks(read_int(int32_t{}));
+                for (auto & chunk : chunks)
+                {
+                    chunk.begin = read_int(uint64_t{});
+                    chunk.end = read_int(uint64_t{});
+                }
+                if (bin_id != pseudo_bin)
+                    reference.bins.emplace(bin_id, bin_content{loffset, std::move(chunks)});
+            }
+
+            if (!is_csi)
+            {
+                reference.linear.resize(read_int(int32_t{}));
+                for (auto & offset : reference.linear)
+                    offset = read_int(uint64_t{});
+            }
+        }
+    }
+
+    // Sorted and merged chunks that contain all reads overlapping [start, end) on a reference sequence
+    std::vector<bgzf_chunk> query(size_t ref_id, uint64_t start, uint64_t end) const
+    {
+        std::vector<bgzf_chunk> chunks;
+        if (ref_id >= references.size() || start >= end)
+            return chunks;
+
+        auto const & reference = references[ref_id];
+        uint64_t min_offset = minimal_offset(reference, start);
+
+        for (uint32_t bin_id : reg2bins(start, end))
+        {
+            auto it = reference.bins.find(bin_id);
+            if (it == reference.bins.end())
+                continue;
+            for (auto const & chunk : it->second.chunks)
+            {
+                if (chunk.end > min_offset)
+                    chunks.push_back(bgzf_chunk{std::max(chunk.begin, min_offset), chunk.end});
+            }
+        }
+
+        return merge_chunks(std::move(chunks));
+    }
+
+    // Sort chunks by offset and merge overlapping or adjacent ones
+    static std::vector<bgzf_chunk> merge_chunks(std::vector<bgzf_chunk> chunks)
+    {
+        std::sort(chunks.begin(), chunks.end(), [] (auto const & a, auto const & b)
+        {
+            return a.begin < b.begin;
+        });
+
+        std::vector<bgzf_chunk> merged;
+        for (auto const & chunk : chunks)
+        {
+            if (!merged.empty() && chunk.begin <= merged.back().end)
+                merged.back().end = std::max(merged.back().end, chunk.end);
+            else
+                merged.push_back(chunk);
+        }
+        return merged;
+    }
+
+    // All bins that may contain reads overlapping [start, end)
+    std::vector<uint32_t> reg2bins(uint64_t start, uint64_t end) const
+    {
+        std::vector<uint32_t> bins;
+        int shift = min_shift + depth * 3;
+        uint64_t max_end = uint64_t{1} << shift;
+        end = std::min(end, max_end) - 1;
+        if (start > end)
+            return bins;
+
+        uint32_t level_offset = 0;
+        for (int level = 0; level <= depth; level++)
+        {
+            for (uint64_t bin = level_offset + (start >> shift); bin <= level_offset + (end >> shift); bin++)
+                bins.push_back(bin);
+            level_offset += 1u << (level * 3);
+            shift -= 3;
+        }
+        return bins;
+    }
+
+private:
+    struct bin_content
+    {
+        uint64_t loffset;
+        std::vector<bgzf_chunk> chunks;
+    };
+
+    struct reference_index
+    {
+        std::unordered_map<uint32_t, bin_content> bins;
+        std::vector<uint64_t> linear;
+    };
+
+    // Smallest file offset at which reads overlapping start can begin
+    uint64_t minimal_offset(reference_index const & reference, uint64_t start) const
+    {
+        if (!is_csi)
+        {
+            if (reference.linear.empty())
+                return 0;
+            return reference.linear[std::min<uint64_t>(start >> min_shift, reference.linear.size() - 1)];
+        }
+
+        // Walk up from the leaf bin containing start until a bin with data is found
+        uint64_t bin = ((uint64_t{1} << (3 * depth)) - 1) / 7 + (start >> min_shift);
+        while (true)
+        {
+            auto it = reference.bins.find(bin);
+            if (it != reference.bins.end())
+                return it->second.loffset;
+            if (bin == 0)
+                return 0;
+            bin = (bin - 1) >> 3;
+        }
+    }
+
+    // BAI files are plain, CSI files are BGZF compressed
+    static std::string read_index_file(std::filesystem::path const & index_file)
+    {
+        std::ifstream input_stream{index_file, std::ios::binary};
+        if (!input_stream.is_open())
+            throw std::runtime_error("Could not open index file " + index_file.string() + ".");
+
+        std::string data((std::istreambuf_iterator<char>(input_stream)), std::istreambuf_iterator<char>());
+        if (data.size() < 2 || static_cast<uint8_t>(data[0]) != 31 || static_cast<uint8_t>(data[1]) != 139)
+            return data;
+
+        bgzf_reader reader{index_file};
+        std::string uncompressed;
+        while (reader.fill())
+        {
+            uncompressed.append(reader.block_data() + reader.block_offset(), reader.block_size() - reader.block_offset());
+            reader.skip(reader.block_size() - reader.block_offset());
+        }
+        return uncompressed;
+    }
+
+    std::vector<reference_index> references;
+    int min_shift = 14;
+    int depth = 5;
+    bool is_csi = false;
+};
+
+// Stream buffer that presents the BAM header followed by the given chunks as one uncompressed BAM stream
+class bgzf_region_streambuf : public std::streambuf
+{
+public:
+    bgzf_region_streambuf(std::filesystem::path const & bam_file, std::vector<bgzf_chunk> const & chunks) :
+        reader{bam_file}
+    {
+        uint64_t header_end;
+        read_bam_header(reader, header_end);
+
+        segments.push_back(bgzf_chunk{0, header_end});
+        for (auto const & chunk : chunks)
+        {
+            // Skip chunks that are part of the header or of an already selected chunk
+            if (chunk.end > segments.back().end)
+                segments.push_back(bgzf_chunk{std::max(chunk.begin, segments.back().end), chunk.end});
+        }
+
+        reader.seek(0);
+    }
+
+protected:
+    int_type underflow() override
+    {
+        while (current_segment < segments.size())
+        {
+            bgzf_chunk const & segment = segments[current_segment];
+
+            if (!reader.fill())
+                break;
+
+            if (reader.tell() >= segment.end)
+            {
+                if (++current_segment < segments.size())
+                    reader.seek(segments[current_segment].begin);
+                continue;
+            }
+
+            // Serve data up to the end of the block or the end of the segment
+            size_t available = reader.block_size() - reader.block_offset();
+            if (reader.block_address() == segment.end >> 16)
+                available = std::min<size_t>(available, (segment.end & 0xFFFF) - reader.block_offset());
+
+            char * begin = reader.block_data() + reader.block_offset();
+            setg(begin, begin, begin + available);
+            reader.skip(available);
+            return traits_type::to_int_type(*begin);
+        }
+
+        return traits_type::eof();
+    }
+
+private:
+    bgzf_reader reader;
+    std::vector<bgzf_chunk> segments;
+    size_t current_segment = 0;
+};
@@ -0,0 +1,174 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Processing of several samples with one reference genome
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "reference.hpp"
+
+// A BAM file of a sample sheet and the prefix of its output files
+struct batch_sample
+{
+    std::filesystem::path bam_file{};
+    std::string output_prefix{};
+};
+
+// Read a sample sheet with one sample per line: the BAM file and, separated by a tab, the prefix of its output files.
+// Without a prefix, the BAM file without its extension is used. Empty lines and lines starting with '#' are skipped.
+inline std::vector<batch_sample> read_sample_sheet(std::filesystem::path const & file)
+{
+    std::ifstream input{file};
+    if (!input.is_open())
+        throw std::runtime_error("ERROR: Could not open sample sheet " + file.string() + ".");
+
+    std::vector<batch_sample> samples;
+    std::set<std::string> prefixes;
+    std::string line;
+    for (size_t line_number = 1; std::getline(input, line); line_number++)
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line.front() == '#')
+            continue;
+
+        batch_sample sample{};
+        size_t const tab = line.find('\t');
+        sample.bam_file = line.substr(0, tab);
+        if (tab != std::string::npos)
+            sample.output_prefix = line.substr(tab + 1);
+        if (sample.output_prefix.empty())
+            sample.output_prefix = std::filesystem::path{sample.bam_file}.replace_extension().string();
+
+        if (sample.bam_file.empty() || sample.output_prefix.find('\t') != std::string::npos)
+            throw std::runtime_error("ERROR: Invalid line " + std::to_string(line_number) + " in sample sheet " + file.string() + ".");
+        if (!prefixes.insert(sample.output_prefix).second)
+            throw std::runtime_error("ERROR: Output prefix " + sample.output_prefix + " is used by several samples.");
+
+        samples.push_back(std::move(sample));
+    }
+
+    if (samples.empty())
+        throw std::runtime_error("ERROR: Sample sheet " + file.string() + " contains no samples.");
+
+    return samples;
+}
+
+// Memory needed by one sample for reading the BAM file and writing the outputs
+inline constexpr uint64_t batch_sample_base_memory = uint64_t{64} << 20;
+
+// Estimated memory of a sample. Counts of position sorted BAM files are written as soon as they are final, so only
+// those of the reads around the current position are kept. For all other BAM files, the counts of every CpG (20 bytes)
+// and 4-mer (64 bytes) of the genome may be kept until the end. Reads waiting for their mate and single read lines
+// waiting to be sorted depend on the reads and are not included.
+inline uint64_t estimate_sample_memory(bool const sorted,
+                                       bool const calc_pdr_score,
+                                       bool const calc_entropy_score,
+                                       uint64_t const num_genome_cpgs)
+{
+    uint64_t memory = batch_sample_base_memory;
+    if (!sorted)
+        memory += num_genome_cpgs * ((calc_pdr_score ? 20 : 0) + (calc_entropy_score ? 64 : 0));
+    return memory;
+}
+
+// Number of CpGs of all reference sequences. The CpG positions of every sequence are found (or taken from the binary
+// reference index) and freed again.
+inline uint64_t count_genome_cpgs(reference_genome & reference)
+{
+    uint64_t num_cpgs = 0;
+    for (size_t i = 0; i < reference.size(); i++)
+        num_cpgs += reference.cpg_positions(i)->size();
+    return num_cpgs;
+}
+
+// Process samples on num_jobs threads in the order of the sample sheet. A sample is only started while the estimated
+// memory of all running samples stays within memory_budget (0 for no limit), but at least one sample always runs.
+// process_sample returns whether the sample was processed successfully (and must not throw), the number of failed
+// samples is returned.
+template <typename process_fn_t>
+size_t process_samples(std::vector<batch_sample> const & samples,
+                       std::vector<uint64_t> const & estimated_memory,
+                       size_t const num_jobs,
+                       uint64_t const memory_budget,
+                       process_fn_t && process_sample)
+{
+    std::mutex mutex;
+    std::condition_variable sample_can_start;
+    size_t next_sample = 0;
+    size_t num_started = 0;
+    size_t num_running = 0;
+    uint64_t reserved_memory = 0;
+    size_t num_failed = 0;
+
+    auto run_jobs = [&] ()
+    {
+        while (true)
+        {
+            size_t sample;
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                if (next_sample == samples.size())
+                    return;
+
+                // Samples are started in order, the next one waits until enough memory is free
+                sample = next_sample++;
+                sample_can_start.wait(lock, [&] ()
+                {
+                    return sample == num_started &&
+                           (memory_budget == 0 || num_running == 0 || reserved_memory + estimated_memory[sample] <= memory_budget);
+                });
+                num_started++;
+                num_running++;
+                reserved_memory += estimated_memory[sample];
+            }
+            sample_can_start.notify_all();
+
+            bool const success = process_sample(sample);
+
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                num_running--;
+                reserved_memory -= estimated_memory[sample];
+                if (!success)
+                    num_failed++;
+            }
+            sample_can_start.notify_all();
+        }
+    };
+
+    std::vector<std::thread> jobs;
+    for (size_t i = 0; i < std::min(num_jobs, samples.size()); i++)
+        jobs.emplace_back(run_jobs);
+    for (auto & job : jobs)
+        job.join();
+
+    return num_failed;
+}
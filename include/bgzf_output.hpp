@@ -0,0 +1,584 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// BGZF compressed output and its tabix index
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <zlib.h>
+
+// Uncompressed size of a BGZF block, as used by bgzip
+inline constexpr size_t bgzf_block_size = 0xff00;
+
+// Tabix index of a BED file, built while the file is written. Lines are given with their offsets in the uncompressed
+// file, which are translated into virtual file offsets once the compressed offsets of all blocks are known.
+// Lines have to be sorted by position within every reference sequence, header lines starting with '#' are skipped.
+class tabix_index
+{
+public:
+    // Add a line without its newline, which starts at offset begin of the uncompressed file and ends at end
+    void add_line(std::string_view const line, uint64_t const begin, uint64_t const end)
+    {
+        if (line.empty() || line[0] == '#')
+            return;
+
+        size_t const chr_end = line.find('\t');
+        size_t const start_end = chr_end == std::string_view::npos ? chr_end : line.find('\t', chr_end + 1);
+        if (start_end == std::string_view::npos)
+            throw std::runtime_error("ERROR: Line without position can not be indexed: " + std::string{line});
+
+        size_t const end_end = std::min(line.find('\t', start_end + 1), line.size());
+        uint64_t start = 0;
+        uint64_t stop = 0;
+        std::from_chars(line.data() + chr_end + 1, line.data() + start_end, start);
+        std::from_chars(line.data() + start_end + 1, line.data() + end_end, stop);
+        stop = std::max(stop, start + 1);
+
+        std::string_view const name = line.substr(0, chr_end);
+        if (references.empty() || name != names.back())
+        {
+            if (ids.contains(std::string{name}))
+                throw std::runtime_error("ERROR: Output is not sorted by reference sequence and can not be indexed.");
+            ids.emplace(name, names.size());
+            names.emplace_back(name);
+            references.emplace_back();
+            last_start = 0;
+        }
+        else if (start < last_start)
+        {
+            throw std::runtime_error("ERROR: Output is not sorted by position and can not be indexed.");
+        }
+        last_start = start;
+        max_end = std::max(max_end, stop);
+
+        reference & ref = references.back();
+
+        // Consecutive lines of a bin are one chunk
+        std::vector<chunk> & chunks = ref.bins[reg2bin(start, stop, min_shift, max_depth)];
+        if (!chunks.empty() && chunks.back().end == begin)
+            chunks.back().end = end;
+        else
+            chunks.push_back(chunk{begin, end});
+
+        // Offset of the first line overlapping every window of 16 kbp
+        uint64_t const last_window = (stop - 1) >> min_shift;
+        if (ref.linear.size() <= last_window)
+            ref.linear.resize(last_window + 1, unset);
+        for (uint64_t window = start >> min_shift; window <= last_window; window++)
+            if (ref.linear[window] == unset)
+                ref.linear[window] = begin;
+    }
+
+    // Write the index as .tbi, or as .csi if a reference sequence is too long for a .tbi index. block_offsets
+    // contains the compressed offset of every block and of the end of the file. Returns the path of the index.
+    std::filesystem::path write(std::filesystem::path const & file, std::vector<uint64_t> const & block_offsets) const;
+
+private:
+    struct chunk
+    {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct reference
+    {
+        std::map<uint32_t, std::vector<chunk> > bins;
+        std::vector<uint64_t> linear;
+    };
+
+    static constexpr int min_shift = 14;
+    static constexpr int max_depth = 9;          // Bins are collected at the finest level of a CSI index of depth 9
+    static constexpr uint64_t unset = std::numeric_limits<uint64_t>::max();
+
+    std::vector<std::string> names;
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<reference> references;
+    uint64_t last_start = 0;
+    uint64_t max_end = 0;
+
+    // Bin of the region [begin, end) in a binning scheme with the given depth
+    static uint32_t reg2bin(uint64_t const begin, uint64_t end, int const shift, int const depth)
+    {
+        int s = shift;
+        uint64_t t = ((uint64_t{1} << (3 * depth)) - 1) / 7;
+        --end;
+        for (int level = depth; level > 0; --level, s += 3, t -= uint64_t{1} << (3 * level))
+            if (begin >> s == end >> s)
+                return t + (begin >> s);
+        return 0;
+    }
+
+    // Level and offset within the level of a bin
+    static std::pair<int, uint64_t> bin_level(uint32_t const bin)
+    {
+        int level = 0;
+        uint64_t first = 0;
+        while (bin >= first + (uint64_t{1} << (3 * level)))
+        {
+            first += uint64_t{1} << (3 * level);
+            level++;
+        }
+        return {level, bin - first};
+    }
+};
+
+// Stream buffer writing BGZF blocks to another stream. Blocks are compressed by num_threads threads in groups, the
+// compressed blocks are written in order. If an index is given, the lines written are added to it.
+class bgzf_output_buffer : public std::streambuf
+{
+public:
+    bgzf_output_buffer(std::ostream & output, size_t const num_threads = 1, tabix_index * index = nullptr) :
+        output{output},
+        index{index},
+        blocks(4 * std::max<size_t>(num_threads, 1))
+    {
+        for (auto & block : blocks)
+            block.data.resize(bgzf_block_size);
+        setp(blocks[0].data.data(), blocks[0].data.data() + bgzf_block_size);
+
+        for (size_t i = 1; i < num_threads; i++)
+            workers.emplace_back([this] () { run_worker(); });
+    }
+
+    bgzf_output_buffer(bgzf_output_buffer const &) = delete;
+    bgzf_output_buffer & operator=(bgzf_output_buffer const &) = delete;
+
+    ~bgzf_output_buffer()
+    {
+        stop_workers();
+    }
+
+    // Write all remaining data and the end of file marker. Returns the compressed offsets of all blocks and of the
+    // end of the data (before the end of file marker).
+    std::vector<uint64_t> finish()
+    {
+        rethrow_error();
+        finish_block();
+        compress_blocks();
+        stop_workers();
+
+        static constexpr std::array<uint8_t, 28> eof_marker{0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43,
+                                                            0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        output.write(reinterpret_cast<char const *>(eof_marker.data()), eof_marker.size());
+
+        block_offsets.push_back(compressed_size);
+        return std::move(block_offsets);
+    }
+
+    // Rethrow an error that occurred while data was written through the stream, which only sees a failed write
+    void rethrow_error() const
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+protected:
+    int_type overflow(int_type const c) override
+    {
+        if (error)
+            return traits_type::eof();
+
+        try
+        {
+            finish_block();
+            if (current == blocks.size())
+                compress_blocks();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+            return traits_type::eof();
+        }
+
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+
+        return traits_type::not_eof(c);
+    }
+
+private:
+    struct block
+    {
+        std::vector<char> data;
+        size_t size = 0;
+        std::vector<char> compressed;
+    };
+
+    std::ostream & output;
+    tabix_index * index;
+
+    // Filled blocks waiting to be compressed, the block at current is being filled
+    std::vector<block> blocks;
+    size_t current = 0;
+
+    std::vector<uint64_t> block_offsets;
+    uint64_t compressed_size = 0;
+    uint64_t uncompressed_size = 0;
+
+    // Line that started in an earlier block and its offset in the uncompressed file
+    std::string line;
+    uint64_t line_begin = 0;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    uint64_t group = 0;
+    size_t num_blocks = 0;
+    size_t next_block = 0;
+    size_t blocks_done = 0;
+    bool stopped = false;
+    bool failed = false;
+    std::exception_ptr error{};
+
+    // Close the block being filled and continue with the next one
+    void finish_block()
+    {
+        block & filled = blocks[current];
+        filled.size = pptr() - pbase();
+        if (filled.size == 0)
+            return;
+
+        if (index)
+            index_lines(filled);
+        uncompressed_size += filled.size;
+
+        current++;
+        if (current < blocks.size())
+            setp(blocks[current].data.data(), blocks[current].data.data() + bgzf_block_size);
+        else
+            setp(nullptr, nullptr);
+    }
+
+    void index_lines(block const & filled)
+    {
+        std::string_view text{filled.data.data(), filled.size};
+        uint64_t offset = uncompressed_size;
+
+        for (size_t newline = text.find('\n'); newline != std::string_view::npos; newline = text.find('\n'))
+        {
+            uint64_t const end = offset + newline + 1;
+            if (line.empty())
+            {
+                index->add_line(text.substr(0, newline), offset, end);
+            }
+            else
+            {
+                line.append(text.substr(0, newline));
+                index->add_line(line, line_begin, end);
+                line.clear();
+            }
+
+            text.remove_prefix(newline + 1);
+            offset = end;
+        }
+
+        if (!text.empty())
+        {
+            if (line.empty())
+                line_begin = offset;
+            line.append(text);
+        }
+    }
+
+    // Compress the filled blocks in parallel and write them in order
+    void compress_blocks()
+    {
+        if (current == 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            num_blocks = current;
+            next_block = 0;
+            blocks_done = 0;
+            group++;
+        }
+        work_available.notify_all();
+
+        compress_group();
+
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            work_done.wait(lock, [this] () { return blocks_done == num_blocks; });
+            if (failed)
+                throw std::runtime_error("ERROR: Could not compress output.");
+        }
+
+        for (size_t i = 0; i < current; i++)
+        {
+            block_offsets.push_back(compressed_size);
+            output.write(blocks[i].compressed.data(), blocks[i].compressed.size());
+            compressed_size += blocks[i].compressed.size();
+        }
+
+        current = 0;
+        setp(blocks[0].data.data(), blocks[0].data.data() + bgzf_block_size);
+    }
+
+    // Compress blocks of the current group until none is left. Blocks are taken under the lock, so a thread still
+    // busy with an earlier group can not take a block twice.
+    void compress_group()
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+
+        while (next_block < num_blocks)
+        {
+            size_t const i = next_block++;
+            lock.unlock();
+            bool const compressed = compress(blocks[i]);
+            lock.lock();
+
+            failed |= !compressed;
+            if (++blocks_done == num_blocks)
+                work_done.notify_all();
+        }
+    }
+
+    void run_worker()
+    {
+        uint64_t last_group = 0;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                work_available.wait(lock, [&] () { return stopped || group != last_group; });
+                if (stopped)
+                    return;
+                last_group = group;
+            }
+
+            compress_group();
+        }
+    }
+
+    void stop_workers()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stopped = true;
+        }
+        work_available.notify_all();
+
+        for (auto & worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    // Compress a block into a BGZF block with gzip header, raw deflate data, CRC32 and uncompressed size
+    static bool compress(block & b)
+    {
+        static constexpr size_t header_size = 18;
+        static constexpr size_t footer_size = 8;
+
+        b.compressed.resize(header_size + compressBound(b.size) + footer_size);
+
+        z_stream zs{};
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+
+        zs.next_in = reinterpret_cast<Bytef *>(b.data.data());
+        zs.avail_in = b.size;
+        zs.next_out = reinterpret_cast<Bytef *>(b.compressed.data() + header_size);
+        zs.avail_out = b.compressed.size() - header_size - footer_size;
+
+        int status = deflate(&zs, Z_FINISH);
+        size_t const deflated_size = zs.total_out;
+        deflateEnd(&zs);
+        if (status != Z_STREAM_END)
+            return false;
+
+        size_t const total_size = header_size + deflated_size + footer_size;
+        b.compressed.resize(total_size);
+
+        std::array<uint8_t, header_size> const header{0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0,
+                                                      static_cast<uint8_t>((total_size - 1) & 0xff),
+                                                      static_cast<uint8_t>((total_size - 1) >> 8)};
+        std::memcpy(b.compressed.data(), header.data(), header_size);
+
+        uint32_t const crc = crc32(crc32(0, nullptr, 0), reinterpret_cast<Bytef const *>(b.data.data()), b.size);
+        uint32_t const size = b.size;
+        char * footer = b.compressed.data() + header_size + deflated_size;
+        for (size_t i = 0; i < 4; i++)
+        {
+            footer[i] = static_cast<char>((crc >> (8 * i)) & 0xff);
+            footer[4 + i] = static_cast<char>((size >> (8 * i)) & 0xff);
+        }
+
+        return true;
+    }
+};
+
+inline std::filesystem::path tabix_index::write(std::filesystem::path const & file, std::vector<uint64_t> const & block_offsets) const
+{
+    // Translate an offset in the uncompressed file into a virtual file offset
+    auto virtual_offset = [&] (uint64_t const offset)
+    {
+        return (block_offsets[offset / bgzf_block_size] << 16) | (offset % bgzf_block_size);
+    };
+
+    // Sequences of up to 2^29 bp fit into a .tbi index with its fixed depth of 5
+    bool const csi = max_end > (uint64_t{1} << 29);
+    int depth = 5;
+    while (csi && (uint64_t{1} << (min_shift + 3 * depth)) < max_end)
+        depth++;
+
+    std::filesystem::path index_file = file.string() + (csi ? ".csi" : ".tbi");
+    std::ofstream index_stream{index_file, std::ios::binary};
+    if (!index_stream.is_open())
+        throw std::runtime_error("ERROR: Could not open index file " + index_file.string() + ".");
+
+    {
+        bgzf_output_buffer compressed{index_stream};
+        std::ostream stream{&compressed};
+
+        auto write_int = [&] <typename value_t> (value_t const value)
+        {
+            stream.write(reinterpret_cast<char const *>(&value), sizeof(value_t));
+        };
+
+        // Tabix settings of BED files: 0-based coordinates in columns 1-3, header lines start with '#'
+        std::string names_data;
+        for (auto const & name : names)
+            names_data.append(name).push_back('\0');
+
+        auto write_settings = [&] ()
+        {
+            write_int(int32_t{0x10000});
+            write_int(int32_t{1});
+            write_int(int32_t{2});
+            write_int(int32_t{3});
+            write_int(int32_t{'#'});
+            write_int(int32_t{0});
+            write_int(static_cast<int32_t>(names_data.size()));
+            stream.write(names_data.data(), names_data.size());
+        };
+
+        if (csi)
+        {
+            stream.write("CSI\1", 4);
+            write_int(int32_t{min_shift});
+            write_int(static_cast<int32_t>(depth));
+            write_int(static_cast<int32_t>(7 * sizeof(int32_t) + names_data.size()));
+            write_settings();
+        }
+        else
+        {
+            stream.write("TBI\1", 4);
+            write_int(static_cast<int32_t>(names.size()));
+            write_settings();
+        }
+
+        if (csi)
+            write_int(static_cast<int32_t>(names.size()));
+
+        for (reference const & ref : references)
+        {
+            // Linear index with the offsets of windows without lines taken from the previous window
+            std::vector<uint64_t> linear(ref.linear.size());
+            uint64_t previous = 0;
+            for (size_t i = 0; i < ref.linear.size(); i++)
+            {
+                if (ref.linear[i] != unset)
+                    previous = virtual_offset(ref.linear[i]);
+                linear[i] = previous;
+            }
+
+            // Bins of the finest level are moved to their bin in the binning scheme of the index
+            std::map<uint32_t, std::vector<std::pair<uint64_t, uint64_t> > > bins;
+            for (auto const & [bin, chunks] : ref.bins)
+            {
+                // Levels above the first level of the index are collected in its root bin
+                auto [level, position] = bin_level(bin);
+                int const index_level = level - (max_depth - depth);
+                uint32_t const index_bin = index_level <= 0 ? 0 : ((uint64_t{1} << (3 * index_level)) - 1) / 7 + position;
+
+                for (chunk const & c : chunks)
+                    bins[index_bin].emplace_back(virtual_offset(c.begin), virtual_offset(c.end));
+            }
+
+            write_int(static_cast<int32_t>(bins.size()));
+            for (auto & [bin, chunks] : bins)
+            {
+                // Chunks that end in the block in which the next one starts are merged
+                std::sort(chunks.begin(), chunks.end());
+                std::vector<std::pair<uint64_t, uint64_t> > merged;
+                for (auto const & c : chunks)
+                {
+                    if (!merged.empty() && merged.back().second >> 16 >= c.first >> 16)
+                        merged.back().second = std::max(merged.back().second, c.second);
+                    else
+                        merged.push_back(c);
+                }
+
+                write_int(bin);
+                if (csi)
+                {
+                    auto [level, position] = bin_level(bin);
+                    uint64_t const window = position << (3 * (depth - level));
+                    write_int(window < linear.size() ? linear[window] : merged.front().first);
+                }
+                write_int(static_cast<int32_t>(merged.size()));
+                for (auto const & [begin, end] : merged)
+                {
+                    write_int(begin);
+                    write_int(end);
+                }
+            }
+
+            if (!csi)
+            {
+                write_int(static_cast<int32_t>(linear.size()));
+                for (uint64_t const offset : linear)
+                    write_int(offset);
+            }
+        }
+
+        compressed.finish();
+    }
+
+    if (!index_stream)
+        throw std::runtime_error("ERROR: Could not write index file " + index_file.string() + ".");
+
+    return index_file;
+}
@@ -0,0 +1,212 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Checkpoints of a run, from which an interrupted run continues
+// ==========================================================================
+
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "counts.hpp"
+#include "data_structures.hpp"
+#include "mate_buffer.hpp"
+#include "reference.hpp"
+
+// A checkpoint starts with the magic string and the options of the run that wrote it, followed by the position of
+// the first read that was not processed, the size of every output file at that point, the stored mates and the
+// counts that were not written yet.
+inline constexpr std::string_view checkpoint_magic{"RLMK\1", 5};
+
+// Sizes of the 'single_read', 'pdr' and 'entropy' outputs, the epiallele cache and the partial counts are stored
+inline constexpr size_t num_checkpoint_outputs = 5;
+
+// Writes values to a checkpoint: trivially copyable values as they are in memory, strings and vectors with their size
+class checkpoint_output
+{
+public:
+    explicit checkpoint_output(std::ostream & stream) : stream{stream}
+    {}
+
+    template <typename value_t>
+    void write(value_t const & value)
+    {
+        static_assert(std::is_trivially_copyable_v<value_t>);
+        stream.write(reinterpret_cast<char const *>(&value), sizeof(value_t));
+    }
+
+    void write(std::string const & value)
+    {
+        write(static_cast<uint64_t>(value.size()));
+        stream.write(value.data(), value.size());
+    }
+
+    template <typename value_t>
+    void write(std::vector<value_t> const & values)
+    {
+        static_assert(std::is_trivially_copyable_v<value_t>);
+        write(static_cast<uint64_t>(values.size()));
+        stream.write(reinterpret_cast<char const *>(values.data()), values.size() * sizeof(value_t));
+    }
+
+private:
+    std::ostream & stream;
+};
+
+// Reads the values written by checkpoint_output
+class checkpoint_input
+{
+public:
+    explicit checkpoint_input(std::istream & stream) : stream{stream}
+    {}
+
+    template <typename value_t>
+    void read(value_t & value)
+    {
+        static_assert(std::is_trivially_copyable_v<value_t>);
+        read_bytes(&value, sizeof(value_t));
+    }
+
+    void read(std::string & value)
+    {
+        value.resize(checked_size(read<uint64_t>()));
+        read_bytes(value.data(), value.size());
+    }
+
+    template <typename value_t>
+    void read(std::vector<value_t> & values)
+    {
+        static_assert(std::is_trivially_copyable_v<value_t>);
+        values.resize(checked_size(read<uint64_t>()));
+        read_bytes(values.data(), values.size() * sizeof(value_t));
+    }
+
+    template <typename value_t>
+    value_t read()
+    {
+        value_t value{};
+        read(value);
+        return value;
+    }
+
+private:
+    std::istream & stream;
+
+    void read_bytes(void * destination, size_t const n)
+    {
+        if (!stream.read(static_cast<char *>(destination), n))
+            throw std::runtime_error("ERROR: The checkpoint is truncated.");
+    }
+
+    // Sizes that can not be allocated are only found in a corrupt checkpoint
+    size_t checked_size(uint64_t const size) const
+    {
+        if (size > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("ERROR: The checkpoint is corrupt.");
+        return size;
+    }
+};
+
+// State of a run at a checkpoint
+struct checkpoint
+{
+    GenomePosition read_position{};                 // Position of the first read that was not processed
+    std::vector<std::streamoff> output_sizes{};     // Size of every output file
+    mate_buffer mates{};
+    cpg_counts_t all_CpGs{};
+    kmer_counts_t all_kmers{};
+};
+
+// Write a checkpoint of a run with the given options. It is written to a temporary file first, so an interruption
+// while it is written leaves the previous checkpoint intact.
+inline void write_checkpoint(std::filesystem::path const & file,
+                             std::string const & options,
+                             GenomePosition const & read_position,
+                             std::vector<std::streamoff> const & output_sizes,
+                             mate_buffer const & mates,
+                             cpg_counts_t const & all_CpGs,
+                             kmer_counts_t const & all_kmers)
+{
+    std::filesystem::path temporary_file = file.string() + ".tmp";
+    {
+        std::ofstream stream{temporary_file, std::ios::binary};
+        checkpoint_output output{stream};
+
+        stream.write(checkpoint_magic.data(), checkpoint_magic.size());
+        output.write(options);
+        output.write(read_position.ref_id);
+        output.write(read_position.start);
+        output.write(output_sizes);
+        mates.save(output);
+        all_CpGs.save(output);
+        all_kmers.save(output);
+
+        stream.close();
+        if (stream.fail())
+            throw std::runtime_error("ERROR: Could not write checkpoint " + temporary_file.string() + ".");
+    }
+
+    std::filesystem::rename(temporary_file, file);
+}
+
+// Read a checkpoint, which must have been written by a run with the same options
+inline checkpoint read_checkpoint(std::filesystem::path const & file,
+                                  std::string const & options,
+                                  reference_genome & reference,
+                                  bool const collated)
+{
+    std::ifstream stream{file, std::ios::binary};
+    if (!stream.is_open())
+        throw std::runtime_error("ERROR: Could not open checkpoint " + file.string() + ".");
+    checkpoint_input input{stream};
+
+    std::string magic(checkpoint_magic.size(), '\0');
+    stream.read(magic.data(), magic.size());
+    if (magic != checkpoint_magic)
+        throw std::runtime_error("ERROR: " + file.string() + " is not a checkpoint of this version of RLM.");
+
+    if (input.read<std::string>() != options)
+        throw std::runtime_error("ERROR: The checkpoint " + file.string() + " was written by a run with another BAM file or other options.");
+
+    checkpoint state{};
+    state.read_position.ref_id = input.read<uint16_t>();
+    state.read_position.start = input.read<uint64_t>();
+    input.read(state.output_sizes);
+
+    state.mates = mate_buffer{false, collated};
+    state.mates.load(input);
+
+    auto get_cpgs = [&] (size_t const ref_id)
+    {
+        if (ref_id >= reference.size())
+            throw std::runtime_error("ERROR: The checkpoint is corrupt.");
+        return reference.cpg_positions(ref_id);
+    };
+    state.all_CpGs.load(input, get_cpgs);
+    state.all_kmers.load(input, get_cpgs);
+
+    return state;
+}
@@ -0,0 +1,479 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Binary columnar format of the single read output
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+#include "bam_index.hpp"
+#include "output.hpp"
+#include "text_writer.hpp"
+
+// The columnar single read file (.rlmc) starts with the magic string and the names of the reference sequences.
+// Reads follow in blocks of up to columnar_block_size reads. Every column of a block is compressed on its own:
+//   contig id (2 bytes), start (difference to the previous read), length, n_CpGs, n_CpGs_methyl (all as varints),
+//   the methylation patterns (one bit per CpG, the patterns of all reads one after another) and the read names.
+// The file ends with the block index, which holds the offset and the first and last position of every block, its
+// offset and the magic string. All numbers are stored in little endian byte order.
+inline constexpr std::string_view columnar_magic{"RLMC\1", 5};
+inline constexpr size_t columnar_block_size = 1 << 16;
+inline constexpr size_t columnar_num_columns = 7;
+
+inline bool is_columnar_file(std::filesystem::path const & file)
+{
+    return file.extension() == ".rlmc";
+}
+
+// Number stored with 7 bits per byte, the highest bit marks that more bytes follow
+inline void write_varint(std::string & output, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        output.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+inline uint64_t read_varint(std::string_view const input, size_t & pos)
+{
+    uint64_t value = 0;
+    for (int shift = 0; pos < input.size() && shift < 64; shift += 7)
+    {
+        uint8_t const byte = input[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    throw std::runtime_error("ERROR: Corrupt number in binary file.");
+}
+
+template <typename value_t>
+void write_value(std::ostream & output, value_t const value)
+{
+    output.write(reinterpret_cast<char const *>(&value), sizeof(value_t));
+}
+
+// Position range covered by the reads of a block, used to skip blocks outside of a region
+struct columnar_block_info
+{
+    uint64_t offset;
+    uint32_t num_reads;
+    GenomePosition first;   // Smallest start of the reads in the block
+    GenomePosition last;    // Largest end of the reads in the block
+};
+
+// Stream buffer that receives the text lines of the single read output and writes them in the columnar format. Only
+// the fields needed to restore the lines are stored, the scores are calculated again from the patterns.
+class columnar_output_buffer : public std::streambuf
+{
+public:
+    columnar_output_buffer(std::ostream & output_stream, std::deque<std::string> const & ref_ids) :
+        output_stream{output_stream}
+    {
+        for (size_t i = 0; i < ref_ids.size(); i++)
+            ref_id_map.emplace(ref_ids[i], i);
+
+        output_stream.write(columnar_magic.data(), columnar_magic.size());
+        write_value(output_stream, static_cast<uint32_t>(ref_ids.size()));
+        for (auto const & name : ref_ids)
+        {
+            write_value(output_stream, static_cast<uint32_t>(name.size()));
+            output_stream.write(name.data(), name.size());
+        }
+        offset = header_size(ref_ids);
+    }
+
+    columnar_output_buffer(columnar_output_buffer const &) = delete;
+    columnar_output_buffer & operator=(columnar_output_buffer const &) = delete;
+
+    // Write the last block and the block index
+    void finish()
+    {
+        if (!current.empty())
+            throw std::runtime_error("ERROR: Incomplete line in the single read output: " + current);
+        write_block();
+
+        uint64_t const index_offset = offset;
+        for (columnar_block_info const & block : blocks)
+        {
+            write_value(output_stream, block.offset);
+            write_value(output_stream, block.num_reads);
+            write_value(output_stream, block.first.ref_id);
+            write_value(output_stream, block.first.start);
+            write_value(output_stream, block.last.ref_id);
+            write_value(output_stream, block.last.start);
+        }
+        write_value(output_stream, static_cast<uint64_t>(blocks.size()));
+        write_value(output_stream, index_offset);
+        output_stream.write(columnar_magic.data(), columnar_magic.size());
+    }
+
+protected:
+    int_type overflow(int_type const c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+
+        char const ch = traits_type::to_char_type(c);
+        if (ch == '\n')
+        {
+            add_line(current);
+            current.clear();
+        }
+        else
+        {
+            current.push_back(ch);
+        }
+        return c;
+    }
+
+    std::streamsize xsputn(char const * s, std::streamsize const n) override
+    {
+        std::string_view text{s, static_cast<size_t>(n)};
+        for (size_t newline = text.find('\n'); newline != std::string_view::npos; newline = text.find('\n'))
+        {
+            if (current.empty())
+            {
+                add_line(text.substr(0, newline));
+            }
+            else
+            {
+                current.append(text.substr(0, newline));
+                add_line(current);
+                current.clear();
+            }
+            text.remove_prefix(newline + 1);
+        }
+        current.append(text);
+        return n;
+    }
+
+private:
+    std::ostream & output_stream;
+    std::map<std::string, uint16_t, std::less<> > ref_id_map;
+    std::string current;
+    uint64_t offset;        // Offset in the file of the next block, the stream may not report its position
+
+    // Columns of the current block
+    uint32_t num_reads = 0;
+    std::array<std::string, columnar_num_columns> columns{};
+    uint64_t pattern_bits = 0;
+    uint64_t last_start = 0;
+    GenomePosition first{};
+    GenomePosition last{};
+
+    std::vector<columnar_block_info> blocks;
+    std::string compressed;
+
+    static uint64_t header_size(std::deque<std::string> const & ref_ids)
+    {
+        uint64_t size = columnar_magic.size() + sizeof(uint32_t);
+        for (auto const & name : ref_ids)
+            size += sizeof(uint32_t) + name.size();
+        return size;
+    }
+
+    // Lines start with the reference sequence, start, end, name, pattern, number of CpGs and of methylated CpGs
+    void add_line(std::string_view const line)
+    {
+        if (line.empty() || line[0] == '#')
+            return;
+
+        std::array<std::string_view, 7> fields;
+        size_t begin = 0;
+        for (size_t i = 0; i < fields.size(); i++)
+        {
+            size_t end = line.find('\t', begin);
+            if (end == std::string_view::npos && i + 1 < fields.size())
+                throw std::runtime_error("ERROR: Unexpected line in the single read output: " + std::string{line});
+            fields[i] = line.substr(begin, end - begin);
+            begin = end + 1;
+        }
+
+        auto unexpected_line = [&] ()
+        {
+            return std::runtime_error("ERROR: Unexpected line in the single read output: " + std::string{line});
+        };
+
+        auto ref_id = ref_id_map.find(fields[0]);
+        if (ref_id == ref_id_map.end())
+            throw unexpected_line();
+
+        // Numbers must fill their whole field
+        auto parse_number = [&] (std::string_view const field)
+        {
+            uint64_t number = 0;
+            auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), number);
+            if (field.empty() || ec != std::errc{} || ptr != field.data() + field.size())
+                throw unexpected_line();
+            return number;
+        };
+
+        uint64_t const start = parse_number(fields[1]);
+        uint64_t const end = parse_number(fields[2]);
+        uint64_t const num_cpgs = parse_number(fields[5]);
+        uint64_t const num_methyl_cpgs = parse_number(fields[6]);
+        if (end < start || fields[4].size() != num_cpgs ||
+            fields[4].find_first_not_of("gG") != std::string_view::npos)
+            throw unexpected_line();
+
+        GenomePosition const read_start{ref_id->second, start};
+        GenomePosition const read_end{ref_id->second, end};
+        if (num_reads == 0 || read_start < first)
+            first = read_start;
+        if (num_reads == 0 || last < read_end)
+            last = read_end;
+
+        // Starts are stored as the difference to the previous start (zigzag encoded, as the output may be unsorted)
+        int64_t const difference = static_cast<int64_t>(start - last_start);
+        write_varint(columns[1], (static_cast<uint64_t>(difference) << 1) ^ static_cast<uint64_t>(difference >> 63));
+        last_start = start;
+
+        columns[0].append(reinterpret_cast<char const *>(&ref_id->second), sizeof(uint16_t));
+        write_varint(columns[2], end - start);
+        write_varint(columns[3], num_cpgs);
+        write_varint(columns[4], num_methyl_cpgs);
+
+        // Bits of all patterns one after another, CpG i of the pattern in bit i
+        std::string & patterns = columns[5];
+        for (char const c : fields[4])
+        {
+            if (pattern_bits % 8 == 0)
+                patterns.push_back(0);
+            if (c == 'G')
+                patterns.back() |= static_cast<char>(1 << (pattern_bits % 8));
+            pattern_bits++;
+        }
+
+        columns[6].append(fields[3]).push_back('\0');
+
+        if (++num_reads == columnar_block_size)
+            write_block();
+    }
+
+    void write_block()
+    {
+        if (num_reads == 0)
+            return;
+
+        blocks.push_back(columnar_block_info{offset, num_reads, first, last});
+
+        write_value(output_stream, num_reads);
+        offset += sizeof(uint32_t);
+
+        std::string block_data;
+        for (std::string & column : columns)
+        {
+            compressed.resize(compressBound(column.size()));
+            uLongf compressed_size = compressed.size();
+            if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressed_size,
+                          reinterpret_cast<Bytef const *>(column.data()), column.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+                throw std::runtime_error("ERROR: Could not compress the single read output.");
+
+            write_value(output_stream, static_cast<uint32_t>(column.size()));
+            write_value(output_stream, static_cast<uint32_t>(compressed_size));
+            block_data.append(compressed.data(), compressed_size);
+            column.clear();
+        }
+        output_stream.write(block_data.data(), block_data.size());
+        offset += columnar_num_columns * 2 * sizeof(uint32_t) + block_data.size();
+
+        num_reads = 0;
+        pattern_bits = 0;
+        last_start = 0;
+    }
+};
+
+// Reader of a columnar single read file that writes its reads as lines of the single read output
+class columnar_reader
+{
+public:
+    explicit columnar_reader(std::filesystem::path const & file) :
+        file{file},
+        input{file, std::ios::binary}
+    {
+        if (!input.is_open())
+            throw std::runtime_error("ERROR: Could not open " + file.string() + ".");
+
+        std::string magic(columnar_magic.size(), '\0');
+        input.read(magic.data(), magic.size());
+        if (magic != columnar_magic)
+            throw std::runtime_error("ERROR: " + file.string() + " is not a columnar single read file.");
+
+        uint32_t const num_refs = read_value<uint32_t>();
+        for (uint32_t i = 0; i < num_refs; i++)
+        {
+            std::string name(read_value<uint32_t>(), '\0');
+            input.read(name.data(), name.size());
+            ref_ids.push_back(std::move(name));
+        }
+
+        // Block index at the end of the file
+        input.seekg(-static_cast<std::streamoff>(2 * sizeof(uint64_t) + columnar_magic.size()), std::ios::end);
+        uint64_t const num_blocks = read_value<uint64_t>();
+        uint64_t const index_offset = read_value<uint64_t>();
+        input.read(magic.data(), magic.size());
+        if (!input || magic != columnar_magic)
+            throw std::runtime_error("ERROR: " + file.string() + " is truncated.");
+
+        input.seekg(index_offset);
+        for (uint64_t i = 0; i < num_blocks; i++)
+        {
+            columnar_block_info block{};
+            block.offset = read_value<uint64_t>();
+            block.num_reads = read_value<uint32_t>();
+            block.first.ref_id = read_value<uint16_t>();
+            block.first.start = read_value<uint64_t>();
+            block.last.ref_id = read_value<uint16_t>();
+            block.last.start = read_value<uint64_t>();
+            blocks.push_back(block);
+        }
+        if (!input)
+            throw std::runtime_error("ERROR: " + file.string() + " is truncated.");
+    }
+
+    std::deque<std::string> const & references() const
+    {
+        return ref_ids;
+    }
+
+    // Write the reads as lines of the single read output. If a region is given, only blocks that may contain reads
+    // overlapping it are read and only the overlapping reads are written.
+    void view(text_writer & output_stream, std::optional<named_region> const & region = std::nullopt)
+    {
+        std::optional<uint16_t> region_id{};
+        if (region)
+        {
+            auto it = std::find(ref_ids.begin(), ref_ids.end(), region->chr);
+            if (it == ref_ids.end())
+                throw std::runtime_error("ERROR: Reference sequence " + region->chr + " not found in " + file.string() + ".");
+            region_id = it - ref_ids.begin();
+        }
+
+        methylation_pattern pattern;
+        for (columnar_block_info const & block : blocks)
+        {
+            if (region && !(block.first < GenomePosition{region_id.value(), region->end} &&
+                            GenomePosition{region_id.value(), region->start} < block.last))
+                continue;
+
+            read_block(block);
+
+            std::string_view const contigs{columns[0]};
+            size_t start_pos = 0;
+            size_t length_pos = 0;
+            size_t cpgs_pos = 0;
+            size_t methyl_pos = 0;
+            size_t name_pos = 0;
+            uint64_t pattern_bit = 0;
+            uint64_t start = 0;
+
+            for (uint32_t i = 0; i < block.num_reads; i++)
+            {
+                uint16_t ref_id;
+                std::memcpy(&ref_id, contigs.data() + i * sizeof(uint16_t), sizeof(uint16_t));
+                uint64_t const difference = read_varint(columns[1], start_pos);
+                start += (difference >> 1) ^ (~(difference & 1) + 1);
+                uint64_t const end = start + read_varint(columns[2], length_pos);
+                uint64_t const num_cpgs = read_varint(columns[3], cpgs_pos);
+                read_varint(columns[4], methyl_pos);
+
+                size_t const name_end = columns[6].find('\0', name_pos);
+                std::string_view const name = std::string_view{columns[6]}.substr(name_pos, name_end - name_pos);
+                name_pos = name_end + 1;
+
+                pattern.size = num_cpgs;
+                pattern.bits.assign((num_cpgs + 63) / 64, 0);
+                for (uint64_t j = 0; j < num_cpgs; j++, pattern_bit++)
+                    if ((columns[5][pattern_bit / 8] >> (pattern_bit % 8)) & 1)
+                        pattern.bits[j / 64] |= uint64_t{1} << (j % 64);
+
+                if (region && (ref_id != region_id.value() || start >= region->end || end <= region->start))
+                    continue;
+
+                write_record_single_read(output_stream, ref_ids[ref_id], start, end, name, pattern);
+            }
+        }
+    }
+
+private:
+    std::filesystem::path file;
+    std::ifstream input;
+    std::deque<std::string> ref_ids;
+    std::vector<columnar_block_info> blocks;
+    std::array<std::string, columnar_num_columns> columns{};
+    std::string compressed;
+
+    template <typename value_t>
+    value_t read_value()
+    {
+        value_t value{};
+        input.read(reinterpret_cast<char *>(&value), sizeof(value_t));
+        return value;
+    }
+
+    void read_block(columnar_block_info const & block)
+    {
+        input.seekg(block.offset);
+        if (read_value<uint32_t>() != block.num_reads)
+            throw std::runtime_error("ERROR: Corrupt block in " + file.string() + ".");
+
+        std::array<std::pair<uint32_t, uint32_t>, columnar_num_columns> sizes;
+        for (auto & [size, compressed_size] : sizes)
+        {
+            size = read_value<uint32_t>();
+            compressed_size = read_value<uint32_t>();
+        }
+
+        for (size_t i = 0; i < columnar_num_columns; i++)
+        {
+            compressed.resize(sizes[i].second);
+            input.read(compressed.data(), compressed.size());
+
+            columns[i].resize(sizes[i].first);
+            uLongf size = columns[i].size();
+            if (!input || uncompress(reinterpret_cast<Bytef *>(columns[i].data()), &size,
+                                     reinterpret_cast<Bytef const *>(compressed.data()), compressed.size()) != Z_OK ||
+                size != sizes[i].first)
+                throw std::runtime_error("ERROR: Corrupt block in " + file.string() + ".");
+        }
+
+        if (columns[0].size() != block.num_reads * sizeof(uint16_t))
+            throw std::runtime_error("ERROR: Corrupt block in " + file.string() + ".");
+    }
+};
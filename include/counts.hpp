@@ -0,0 +1,313 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Counts of all reads covering a CpG or 4-mer
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "methylation_scores.hpp"
+
+// Epiallele counts of a 4-mer, indexed as given by epiallele_pos_array
+using epiallele_counts_t = std::array<uint32_t, 16>;
+
+// Counts of the CpGs (or of the 4-mers, given by their first CpG) of all reference sequences. The counts of a
+// reference sequence are stored in flat arrays, one per column, indexed by the ordinal of the CpG among all CpGs of
+// the reference sequence (its index in the sorted CpG positions). Only the range of CpGs covered by reads so far is
+// allocated, which grows with the reads and shrinks when counts are extracted.
+template <typename... column_ts>
+class cpg_indexed_counts
+{
+public:
+    // Add all counts of other, which is left empty
+    void merge(cpg_indexed_counts & other)
+    {
+        for (size_t ref_id = 0; ref_id < other.windows.size(); ref_id++)
+        {
+            counts_window & other_window = other.windows[ref_id];
+            if (other_window.empty())
+                continue;
+
+            counts_window & window = get_window(ref_id, other_window.cpgs, other_window.first, other_window.first + other_window.size());
+            size_t const offset = other_window.first - window.first;
+
+            [&] <size_t... columns> (std::index_sequence<columns...>)
+            {
+                for (size_t i = 0; i < other_window.size(); i++)
+                    (add_counts(std::get<columns>(window.columns)[offset + i], std::get<columns>(other_window.columns)[i]), ...);
+            }(std::index_sequence_for<column_ts...>{});
+
+            other_window = counts_window{};
+        }
+    }
+
+    // Pass the counts of all CpGs covered by reads that are located before end to fn in order of their position,
+    // one argument per column, and remove them
+    template <typename fn_t>
+    void extract(GenomePosition const & end, fn_t && fn)
+    {
+        for (size_t ref_id = 0; ref_id < windows.size() && ref_id <= end.ref_id; ref_id++)
+        {
+            counts_window & window = windows[ref_id];
+            if (window.empty())
+                continue;
+
+            std::span<uint32_t const> positions = *window.cpgs;
+            size_t last = window.first + window.size();
+            if (ref_id == end.ref_id)
+                last = std::clamp<size_t>(std::lower_bound(positions.begin(), positions.end(), end.start) - positions.begin(),
+                                          window.first,
+                                          last);
+
+            size_t const n = last - window.first;
+            for (size_t i = 0; i < n; i++)
+            {
+                if (!has_counts(std::get<0>(window.columns)[i]))
+                    continue;
+
+                std::apply([&] (auto const & ... column)
+                {
+                    fn(GenomePosition{static_cast<uint16_t>(ref_id), positions[window.first + i]}, column[i]...);
+                }, window.columns);
+            }
+
+            if (n == window.size())
+                window = counts_window{};
+            else
+                window.drop_front(n);
+        }
+    }
+
+    // Write all counts with output.write(value), e.g. to a checkpoint
+    template <typename output_t>
+    void save(output_t & output) const
+    {
+        output.write(static_cast<uint64_t>(windows.size()));
+        for (counts_window const & window : windows)
+        {
+            output.write(static_cast<uint64_t>(window.first));
+            std::apply([&] (auto const & ... column) { (output.write(column), ...); }, window.columns);
+        }
+    }
+
+    // Replace all counts by those written by save. get_cpgs(ref_id) returns the CpG positions of a reference sequence.
+    template <typename input_t, typename cpgs_fn_t>
+    void load(input_t & input, cpgs_fn_t && get_cpgs)
+    {
+        windows.assign(input.template read<uint64_t>(), counts_window{});
+        for (size_t ref_id = 0; ref_id < windows.size(); ref_id++)
+        {
+            counts_window & window = windows[ref_id];
+            window.first = input.template read<uint64_t>();
+            std::apply([&] (auto & ... column) { (input.read(column), ...); }, window.columns);
+
+            if (!window.empty())
+                window.cpgs = get_cpgs(ref_id);
+        }
+    }
+
+protected:
+    struct counts_window
+    {
+        cpg_table cpgs{};
+        size_t first = 0;
+        std::tuple<std::vector<column_ts>...> columns{};
+
+        size_t size() const
+        {
+            return std::get<0>(columns).size();
+        }
+
+        bool empty() const
+        {
+            return std::get<0>(columns).empty();
+        }
+
+        // Extend the arrays to the CpGs with ordinals [begin, end)
+        void cover(size_t const begin, size_t const end)
+        {
+            if (empty())
+                first = begin;
+
+            if (begin < first)
+            {
+                size_t const n = first - begin;
+                std::apply([n] (auto & ... column) { (column.insert(column.begin(), n, {}), ...); }, columns);
+                first = begin;
+            }
+
+            if (end > first + size())
+            {
+                size_t const n = end - first;
+                std::apply([n] (auto & ... column) { (column.resize(n), ...); }, columns);
+            }
+        }
+
+        void drop_front(size_t const n)
+        {
+            std::apply([n] (auto & ... column) { (column.erase(column.begin(), column.begin() + n), ...); }, columns);
+            first += n;
+        }
+    };
+
+    std::vector<counts_window> windows;
+
+    // Get the window of a reference sequence covering the CpGs with ordinals [begin, end). The window keeps the CpG
+    // positions of its reference sequence to translate ordinals into positions.
+    counts_window & get_window(size_t const ref_id, cpg_table const & cpgs, size_t const begin, size_t const end)
+    {
+        if (ref_id >= windows.size())
+            windows.resize(ref_id + 1);
+
+        counts_window & window = windows[ref_id];
+        if (!window.cpgs)
+            window.cpgs = cpgs;
+        window.cover(begin, end);
+
+        return window;
+    }
+
+private:
+    template <typename value_t>
+    static void add_counts(value_t & total, value_t const & counts)
+    {
+        if constexpr (std::is_arithmetic_v<value_t>)
+            total += counts;
+        else
+            for (size_t i = 0; i < total.size(); i++)
+                total[i] += counts[i];
+    }
+
+    template <typename value_t>
+    static bool has_counts(value_t const & counts)
+    {
+        if constexpr (std::is_arithmetic_v<value_t>)
+            return counts != 0;
+        else
+            return std::ranges::any_of(counts, [] (auto const count) { return count != 0; });
+    }
+};
+
+// Number of reads, discordant reads, sum of transition scores and number of methylated reads per CpG
+class cpg_counts : public cpg_indexed_counts<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t>
+{
+public:
+    // Add the scores of a read to all of its CpGs. first_cpg is the ordinal of the first CpG of the read.
+    void add_read(size_t const ref_id,
+                  cpg_table const & cpgs,
+                  size_t const first_cpg,
+                  methylation_pattern const & pattern,
+                  num_discordant_reads_t const discordance,
+                  sum_transitions_t const transitions)
+    {
+        counts_window & window = get_window(ref_id, cpgs, first_cpg, first_cpg + pattern.size);
+        auto & [num_reads, num_discordant_reads, sum_transitions, num_methyl_cpgs] = window.columns;
+
+        size_t const offset = first_cpg - window.first;
+        for (size_t i = 0; i < pattern.size; i++)
+        {
+            num_reads[offset + i]++;
+            num_discordant_reads[offset + i] += discordance;
+            sum_transitions[offset + i] += transitions;
+            num_methyl_cpgs[offset + i] += pattern[i];
+        }
+    }
+};
+
+// Epiallele counts per 4-mer, given by the ordinal of its first CpG
+class kmer_counts : public cpg_indexed_counts<epiallele_counts_t>
+{
+public:
+    // Add the epialleles of all 4-mers of a read. first_cpg is the ordinal of the first CpG of the read.
+    void add_read(size_t const ref_id,
+                  cpg_table const & cpgs,
+                  size_t const first_cpg,
+                  methylation_pattern const & pattern)
+    {
+        if (pattern.size < 4)
+            return;
+
+        size_t const num_kmers = pattern.size - 3;
+        counts_window & window = get_window(ref_id, cpgs, first_cpg, first_cpg + num_kmers);
+        auto & epialleles = std::get<0>(window.columns);
+
+        size_t const offset = first_cpg - window.first;
+        for (size_t i = 0; i < num_kmers; i++)
+        {
+            uint16_t const kmer = pattern.kmer(i);
+            epialleles[offset + i][epiallele_pos_array[kmer & 1][(kmer >> 1) & 1][(kmer >> 2) & 1][(kmer >> 3) & 1]]++;
+        }
+    }
+};
+
+// Counts per CpG and epiallele counts per 4-mer
+using cpg_counts_t = cpg_counts;
+using kmer_counts_t = kmer_counts;
+
+// Counts added by several threads at once. Every thread adds reads to its own counts, so threads never wait for each
+// other. The counts of a thread are only locked to be merged into the total counts. Since all counts are integers,
+// the total does not depend on the order in which reads are added or merged.
+template <typename counts_t>
+class concurrent_counts
+{
+public:
+    // Counts of a thread, locked as long as they are used
+    struct local_counts
+    {
+        std::unique_lock<std::mutex> lock;
+        counts_t & counts;
+    };
+
+    explicit concurrent_counts(size_t const num_threads) : num_threads{num_threads}, parts{std::make_unique<part[]>(num_threads)}
+    {}
+
+    local_counts local(size_t const thread)
+    {
+        return local_counts{std::unique_lock<std::mutex>{parts[thread].mutex}, parts[thread].counts};
+    }
+
+    // Add the counts of all threads to total and remove them
+    void merge_into(counts_t & total)
+    {
+        for (size_t thread = 0; thread < num_threads; thread++)
+        {
+            std::lock_guard<std::mutex> lock{parts[thread].mutex};
+            total.merge(parts[thread].counts);
+        }
+    }
+
+private:
+    // Counts of different threads are on different cache lines
+    struct alignas(64) part
+    {
+        std::mutex mutex;
+        counts_t counts;
+    };
+
+    size_t num_threads;
+    std::unique_ptr<part[]> parts;
+};
@@ -21,6 +21,9 @@
 
 #pragma once
 
+#include <limits>
+#include <memory>
+#include <span>
 #include <vector>
 
 #include <seqan3/io/sam_file/sam_tag_dictionary.hpp>
@@ -204,6 +207,37 @@ struct GenomePosition
     }
 };
 
+// Position behind all reference sequences
+inline constexpr GenomePosition genome_end{std::numeric_limits<uint16_t>::max(), std::numeric_limits<uint64_t>::max()};
+
+// Sorted positions of all CpGs of a reference sequence
+using cpg_table = std::shared_ptr<std::span<uint32_t const> const>;
+
+// Methylation pattern of the CpGs of a read. Bit i is set if CpG i is methylated.
+struct methylation_pattern
+{
+    std::vector<uint64_t> bits{};
+    size_t size = 0;
+
+    inline bool operator[] (size_t const i) const
+    {
+        return (bits[i / 64] >> (i % 64)) & 1;
+    }
+
+    // Methylation of the 4 CpGs starting at CpG i, CpG i in the lowest bit
+    inline uint16_t kmer(size_t const i) const
+    {
+        size_t const word = i / 64;
+        size_t const offset = i % 64;
+        uint64_t kmer_bits = bits[word] >> offset;
+
+        if (offset > 60)
+            kmer_bits |= bits[word + 1] << (64 - offset);
+
+        return kmer_bits & 0xF;
+    }
+};
+
 // Epiallele configuration used for entropy/epipolymorphism calculations
 static constexpr std::array<std::array<std::array<std::array<uint16_t, 2>, 2>, 2>, 2> epiallele_pos_array
 {
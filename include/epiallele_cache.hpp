@@ -0,0 +1,258 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Cache of the epialleles of all reads, from which the scores are computed again without reading the BAM file
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "columnar_output.hpp"
+#include "data_structures.hpp"
+
+// The epiallele cache (.rlme) starts with the magic string, whether the BAM file was sorted by position and the names
+// of the reference sequences. It is followed by a record for every read with at least 3 CpGs in the order in which the
+// reads were counted: the number of CpGs, the reference sequence and the ordinal of the first CpG on it (as varints),
+// followed by the methylation pattern with one bit per CpG. A record with 0 CpGs holds a reference sequence and a
+// position instead: the counts before this position were final when it was written.
+inline constexpr std::string_view epiallele_cache_magic{"RLME\1", 5};
+
+inline bool is_epiallele_cache_file(std::filesystem::path const & file)
+{
+    return file.extension() == ".rlme";
+}
+
+// Writes the records of the epiallele cache to a stream
+class epiallele_cache_writer
+{
+public:
+    // A resumed run appends to a cache that already has its header
+    epiallele_cache_writer(std::ostream & output_stream,
+                           std::deque<std::string> const & ref_ids,
+                           bool const sorted,
+                           bool const resumed = false) :
+        output_stream{output_stream}
+    {
+        if (resumed)
+            return;
+
+        output_stream.write(epiallele_cache_magic.data(), epiallele_cache_magic.size());
+        output_stream.put(sorted ? 1 : 0);
+        write_value(output_stream, static_cast<uint32_t>(ref_ids.size()));
+        for (auto const & name : ref_ids)
+        {
+            write_value(output_stream, static_cast<uint32_t>(name.size()));
+            output_stream.write(name.data(), name.size());
+        }
+    }
+
+    epiallele_cache_writer(epiallele_cache_writer const &) = delete;
+    epiallele_cache_writer & operator=(epiallele_cache_writer const &) = delete;
+
+    ~epiallele_cache_writer()
+    {
+        flush();
+    }
+
+    // Append the record of a read to records, e.g. the records of a batch of reads that are written later
+    static void encode_read(std::string & records, size_t const ref_id, size_t const first_cpg, methylation_pattern const & pattern)
+    {
+        write_varint(records, pattern.size);
+        write_varint(records, ref_id);
+        write_varint(records, first_cpg);
+
+        for (size_t i = 0; i < pattern.size; i += 8)
+        {
+            uint8_t byte = (pattern.bits[i / 64] >> (i % 64)) & 0xff;
+            if (pattern.size - i < 8)
+                byte &= (1 << (pattern.size - i)) - 1;
+            records.push_back(static_cast<char>(byte));
+        }
+    }
+
+    void add_read(size_t const ref_id, size_t const first_cpg, methylation_pattern const & pattern)
+    {
+        encode_read(records, ref_id, first_cpg, pattern);
+        flush_if_full();
+    }
+
+    // Add records encoded by encode_read
+    void add_records(std::string_view const encoded_records)
+    {
+        records.append(encoded_records);
+        flush_if_full();
+    }
+
+    // The counts before end are final with the reads added so far
+    void final_position(GenomePosition const & end)
+    {
+        write_varint(records, 0);
+        write_varint(records, end.ref_id);
+        write_varint(records, end.start);
+        flush_if_full();
+    }
+
+    void flush()
+    {
+        output_stream.write(records.data(), records.size());
+        records.clear();
+    }
+
+private:
+    static constexpr size_t buffer_size = 1 << 20;
+
+    std::ostream & output_stream;
+    std::string records;
+
+    void flush_if_full()
+    {
+        if (records.size() >= buffer_size)
+            flush();
+    }
+};
+
+// Reads the records of an epiallele cache in large chunks
+class epiallele_cache_reader
+{
+public:
+    explicit epiallele_cache_reader(std::filesystem::path const & file) :
+        file{file},
+        input{file, std::ios::binary}
+    {
+        if (!input.is_open())
+            throw std::runtime_error("ERROR: Could not open " + file.string() + ".");
+
+        std::string magic(epiallele_cache_magic.size(), '\0');
+        input.read(magic.data(), magic.size());
+        if (magic != epiallele_cache_magic)
+            throw std::runtime_error("ERROR: " + file.string() + " is not an epiallele cache.");
+
+        is_sorted = input.get() == 1;
+
+        uint32_t num_refs = 0;
+        input.read(reinterpret_cast<char *>(&num_refs), sizeof(num_refs));
+        for (uint32_t i = 0; i < num_refs; i++)
+        {
+            uint32_t length = 0;
+            input.read(reinterpret_cast<char *>(&length), sizeof(length));
+            std::string name(length, '\0');
+            input.read(name.data(), name.size());
+            ref_ids.push_back(std::move(name));
+        }
+
+        if (!input)
+            throw std::runtime_error("ERROR: " + file.string() + " is truncated.");
+    }
+
+    std::deque<std::string> const & references() const
+    {
+        return ref_ids;
+    }
+
+    // Whether the reads were written in the order of a BAM file sorted by position
+    bool sorted() const
+    {
+        return is_sorted;
+    }
+
+    // Call on_read(ref_id, first_cpg, pattern) for every read and on_final_position(end) for every position before
+    // which the counts are final. Returns the number of reads.
+    template <typename read_handler_t, typename position_handler_t>
+    uint64_t read(read_handler_t && on_read, position_handler_t && on_final_position)
+    {
+        methylation_pattern pattern;
+        uint64_t num_reads = 0;
+
+        while (true)
+        {
+            // The numbers at the start of the record, fewer bytes are only left at the end of the file
+            fill(max_header_size);
+            if (pos == buffer_end)
+                break;
+
+            std::string_view const data{buffer.data(), buffer_end};
+            uint64_t const num_cpgs = read_varint(data, pos);
+            uint64_t const ref_id = read_varint(data, pos);
+            uint64_t const value = read_varint(data, pos);
+
+            if (ref_id >= ref_ids.size())
+                throw std::runtime_error("ERROR: Corrupt record in " + file.string() + ".");
+
+            if (num_cpgs == 0)
+            {
+                on_final_position(GenomePosition{static_cast<uint16_t>(ref_id), value});
+                continue;
+            }
+
+            size_t const num_bytes = (num_cpgs + 7) / 8;
+            if (!fill(num_bytes))
+                throw std::runtime_error("ERROR: " + file.string() + " is truncated.");
+
+            pattern.size = num_cpgs;
+            pattern.bits.assign((num_cpgs + 63) / 64, 0);
+            for (size_t i = 0; i < num_bytes; i++)
+                pattern.bits[i / 8] |= static_cast<uint64_t>(static_cast<uint8_t>(buffer[pos + i])) << (8 * (i % 8));
+            pos += num_bytes;
+
+            on_read(static_cast<size_t>(ref_id), static_cast<size_t>(value), pattern);
+            num_reads++;
+        }
+
+        return num_reads;
+    }
+
+private:
+    static constexpr size_t chunk_size = 1 << 24;
+    static constexpr size_t max_header_size = 3 * 10;   // Three varints of at most 10 bytes
+
+    std::filesystem::path file;
+    std::ifstream input;
+    std::deque<std::string> ref_ids;
+    bool is_sorted = false;
+
+    std::vector<char> buffer;
+    size_t buffer_end = 0;
+    size_t pos = 0;
+
+    // Make sure that n bytes are in the buffer if the file has them, returns whether it has
+    bool fill(size_t const n)
+    {
+        if (buffer_end - pos < n && input)
+        {
+            // Unread bytes are moved to the front of the buffer
+            std::copy(buffer.begin() + pos, buffer.begin() + buffer_end, buffer.begin());
+            buffer_end -= pos;
+            pos = 0;
+
+            buffer.resize(std::max(chunk_size, buffer_end + n));
+            input.read(buffer.data() + buffer_end, buffer.size() - buffer_end);
+            buffer_end += input.gcount();
+        }
+
+        return buffer_end - pos >= n;
+    }
+};
@@ -0,0 +1,91 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Progress messages of samples processed at once
+// ==========================================================================
+
+#pragma once
+
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+
+// Stream buffer collecting a line and writing it at once, after a prefix, to another stream. Lines of all buffers are
+// written under one lock, so the lines of samples processed at once are not mixed.
+class line_log_buffer : public std::streambuf
+{
+public:
+    explicit line_log_buffer(std::string prefix = {}, std::ostream & output = std::cout) :
+        prefix{std::move(prefix)},
+        output{output}
+    {}
+
+    ~line_log_buffer() override
+    {
+        sync();
+    }
+
+protected:
+    int_type overflow(int_type const c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+
+        line.push_back(traits_type::to_char_type(c));
+        if (c == '\n')
+            write_line();
+        return c;
+    }
+
+    int sync() override
+    {
+        if (!line.empty())
+            write_line();
+        return 0;
+    }
+
+private:
+    void write_line()
+    {
+        static std::mutex mutex;
+
+        std::lock_guard<std::mutex> lock{mutex};
+        output << prefix << line << std::flush;
+        line.clear();
+    }
+
+    std::string prefix;
+    std::ostream & output;
+    std::string line{};
+};
+
+// Output stream of progress messages whose lines start with prefix
+class line_log : public std::ostream
+{
+public:
+    explicit line_log(std::string prefix = {}, std::ostream & output = std::cout) :
+        std::ostream{nullptr},
+        buffer{std::move(prefix), output}
+    {
+        rdbuf(&buffer);
+    }
+
+private:
+    line_log_buffer buffer;
+};
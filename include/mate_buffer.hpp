@@ -0,0 +1,376 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Reads of a pair kept until their mate is read
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <ios>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <seqan3/alphabet/nucleotide/dna5.hpp>
+
+#include "data_structures.hpp"
+
+// Alignment position of a read or its mate that is not given in the BAM file
+inline constexpr uint64_t unknown_position = std::numeric_limits<uint64_t>::max();
+
+// Read of a pair as it is processed (after clipping). The alignment positions of the read and its mate as given in
+// the BAM file identify the mate together with the hash of the read name. The position in the processing order and in
+// the single read output are stored to pair mates that were read by different shards afterwards.
+struct mate_read
+{
+    uint64_t key{};                             // Hash of the read name
+    std::string id{};
+    read_type type{};
+    bool indel = false;                         // Read had indels: only its mate is processed
+    uint16_t ref_id{};
+    uint64_t position{};                        // Alignment position of the processed bases
+    uint64_t alignment_position = unknown_position;
+    uint64_t mate_position = unknown_position;
+    seqan3::dna5_vector sequence{};
+    size_t begin{};                             // Processed bases of the sequence (without clipped bases)
+    size_t length{};
+    uint64_t order{};
+    std::streamoff offset{};
+
+    std::span<seqan3::dna5 const> bases() const
+    {
+        return std::span<seqan3::dna5 const>{sequence}.subspan(begin, length);
+    }
+};
+
+// Hash of a read name to find its mate
+inline uint64_t read_name_key(std::string const & id)
+{
+    return std::hash<std::string>{}(id);
+}
+
+// Reads stored until their mate is read. Only what is needed to process a read is kept: its position, strand and its
+// sequence packed into 4 bits per base. Reads are found by the hash of their name, the alignment positions of both
+// mates have to match as well.
+// If mates are adjacent in the BAM file (collated), only the last read is kept and a read is either paired with it or
+// the last read is dropped as an orphan.
+class mate_buffer
+{
+public:
+    // Read names are only kept if mates are paired afterwards by a buffer that does not see the reads themselves
+    explicit mate_buffer(bool const keep_ids = false, bool const collated = false) : keep_ids{keep_ids}, collated{collated}
+    {}
+
+    // Remove the mate of a read from the buffer and return it, if it has been stored
+    std::optional<mate_read> take(mate_read const & read)
+    {
+        if (collated)
+        {
+            if (!last_read || last_read->key != read.key || !is_mate(last_read.value(), read))
+                return std::nullopt;
+
+            std::optional<mate_read> mate = std::move(last_read);
+            last_read.reset();
+            return mate;
+        }
+
+        auto [first, last] = mates.equal_range(read.key);
+
+        for (auto it = first; it != last; ++it)
+        {
+            if (!is_mate(it->second, read))
+                continue;
+
+            mate_read mate = unpack(read.key, it->second);
+            if (mate.id.empty())
+                mate.id = read.id;
+
+            mates.erase(it);
+            return mate;
+        }
+
+        return std::nullopt;
+    }
+
+    void insert(mate_read && read)
+    {
+        if (collated)
+        {
+            // The mate of the last read would have been read before this read
+            if (last_read)
+                orphans++;
+            last_read = std::move(read);
+            peak = std::max<uint64_t>(peak, 1);
+            return;
+        }
+
+        mates.emplace(read.key, pack(std::move(read)));
+        peak = std::max<uint64_t>(peak, mates.size());
+    }
+
+    // Start of the leftmost stored read, or current if it is further left. For position sorted input the counts left
+    // of it do not change anymore. Stored reads whose mate is located before current will never be paired, since
+    // their mate was already read and filtered out. They are dropped and counted as orphans.
+    GenomePosition first_open_position(GenomePosition const & current)
+    {
+        GenomePosition first = current;
+
+        // Returns false if the mate of a stored read was expected before current
+        auto update_first = [&] (auto const & mate)
+        {
+            if (mate.mate_position != unknown_position && GenomePosition{mate.ref_id, mate.mate_position} < current)
+                return false;
+
+            if (!mate.indel)
+                first = std::min(first, GenomePosition{mate.ref_id, mate.position});
+            return true;
+        };
+
+        if (last_read && !update_first(last_read.value()))
+        {
+            last_read.reset();
+            orphans++;
+        }
+
+        for (auto it = mates.begin(); it != mates.end();)
+        {
+            if (!update_first(it->second))
+            {
+                it = mates.erase(it);
+                orphans++;
+                continue;
+            }
+            ++it;
+        }
+
+        return first;
+    }
+
+    // Remove all stored reads and return them in the order in which they were read
+    std::vector<mate_read> release()
+    {
+        std::vector<mate_read> reads;
+        reads.reserve(size());
+
+        for (auto const & [key, mate] : mates)
+            reads.push_back(unpack(key, mate));
+        mates.clear();
+
+        if (last_read)
+            reads.push_back(std::move(last_read.value()));
+        last_read.reset();
+
+        std::sort(reads.begin(), reads.end(), [] (mate_read const & a, mate_read const & b)
+        {
+            return a.order < b.order;
+        });
+
+        return reads;
+    }
+
+    // Drop all stored reads, their mates will not be read anymore
+    void drop_all()
+    {
+        orphans += size();
+        mates.clear();
+        last_read.reset();
+    }
+
+    size_t size() const
+    {
+        return mates.size() + (last_read ? 1 : 0);
+    }
+
+    // Number of reads dropped because their mate was not read or filtered out
+    uint64_t num_orphans() const
+    {
+        return orphans;
+    }
+
+    // Largest number of reads stored at once
+    uint64_t peak_size() const
+    {
+        return peak;
+    }
+
+    // Write all stored reads with output.write(value), e.g. to a checkpoint
+    template <typename output_t>
+    void save(output_t & output) const
+    {
+        output.write(orphans);
+        output.write(static_cast<uint64_t>(mates.size()));
+        for (auto const & [key, mate] : mates)
+        {
+            output.write(key);
+            save_mate(output, mate);
+        }
+
+        // The last read of collated input keeps its name
+        output.write(last_read.has_value());
+        if (last_read)
+        {
+            pending_mate mate = pack(mate_read{last_read.value()});
+            mate.id = last_read->id;
+            output.write(last_read->key);
+            save_mate(output, mate);
+        }
+    }
+
+    // Replace all stored reads by those written by save
+    template <typename input_t>
+    void load(input_t & input)
+    {
+        mates.clear();
+        last_read.reset();
+
+        input.read(orphans);
+        uint64_t const num_mates = input.template read<uint64_t>();
+        for (uint64_t i = 0; i < num_mates; i++)
+        {
+            uint64_t const key = input.template read<uint64_t>();
+            mates.emplace(key, load_mate(input));
+        }
+
+        if (input.template read<bool>())
+        {
+            uint64_t const key = input.template read<uint64_t>();
+            last_read = unpack(key, load_mate(input));
+        }
+    }
+
+private:
+    struct pending_mate
+    {
+        std::string id{};
+        std::vector<uint8_t> packed_sequence{};  // Two bases per byte, rank of the first base in the lower 4 bits
+        uint64_t position{};
+        uint64_t alignment_position{};
+        uint64_t mate_position{};
+        uint64_t order{};
+        std::streamoff offset{};
+        uint32_t length{};
+        uint16_t ref_id{};
+        read_type type{};
+        bool indel = false;
+    };
+
+    bool keep_ids;
+    bool collated;
+    uint64_t orphans = 0;
+    uint64_t peak = 0;
+    std::unordered_multimap<uint64_t, pending_mate> mates;
+    std::optional<mate_read> last_read{};
+
+    // Mates are on the same reference sequence (reads with a mate on another one are not paired) and each is
+    // aligned where the other expects it
+    template <typename stored_read_t>
+    static bool is_mate(stored_read_t const & mate, mate_read const & read)
+    {
+        auto matches = [] (uint64_t const expected, uint64_t const position)
+        {
+            return expected == unknown_position || position == unknown_position || expected == position;
+        };
+
+        return mate.ref_id == read.ref_id &&
+               matches(mate.mate_position, read.alignment_position) &&
+               matches(read.mate_position, mate.alignment_position);
+    }
+
+    template <typename output_t>
+    static void save_mate(output_t & output, pending_mate const & mate)
+    {
+        output.write(mate.id);
+        output.write(mate.packed_sequence);
+        output.write(mate.position);
+        output.write(mate.alignment_position);
+        output.write(mate.mate_position);
+        output.write(mate.order);
+        output.write(mate.offset);
+        output.write(mate.length);
+        output.write(mate.ref_id);
+        output.write(mate.type);
+        output.write(mate.indel);
+    }
+
+    template <typename input_t>
+    static pending_mate load_mate(input_t & input)
+    {
+        pending_mate mate{};
+        input.read(mate.id);
+        input.read(mate.packed_sequence);
+        input.read(mate.position);
+        input.read(mate.alignment_position);
+        input.read(mate.mate_position);
+        input.read(mate.order);
+        input.read(mate.offset);
+        input.read(mate.length);
+        input.read(mate.ref_id);
+        input.read(mate.type);
+        input.read(mate.indel);
+        return mate;
+    }
+
+    pending_mate pack(mate_read && read) const
+    {
+        std::span<seqan3::dna5 const> bases = read.bases();
+
+        pending_mate mate{keep_ids ? std::move(read.id) : std::string{},
+                          std::vector<uint8_t>((bases.size() + 1) / 2, 0),
+                          read.position,
+                          read.alignment_position,
+                          read.mate_position,
+                          read.order,
+                          read.offset,
+                          static_cast<uint32_t>(bases.size()),
+                          read.ref_id,
+                          read.type,
+                          read.indel};
+
+        for (size_t i = 0; i < bases.size(); i++)
+            mate.packed_sequence[i / 2] |= seqan3::to_rank(bases[i]) << (4 * (i % 2));
+
+        return mate;
+    }
+
+    static mate_read unpack(uint64_t const key, pending_mate const & mate)
+    {
+        mate_read read{key,
+                       mate.id,
+                       mate.type,
+                       mate.indel,
+                       mate.ref_id,
+                       mate.position,
+                       mate.alignment_position,
+                       mate.mate_position,
+                       seqan3::dna5_vector(mate.length),
+                       0,
+                       mate.length,
+                       mate.order,
+                       mate.offset};
+
+        for (size_t i = 0; i < mate.length; i++)
+            seqan3::assign_rank_to((mate.packed_sequence[i / 2] >> (4 * (i % 2))) & 0xF, read.sequence[i]);
+
+        return read;
+    }
+};
@@ -0,0 +1,193 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Methylation calls of the CpGs covered by a read
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <seqan3/alphabet/nucleotide/dna5.hpp>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define RLM_AVX2_METHYLATION_CALL 1
+#endif
+
+// The read bases of a CpG are encoded as the rank of the base at the position of the 'C' plus 256 times the rank of
+// the base at the position of the 'G' (dna5 ranks: A = 0, C = 1, G = 2, N = 3, T = 4).
+// For reads coming from the forward strand, the base at the 'C' is evaluated: C is methylated, T is unmethylated.
+// For reads coming from the reverse strand, the base at the 'G' is evaluated: G is methylated, A is unmethylated.
+// Any other combination of bases makes the read invalid.
+inline constexpr uint32_t methylated_cpg = 1 + 256 * 2;
+inline constexpr uint32_t unmethylated_cpg_forward = 4 + 256 * 2;
+inline constexpr uint32_t unmethylated_cpg_reverse = 1 + 256 * 0;
+
+static_assert(sizeof(seqan3::dna5) == 1, "The methylation call reads the ranks of a dna5 sequence as bytes.");
+
+// Bases of a read as they are processed, without creating a new sequence for them: clipped bases are left out and the
+// bases of two overlapping mates are given as the first mate followed by the part of the second mate behind it.
+struct read_view
+{
+    uint64_t position{};                    // Alignment position of the first base
+    std::span<seqan3::dna5 const> first{};
+    std::span<seqan3::dna5 const> second{}; // Bases directly following the first ones on the reference
+
+    size_t size() const
+    {
+        return first.size() + second.size();
+    }
+};
+
+// Scalar methylation call of the CpGs [first, last). The positions in cpg_pos are relative to the base 'shift' bases
+// before read.
+inline bool call_methylation_scalar(uint8_t const * read,
+                                    size_t const shift,
+                                    uint16_t const * cpg_pos,
+                                    size_t const first,
+                                    size_t const last,
+                                    bool const reverse,
+                                    uint64_t * methylation)
+{
+    uint32_t const unmethylated_cpg = reverse ? unmethylated_cpg_reverse : unmethylated_cpg_forward;
+    bool valid = true;
+
+    for (size_t i = first; i < last; i++)
+    {
+        uint32_t bases = read[cpg_pos[i] - shift] | (read[cpg_pos[i] - shift + 1] << 8);
+        bool methylated = bases == methylated_cpg;
+
+        valid &= methylated || bases == unmethylated_cpg;
+        methylation[i / 64] |= static_cast<uint64_t>(methylated) << (i % 64);
+    }
+
+    return valid;
+}
+
+#ifdef RLM_AVX2_METHYLATION_CALL
+// Methylation call of 8 CpGs at once: the two bases of every CpG are gathered into one 32 bit lane and compared
+// against the codes of methylated and unmethylated CpGs
+__attribute__((target("avx2")))
+inline bool call_methylation_avx2(uint8_t const * read,
+                                  size_t const read_length,
+                                  size_t const shift,
+                                  uint16_t const * cpg_pos,
+                                  size_t const first,
+                                  size_t const last,
+                                  bool const reverse,
+                                  uint64_t * methylation)
+{
+    __m256i const cpg_bases = _mm256_set1_epi32(0xFFFF);
+    __m256i const methylated_code = _mm256_set1_epi32(methylated_cpg);
+    __m256i const unmethylated_code = _mm256_set1_epi32(reverse ? unmethylated_cpg_reverse : unmethylated_cpg_forward);
+    __m256i const shift_offsets = _mm256_set1_epi32(shift);
+
+    int invalid = 0;
+    size_t i = first;
+
+    // Every gather reads 4 bytes, so the CpGs at the very end of the read are left to the scalar call
+    for (; i + 8 <= last && cpg_pos[i + 7] - shift + 4 <= read_length; i += 8)
+    {
+        __m256i offsets = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(cpg_pos + i))),
+                                           shift_offsets);
+        __m256i bases = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<int const *>(read), offsets, 1), cpg_bases);
+
+        int methylated = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(bases, methylated_code)));
+        int unmethylated = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(bases, unmethylated_code)));
+
+        invalid |= ~(methylated | unmethylated) & 0xFF;
+        methylation[i / 64] |= static_cast<uint64_t>(methylated) << (i % 64);
+        if (i % 64 > 56)
+            methylation[i / 64 + 1] |= static_cast<uint64_t>(methylated) >> (64 - i % 64);
+    }
+
+    return call_methylation_scalar(read, shift, cpg_pos, i, last, reverse, methylation) && invalid == 0;
+}
+#endif
+
+// Methylation call of the CpGs [first, last) within bases, which start 'shift' bases after the start of the read
+inline bool call_methylation(std::span<seqan3::dna5 const> bases,
+                             size_t const shift,
+                             std::vector<uint16_t> const & cpg_pos,
+                             size_t const first,
+                             size_t const last,
+                             bool const reverse,
+                             uint64_t * methylation)
+{
+    uint8_t const * read = reinterpret_cast<uint8_t const *>(bases.data());
+
+#ifdef RLM_AVX2_METHYLATION_CALL
+    static bool const has_avx2 = __builtin_cpu_supports("avx2");
+
+    if (has_avx2)
+        return call_methylation_avx2(read, bases.size(), shift, cpg_pos.data(), first, last, reverse, methylation);
+#endif
+
+    return call_methylation_scalar(read, shift, cpg_pos.data(), first, last, reverse, methylation);
+}
+
+// Determine the methylation status of all CpGs of a read. Bit i of the methylation bitmask is set if CpG i is
+// methylated. Returns false if the bases of any CpG do not allow a methylation call.
+inline bool call_methylation(read_view const & read,
+                             std::vector<uint16_t> const & cpg_pos,
+                             bool const reverse,
+                             std::vector<uint64_t> & methylation)
+{
+    methylation.assign((cpg_pos.size() + 63) / 64, 0);
+
+    // CpGs with both bases in the first part of the read
+    size_t const first_size = read.first.size();
+    size_t const split = std::partition_point(cpg_pos.begin(), cpg_pos.end(), [first_size] (uint16_t const pos)
+    {
+        return pos + 1u < first_size;
+    }) - cpg_pos.begin();
+
+    if (!call_methylation(read.first, 0, cpg_pos, 0, split, reverse, methylation.data()))
+        return false;
+
+    if (split == cpg_pos.size())
+        return true;
+
+    size_t second_begin = split;
+
+    // CpG with the 'C' at the end of the first and the 'G' at the start of the second part
+    if (cpg_pos[split] + 1u == first_size)
+    {
+        std::array<uint8_t, 2> bases{seqan3::to_rank(read.first.back()), seqan3::to_rank(read.second.front())};
+
+        if (!call_methylation_scalar(bases.data(), cpg_pos[split], cpg_pos.data(), split, split + 1, reverse, methylation.data()))
+            return false;
+
+        second_begin++;
+    }
+
+    return call_methylation(read.second, first_size, cpg_pos, second_begin, cpg_pos.size(), reverse, methylation.data());
+}
+
+inline bool call_methylation(seqan3::dna5_vector const & sequence,
+                             std::vector<uint16_t> const & cpg_pos,
+                             bool const reverse,
+                             std::vector<uint64_t> & methylation)
+{
+    return call_methylation(read_view{0, sequence}, cpg_pos, reverse, methylation);
+}
@@ -21,44 +21,95 @@
 
 #pragma once
 
+#include <algorithm>
+#include <bit>
 #include <cmath>
 #include <numeric>
+#include <span>
+#include <tuple>
+#include <vector>
 
 #include "data_structures.hpp"
 
 using num_reads_t = uint32_t;
 using num_discordant_reads_t = uint32_t;
-using sum_transitions_t = double;
+using sum_transitions_t = uint64_t;
 using num_methyl_cpgs_t = uint32_t;
 
-// Calculate transirion score of a single read
-double calculate_transitions_per_read(std::vector<uint16_t> const & cpg_config)
+// Transition scores are summed up in fixed point with 32 fractional bits. Integer sums do not depend on the order
+// in which reads are added, so results of runs that process reads in different order are identical.
+static constexpr double transitions_scale = 4294967296.0;
+
+inline sum_transitions_t transitions_to_fixed_point(double const transitions)
+{
+    return static_cast<sum_transitions_t>(std::llround(transitions * transitions_scale));
+}
+
+// Store a methylation pattern given as one 0/1 value per CpG as bits
+methylation_pattern make_methylation_pattern(std::vector<uint16_t> const & cpg_config)
 {
-    uint16_t transitions = 0;
-    for (size_t i = 0; i < (cpg_config.size() - 1); i++)
+    methylation_pattern pattern{std::vector<uint64_t>((cpg_config.size() + 63) / 64, 0), cpg_config.size()};
+
+    for (size_t i = 0; i < cpg_config.size(); i++)
+        pattern.bits[i / 64] |= static_cast<uint64_t>(cpg_config[i] != 0) << (i % 64);
+
+    return pattern;
+}
+
+// Count methylated CpGs of a single read
+uint32_t count_methylated_cpgs(methylation_pattern const & pattern)
+{
+    uint32_t methylated = 0;
+    for (uint64_t word : pattern.bits)
+        methylated += std::popcount(word);
+    return methylated;
+}
+
+// Count changes of the methylation status between neighbouring CpGs of a single read
+uint32_t count_transitions(methylation_pattern const & pattern)
+{
+    uint32_t transitions = 0;
+    for (size_t i = 0; i * 64 + 1 < pattern.size; i++)
     {
-        if (cpg_config[i] != cpg_config[i+1])
-            transitions++;
+        // Compare every CpG with the next one, which is in the next word for the highest bit
+        uint64_t next = pattern.bits[i] >> 1;
+        if (i + 1 < pattern.bits.size())
+            next |= pattern.bits[i + 1] << 63;
+
+        size_t const pairs = std::min<size_t>(pattern.size - 1 - i * 64, 64);
+        uint64_t const mask = pairs == 64 ? ~uint64_t{0} : (uint64_t{1} << pairs) - 1;
+
+        transitions += std::popcount((pattern.bits[i] ^ next) & mask);
     }
-    return static_cast<double>(transitions) / (cpg_config.size() - 1);
+    return transitions;
+}
+
+// Calculate transirion score of a single read
+double calculate_transitions_per_read(methylation_pattern const & pattern)
+{
+    return static_cast<double>(count_transitions(pattern)) / (pattern.size - 1);
+}
+
+double calculate_transitions_per_read(std::vector<uint16_t> const & cpg_config)
+{
+    return calculate_transitions_per_read(make_methylation_pattern(cpg_config));
 }
 
 // Calculate discordance of a single read
+uint16_t calculate_discordance_per_read(methylation_pattern const & pattern)
+{
+    return count_transitions(pattern) == 0 ? 0 : 1;
+}
+
 uint16_t calculate_discordance_per_read(std::vector<uint16_t> const & cpg_config)
 {
-    uint16_t transitions = 0;
-    for (size_t i = 0; i < (cpg_config.size() - 1); i++)
-    {
-        if (cpg_config[i] != cpg_config[i+1])
-            transitions++;
-    }
-    return transitions == 0 ? 0 : 1;
+    return calculate_discordance_per_read(make_methylation_pattern(cpg_config));
 }
 
 // Calculate average RTS for a CpG
 double calculate_avg_transitions_across_reads(std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> const & position_counts)
 {
-    return std::get<2>(position_counts) / std::get<0>(position_counts);
+    return static_cast<double>(std::get<2>(position_counts)) / transitions_scale / std::get<0>(position_counts);
 }
 
 // Calculate average discordance for a CpG
@@ -74,7 +125,7 @@ double calculate_avg_methylation_across_reads(std::tuple<num_reads_t, num_discor
 }
 
 // Calculate entropy for a 4-mer
-double calculate_entropy_across_reads(std::vector<uint32_t> const & epialleles, uint32_t const & num_reads)
+double calculate_entropy_across_reads(std::span<uint32_t const> epialleles, uint32_t const & num_reads)
 {
     double entropy = 0;
 
@@ -89,7 +140,7 @@ double calculate_entropy_across_reads(std::vector<uint32_t> const & epialleles,
 }
 
 // Calculate epipolymorphism for a 4-mer
-double calculate_epipolymorphism_across_reads(std::vector<uint32_t> const & epialleles, uint32_t const & num_reads)
+double calculate_epipolymorphism_across_reads(std::span<uint32_t const> epialleles, uint32_t const & num_reads)
 {
     double epipolymorphism = 0;
 
@@ -103,7 +154,7 @@ double calculate_epipolymorphism_across_reads(std::vector<uint32_t> const & epia
 }
 
 // Calculate average methylation for a 4-mer
-double calculate_avg_kmer_methylation_across_reads(std::vector<uint32_t> const & epialleles, uint32_t const & num_reads)
+double calculate_avg_kmer_methylation_across_reads(std::span<uint32_t const> epialleles, uint32_t const & num_reads)
 {
     uint32_t methylated_cpgs =
     epialleles[1] * 1 +
@@ -21,17 +21,33 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "async_output.hpp"
+#include "bgzf_output.hpp"
+#include "counts.hpp"
 #include "methylation_scores.hpp"
+#include "text_writer.hpp"
 
 using num_reads_t = uint32_t;
 using num_discordant_reads_t = uint32_t;
-using sum_transitions_t = double;
+using sum_transitions_t = uint64_t;
 using num_methyl_cpgs_t = uint32_t;
 
 // Write header for 'single_read' mode
-void write_header_read_info(std::ofstream & output_stream)
+void write_header_read_info(std::ostream & output_stream)
 {
-    if (output_stream.is_open())
+    if (output_stream)
     {
         output_stream << "#chr\t"
                       << "start\t"
@@ -51,9 +67,9 @@ void write_header_read_info(std::ofstream & output_stream)
 }
 
 // Write header for 'entropy' mode
-void write_header_entropy(std::ofstream & output_stream)
+void write_header_entropy(std::ostream & output_stream)
 {
-    if (output_stream.is_open())
+    if (output_stream)
     {
         output_stream << "#chr\t"
                       << "start\t"
@@ -86,9 +102,9 @@ void write_header_entropy(std::ofstream & output_stream)
 }
 
 // Write header for 'pdr' mode
-void write_header_pdr(std::ofstream & output_stream)
+void write_header_pdr(std::ostream & output_stream)
 {
-    if (output_stream.is_open())
+    if (output_stream)
     {
         output_stream << "#chr\t"
                       << "start\t"
@@ -104,11 +120,45 @@ void write_header_pdr(std::ofstream & output_stream)
     }
 }
 
+// Write record for 'single_read' mode and return the offset of the read name in the line
+size_t write_record_single_read(text_writer & output_stream,
+                                std::string_view const chr,
+                                uint64_t const start,
+                                uint64_t const end,
+                                std::string_view const id,
+                                methylation_pattern const & pattern)
+{
+    // Characters for unmethylated or methylated CpGs in the output
+    static constexpr std::array<char, 2> methyl_context_char = {'g', 'G'};
+
+    uint32_t num_methyl_cpgs = count_methylated_cpgs(pattern);
+    uint32_t num_transitions = count_transitions(pattern);
+
+    uint64_t const line_begin = output_stream.size();
+    output_stream << chr << "\t"
+                  << start << "\t"
+                  << end << "\t";
+    size_t const name_begin = output_stream.size() - line_begin;
+    output_stream << id << "\t";
+
+    for (size_t i = 0; i < pattern.size; i++)
+        output_stream << methyl_context_char[pattern[i]];
+
+    output_stream << "\t"
+                  << pattern.size << "\t"
+                  << num_methyl_cpgs << "\t"
+                  << (num_transitions == 0 ? 0 : 1) << "\t"
+                  << static_cast<double>(num_transitions) / (pattern.size - 1) << "\t"
+                  << static_cast<double>(num_methyl_cpgs) / pattern.size << "\n";
+
+    return name_begin;
+}
+
 // Write record for 'entropy' mode
-void write_record_entropy(std::ofstream & output_stream,
+void write_record_entropy(text_writer & output_stream,
                           std::deque<std::string> const & ref_ids,
                           GenomePosition const & pos,
-                          std::vector<uint32_t> const & epialleles,
+                          std::span<uint32_t const> epialleles,
                           uint32_t const & coverage_filter)
 {
     uint32_t coverage = std::accumulate(epialleles.begin(), epialleles.end(), 0);
@@ -141,7 +191,7 @@ void write_record_entropy(std::ofstream & output_stream,
 }
 
 // Write record for 'pdr' mode
-void write_record_pdr(std::ofstream & output_stream,
+void write_record_pdr(text_writer & output_stream,
                       std::deque<std::string> const & ref_ids,
                       GenomePosition const & pos,
                       std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> const & position_counts,
@@ -158,3 +208,304 @@ void write_record_pdr(std::ofstream & output_stream,
                   << calculate_avg_methylation_across_reads(position_counts) << "\t"
                   << std::get<0>(position_counts) << "\n";
 }
+
+// Write and remove all CpGs before the given position. Their counts must not change anymore.
+void write_final_records_pdr(std::ostream & output_stream,
+                             std::deque<std::string> const & ref_ids,
+                             cpg_counts_t & all_CpGs,
+                             GenomePosition const & end,
+                             uint32_t const & coverage_filter)
+{
+    text_writer writer{output_stream};
+
+    all_CpGs.extract(end, [&] (GenomePosition const & pos, auto const & ... position_counts)
+    {
+        write_record_pdr(writer, ref_ids, pos, std::make_tuple(position_counts...), coverage_filter);
+    });
+}
+
+// Write and remove all kmers starting before the given position. Their counts must not change anymore.
+void write_final_records_entropy(std::ostream & output_stream,
+                                 std::deque<std::string> const & ref_ids,
+                                 kmer_counts_t & all_kmers,
+                                 GenomePosition const & end,
+                                 uint32_t const & coverage_filter)
+{
+    text_writer writer{output_stream};
+
+    all_kmers.extract(end, [&] (GenomePosition const & pos, epiallele_counts_t const & epialleles)
+    {
+        write_record_entropy(writer, ref_ids, pos, epialleles, coverage_filter);
+    });
+}
+
+// Position and read name of a line of the sorted single read output. It is written behind the line when the read is
+// emitted, field by field without padding, and removed again by sorted_line_buffer.
+struct sorted_line_key
+{
+    static constexpr size_t encoded_size = sizeof(uint16_t) + sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+    GenomePosition position;
+    uint32_t name_begin;
+    uint32_t name_length;
+
+    void write(text_writer & output_stream) const
+    {
+        std::array<char, encoded_size> bytes;
+        std::memcpy(bytes.data(), &position.ref_id, sizeof(uint16_t));
+        std::memcpy(bytes.data() + 2, &position.start, sizeof(uint64_t));
+        std::memcpy(bytes.data() + 10, &name_begin, sizeof(uint32_t));
+        std::memcpy(bytes.data() + 14, &name_length, sizeof(uint32_t));
+        output_stream << std::string_view{bytes.data(), bytes.size()};
+    }
+
+    static sorted_line_key read(char const * bytes)
+    {
+        sorted_line_key key;
+        std::memcpy(&key.position.ref_id, bytes, sizeof(uint16_t));
+        std::memcpy(&key.position.start, bytes + 2, sizeof(uint64_t));
+        std::memcpy(&key.name_begin, bytes + 10, sizeof(uint32_t));
+        std::memcpy(&key.name_length, bytes + 14, sizeof(uint32_t));
+        return key;
+    }
+};
+
+// Single read output sorted by reference sequence (in the order of the BAM header), start position and read name.
+// Every line is followed by its sorted_line_key (see text_writer::line_keys), which is removed. Lines written to the
+// buffer are kept until release is called with a position before which no more reads start, so only the reads between
+// the last released position and the current position are held in memory. Reads with the same start and name are
+// ordered by the whole line, so the output does not depend on the order of processing.
+class sorted_line_buffer : public std::streambuf
+{
+public:
+    explicit sorted_line_buffer(std::ostream & output_stream) : output_stream{output_stream}
+    {}
+
+    // Write all lines of reads starting before end in sorted order. Lines added since the last release are sorted
+    // and merged into the lines that are still kept, which are sorted already.
+    void release(GenomePosition const & end)
+    {
+        auto first_new = lines.begin() + num_sorted;
+        std::sort(first_new, lines.end());
+        std::inplace_merge(lines.begin(), first_new, lines.end());
+
+        auto last = std::lower_bound(lines.begin(), lines.end(), end, [] (sorted_line const & line, GenomePosition const & end)
+        {
+            return line.position < end;
+        });
+
+        for (auto it = lines.begin(); it != last; ++it)
+            output_stream << it->text;
+        lines.erase(lines.begin(), last);
+        num_sorted = lines.size();
+    }
+
+    size_t size() const
+    {
+        return lines.size();
+    }
+
+protected:
+    int_type overflow(int_type const c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+
+        char const ch = traits_type::to_char_type(c);
+        xsputn(&ch, 1);
+        return c;
+    }
+
+    std::streamsize xsputn(char const * s, std::streamsize const n) override
+    {
+        std::string_view text{s, static_cast<size_t>(n)};
+
+        while (!text.empty())
+        {
+            // The end of a line is searched before its key, which may contain newline characters
+            if (line_length == 0)
+            {
+                size_t const newline = text.find('\n');
+                if (newline == std::string_view::npos)
+                {
+                    current.append(text);
+                    break;
+                }
+
+                current.append(text.substr(0, newline + 1));
+                text.remove_prefix(newline + 1);
+                line_length = current.size();
+            }
+
+            size_t const key_part = std::min(line_length + sorted_line_key::encoded_size - current.size(), text.size());
+            current.append(text.substr(0, key_part));
+            text.remove_prefix(key_part);
+
+            if (current.size() == line_length + sorted_line_key::encoded_size)
+            {
+                add_line(std::move(current));
+                current.clear();
+                line_length = 0;
+            }
+        }
+
+        return n;
+    }
+
+private:
+    struct sorted_line
+    {
+        GenomePosition position;
+        uint32_t name_begin;
+        uint32_t name_length;
+        std::string text;
+
+        std::string_view name() const
+        {
+            return std::string_view{text}.substr(name_begin, name_length);
+        }
+
+        bool operator<(sorted_line const & other) const
+        {
+            if (position < other.position || other.position < position)
+                return position < other.position;
+            if (name() != other.name())
+                return name() < other.name();
+            return text < other.text;
+        }
+    };
+
+    std::ostream & output_stream;
+    std::vector<sorted_line> lines;
+    size_t num_sorted = 0;
+    std::string current;
+    size_t line_length = 0;
+
+    void add_line(std::string && text)
+    {
+        sorted_line_key const key = sorted_line_key::read(text.data() + line_length);
+        text.resize(line_length);
+
+        lines.push_back(sorted_line{key.position, key.name_begin, key.name_length, std::move(text)});
+    }
+};
+
+// Output file written by a background thread. Files whose name ends in .gz are compressed with BGZF on num_threads
+// threads, which can be read by gzip and indexed by tabix. If index is set, the tabix index (.tbi, or .csi for very long
+// reference sequences) is written together with the compressed file, which requires lines sorted by position.
+class output_file
+{
+public:
+    void open(std::filesystem::path const & file_name, size_t const num_threads = 1, bool const index = false)
+    {
+        file = file_name;
+        file_stream.open(file, std::ios::binary);
+        start_writing(num_threads, index);
+    }
+
+    // Continue an uncompressed output file that was written up to size (e.g. when the run was interrupted), anything
+    // behind it is removed
+    void resume(std::filesystem::path const & file_name, std::streamoff const size)
+    {
+        file = file_name;
+        if (!std::filesystem::exists(file) || std::filesystem::file_size(file) < static_cast<uintmax_t>(size))
+            throw std::runtime_error("ERROR: Output file " + file.string() + " is shorter than at the checkpoint.");
+
+        std::filesystem::resize_file(file, size);
+        file_stream.open(file, std::ios::binary | std::ios::app);
+        start_writing(1, false);
+    }
+
+    static bool is_compressed(std::filesystem::path const & file_name)
+    {
+        return file_name.extension() == ".gz";
+    }
+
+    std::ostream & stream()
+    {
+        return output;
+    }
+
+    // Wait until all output so far is written to the file and return its size. Only for uncompressed files.
+    std::streamoff sync()
+    {
+        if (!async)
+            return 0;
+
+        async->wait();
+        file_stream.flush();
+        file_stream.seekp(0, std::ios::end);
+        if (!file_stream)
+            throw std::runtime_error("ERROR: Could not write output file " + file.string() + ".");
+
+        return file_stream.tellp();
+    }
+
+    // Write all remaining output, the end of the compressed file and its index
+    void finish()
+    {
+        if (!async)
+            return;
+
+        try
+        {
+            async->finish();
+        }
+        catch (...)
+        {
+            // Errors while compressing or indexing are more precise than the failed write
+            if (compressed)
+                compressed->rethrow_error();
+            throw;
+        }
+
+        std::vector<uint64_t> block_offsets{};
+        if (compressed)
+            block_offsets = compressed->finish();
+
+        file_stream.close();
+        if (file_stream.fail())
+            throw std::runtime_error("ERROR: Could not write output file " + file.string() + ".");
+
+        if (line_index)
+            line_index->write(file, block_offsets);
+    }
+
+    // Time the processing waited for the output to be written
+    double stall_seconds() const
+    {
+        return async ? async->stall_seconds() : 0;
+    }
+
+private:
+    std::filesystem::path file{};
+    std::ofstream file_stream{};
+    std::unique_ptr<tabix_index> line_index{};
+    std::unique_ptr<bgzf_output_buffer> compressed{};
+    std::unique_ptr<std::ostream> compressed_stream{};
+    std::unique_ptr<async_output_buffer> async{};
+    std::ostream output{nullptr};
+
+    void start_writing(size_t const num_threads, bool const index)
+    {
+        // The stream reports the error, so it is found when the header is written
+        if (!file_stream.is_open())
+        {
+            output.setstate(std::ios::badbit);
+            return;
+        }
+
+        std::ostream * target = &file_stream;
+        if (is_compressed(file))
+        {
+            if (index)
+                line_index = std::make_unique<tabix_index>();
+            compressed = std::make_unique<bgzf_output_buffer>(file_stream, num_threads, line_index.get());
+            compressed_stream = std::make_unique<std::ostream>(compressed.get());
+            target = compressed_stream.get();
+        }
+
+        async = std::make_unique<async_output_buffer>(*target, file);
+        output.rdbuf(async.get());
+    }
+};
@@ -0,0 +1,511 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Raw PDR and entropy counts of a part of the reads, which are summed by 'RLM merge'
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "columnar_output.hpp"
+#include "counts.hpp"
+#include "output.hpp"
+
+// A partial counts file (.rlmp) starts with the magic string, which ends with the version of the format, the kinds of
+// counts it holds and the names of the reference sequences. It is followed by blocks of counts, each starting with
+// the kind of the counts, the reference sequence, the number of positions and the size of the block (as varints).
+// A block holds the position (as difference to the previous one) and the raw counts of every CpG (or 4-mer) as
+// varints. Blocks of the same kind and reference sequence follow each other in order of position. The file ends
+// with partial_counts_end.
+inline constexpr std::string_view partial_counts_magic{"RLMP\1", 5};
+inline constexpr uint8_t partial_counts_end = 0xff;
+
+enum class partial_counts_kind : uint8_t
+{
+    pdr = 0,
+    entropy = 1
+};
+
+inline bool is_partial_counts_file(std::filesystem::path const & file)
+{
+    return file.extension() == ".rlmp";
+}
+
+// Writes counts to a partial counts file instead of calculating the scores
+class partial_counts_writer
+{
+public:
+    // A resumed run appends to a file that already has its header
+    partial_counts_writer(std::ostream & output_stream,
+                          std::deque<std::string> const & ref_ids,
+                          bool const pdr,
+                          bool const entropy,
+                          bool const resumed = false) :
+        output_stream{output_stream}
+    {
+        if (resumed)
+            return;
+
+        output_stream.write(partial_counts_magic.data(), partial_counts_magic.size());
+        output_stream.put((pdr ? 1 : 0) | (entropy ? 2 : 0));
+        write_value(output_stream, static_cast<uint32_t>(ref_ids.size()));
+        for (auto const & name : ref_ids)
+        {
+            write_value(output_stream, static_cast<uint32_t>(name.size()));
+            output_stream.write(name.data(), name.size());
+        }
+    }
+
+    partial_counts_writer(partial_counts_writer const &) = delete;
+    partial_counts_writer & operator=(partial_counts_writer const &) = delete;
+
+    // Write and remove the counts of all CpGs before the given position. Their counts must not change anymore.
+    void write_pdr(cpg_counts_t & all_CpGs, GenomePosition const & end)
+    {
+        all_CpGs.extract(end, [&] (GenomePosition const & pos,
+                                   num_reads_t const num_reads,
+                                   num_discordant_reads_t const num_discordant_reads,
+                                   sum_transitions_t const sum_transitions,
+                                   num_methyl_cpgs_t const num_methyl_cpgs)
+        {
+            add_position(partial_counts_kind::pdr, pos);
+            write_varint(records, num_reads);
+            write_varint(records, num_discordant_reads);
+            write_varint(records, sum_transitions);
+            write_varint(records, num_methyl_cpgs);
+        });
+        write_block();
+    }
+
+    // Write and remove the counts of all kmers starting before the given position. Their counts must not change anymore.
+    void write_entropy(kmer_counts_t & all_kmers, GenomePosition const & end)
+    {
+        all_kmers.extract(end, [&] (GenomePosition const & pos, epiallele_counts_t const & epialleles)
+        {
+            add_position(partial_counts_kind::entropy, pos);
+            for (uint32_t const count : epialleles)
+                write_varint(records, count);
+        });
+        write_block();
+    }
+
+    void finish()
+    {
+        write_block();
+        output_stream.put(static_cast<char>(partial_counts_end));
+    }
+
+private:
+    static constexpr size_t max_block_size = 1 << 20;
+
+    std::ostream & output_stream;
+    std::string records;
+
+    // The block currently written
+    partial_counts_kind kind = partial_counts_kind::pdr;
+    uint16_t ref_id = 0;
+    uint64_t num_positions = 0;
+    uint64_t last_position = 0;
+
+    void add_position(partial_counts_kind const position_kind, GenomePosition const & pos)
+    {
+        if (num_positions > 0 && (position_kind != kind || pos.ref_id != ref_id || records.size() >= max_block_size))
+            write_block();
+
+        if (num_positions == 0)
+        {
+            kind = position_kind;
+            ref_id = pos.ref_id;
+            last_position = 0;
+        }
+
+        write_varint(records, pos.start - last_position);
+        last_position = pos.start;
+        num_positions++;
+    }
+
+    void write_block()
+    {
+        if (num_positions == 0)
+            return;
+
+        std::string header;
+        header.push_back(static_cast<char>(kind));
+        write_varint(header, ref_id);
+        write_varint(header, num_positions);
+        write_varint(header, records.size());
+
+        output_stream.write(header.data(), header.size());
+        output_stream.write(records.data(), records.size());
+        records.clear();
+        num_positions = 0;
+    }
+};
+
+// Reads the counts of a partial counts file by kind and reference sequence. Only the position of every block is kept
+// in memory, the counts are read when they are needed. Counts of different reference sequences can be read at once
+// by several threads.
+class partial_counts_reader
+{
+public:
+    explicit partial_counts_reader(std::filesystem::path const & file) : file{file}
+    {
+        std::ifstream input{file, std::ios::binary};
+        if (!input.is_open())
+            throw std::runtime_error("ERROR: Could not open " + file.string() + ".");
+
+        std::string magic(partial_counts_magic.size(), '\0');
+        input.read(magic.data(), magic.size());
+        if (magic.substr(0, 4) != partial_counts_magic.substr(0, 4))
+            throw std::runtime_error("ERROR: " + file.string() + " is not a partial counts file.");
+        if (magic != partial_counts_magic)
+            throw std::runtime_error("ERROR: " + file.string() + " was written by an incompatible version of RLM.");
+
+        kinds = input.get();
+
+        uint32_t num_refs = 0;
+        input.read(reinterpret_cast<char *>(&num_refs), sizeof(num_refs));
+        for (uint32_t i = 0; i < num_refs && input; i++)
+        {
+            uint32_t length = 0;
+            input.read(reinterpret_cast<char *>(&length), sizeof(length));
+            std::string name(length, '\0');
+            input.read(name.data(), name.size());
+            ref_ids.push_back(std::move(name));
+        }
+
+        // Index of the blocks, which are skipped
+        while (input)
+        {
+            int const block_kind = input.get();
+            if (block_kind == partial_counts_end)
+                return;
+
+            counts_block block{};
+            block.kind = static_cast<partial_counts_kind>(block_kind);
+            block.ref_id = read_stream_varint(input);
+            block.num_positions = read_stream_varint(input);
+            block.size = read_stream_varint(input);
+            block.offset = input.tellg();
+
+            if (!input)
+                break;
+            if (block_kind > 1 || block.ref_id >= ref_ids.size())
+                throw std::runtime_error("ERROR: Corrupt block in " + file.string() + ".");
+
+            blocks.push_back(block);
+            input.seekg(block.size, std::ios::cur);
+        }
+
+        throw std::runtime_error("ERROR: " + file.string() + " is truncated.");
+    }
+
+    std::filesystem::path const & path() const
+    {
+        return file;
+    }
+
+    std::deque<std::string> const & references() const
+    {
+        return ref_ids;
+    }
+
+    // Whether the file was written with counts of the given kind
+    bool has_counts(partial_counts_kind const kind) const
+    {
+        return kinds & (1 << static_cast<uint8_t>(kind));
+    }
+
+    // Call fn(position, counts) for every CpG of the reference sequence in order of position
+    template <typename fn_t>
+    void read_pdr(size_t const ref_id, fn_t && fn) const
+    {
+        read_blocks(partial_counts_kind::pdr, ref_id, [&] (uint64_t const position, std::string_view const data, size_t & pos)
+        {
+            num_reads_t const num_reads = read_varint(data, pos);
+            num_discordant_reads_t const num_discordant_reads = read_varint(data, pos);
+            sum_transitions_t const sum_transitions = read_varint(data, pos);
+            num_methyl_cpgs_t const num_methyl_cpgs = read_varint(data, pos);
+            fn(position, std::make_tuple(num_reads, num_discordant_reads, sum_transitions, num_methyl_cpgs));
+        });
+    }
+
+    // Call fn(position, epialleles) for every kmer of the reference sequence in order of position
+    template <typename fn_t>
+    void read_entropy(size_t const ref_id, fn_t && fn) const
+    {
+        read_blocks(partial_counts_kind::entropy, ref_id, [&] (uint64_t const position, std::string_view const data, size_t & pos)
+        {
+            epiallele_counts_t epialleles;
+            for (uint32_t & count : epialleles)
+                count = read_varint(data, pos);
+            fn(position, epialleles);
+        });
+    }
+
+private:
+    struct counts_block
+    {
+        partial_counts_kind kind;
+        uint64_t ref_id;
+        uint64_t num_positions;
+        uint64_t size;
+        std::streamoff offset;
+    };
+
+    std::filesystem::path file;
+    std::deque<std::string> ref_ids;
+    uint8_t kinds = 0;
+    std::vector<counts_block> blocks;
+
+    static uint64_t read_stream_varint(std::istream & input)
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && input; shift += 7)
+        {
+            int const byte = input.get();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        return value;
+    }
+
+    // Call decode(position, data, pos) for every position of the blocks of a kind and reference sequence, which reads
+    // the counts from data at pos
+    template <typename decode_t>
+    void read_blocks(partial_counts_kind const kind, size_t const ref_id, decode_t && decode) const
+    {
+        std::ifstream input{};
+        std::string data;
+
+        for (counts_block const & block : blocks)
+        {
+            if (block.kind != kind || block.ref_id != ref_id)
+                continue;
+
+            if (!input.is_open())
+                input.open(file, std::ios::binary);
+
+            data.resize(block.size);
+            input.seekg(block.offset);
+            if (!input.read(data.data(), data.size()))
+                throw std::runtime_error("ERROR: Could not read " + file.string() + ".");
+
+            size_t pos = 0;
+            uint64_t position = 0;
+            for (uint64_t i = 0; i < block.num_positions; i++)
+            {
+                position += read_varint(data, pos);
+                decode(position, data, pos);
+            }
+        }
+    }
+};
+
+// Sum the counts of a reference sequence of all files, which read_counts(partial, fn) passes to fn(position, counts)
+// in order of position. The counts of the files are merged one after another and counts of the same position are
+// added by add_counts(total, counts).
+template <typename counts_t, typename read_t, typename add_t>
+std::vector<std::pair<uint64_t, counts_t> > sum_partial_counts(std::vector<partial_counts_reader> const & partials,
+                                                              read_t && read_counts,
+                                                              add_t && add_counts)
+{
+    std::vector<std::pair<uint64_t, counts_t> > merged;
+    for (partial_counts_reader const & partial : partials)
+    {
+        size_t const middle = merged.size();
+        read_counts(partial, [&] (uint64_t const position, counts_t const & counts)
+        {
+            merged.emplace_back(position, counts);
+        });
+        std::inplace_merge(merged.begin(), merged.begin() + middle, merged.end(), [] (auto const & a, auto const & b)
+        {
+            return a.first < b.first;
+        });
+    }
+
+    size_t num_positions = 0;
+    for (size_t i = 0; i < merged.size(); i++)
+    {
+        if (num_positions > 0 && merged[num_positions - 1].first == merged[i].first)
+            add_counts(merged[num_positions - 1].second, merged[i].second);
+        else
+            merged[num_positions++] = merged[i];
+    }
+    merged.resize(num_positions);
+
+    return merged;
+}
+
+// Sum the counts of all partial counts files, which must have the same reference sequences, and write the outputs of
+// the scores whose output stream is given. The reference sequences are merged in parallel by num_threads threads
+// and written in order, so the outputs are the same as written by a run with the reads of all files.
+inline void merge_partial_counts(std::vector<partial_counts_reader> const & partials,
+                                 std::ostream * pdr_output,
+                                 std::ostream * entropy_output,
+                                 uint32_t const coverage_filter,
+                                 size_t const num_threads)
+{
+    std::deque<std::string> const & ref_ids = partials.front().references();
+
+    struct merged_reference
+    {
+        std::string pdr;
+        std::string entropy;
+        bool done = false;
+    };
+
+    std::vector<merged_reference> results(ref_ids.size());
+    std::atomic<size_t> next_ref{0};
+    size_t num_written = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::exception_ptr error{};
+
+    auto merge_pdr = [&] (size_t const ref_id)
+    {
+        using counts_t = std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t>;
+        auto merged = sum_partial_counts<counts_t>(partials, [&] (partial_counts_reader const & partial, auto && fn)
+        {
+            partial.read_pdr(ref_id, fn);
+        },
+        [] (counts_t & total, counts_t const & counts)
+        {
+            std::get<0>(total) += std::get<0>(counts);
+            std::get<1>(total) += std::get<1>(counts);
+            std::get<2>(total) += std::get<2>(counts);
+            std::get<3>(total) += std::get<3>(counts);
+        });
+
+        std::ostringstream output;
+        {
+            text_writer writer{output};
+            for (auto const & [position, counts] : merged)
+                write_record_pdr(writer, ref_ids, GenomePosition{static_cast<uint16_t>(ref_id), position}, counts, coverage_filter);
+        }
+        return output.str();
+    };
+
+    auto merge_entropy = [&] (size_t const ref_id)
+    {
+        auto merged = sum_partial_counts<epiallele_counts_t>(partials, [&] (partial_counts_reader const & partial, auto && fn)
+        {
+            partial.read_entropy(ref_id, fn);
+        },
+        [] (epiallele_counts_t & total, epiallele_counts_t const & counts)
+        {
+            for (size_t i = 0; i < total.size(); i++)
+                total[i] += counts[i];
+        });
+
+        std::ostringstream output;
+        {
+            text_writer writer{output};
+            for (auto const & [position, epialleles] : merged)
+                write_record_entropy(writer, ref_ids, GenomePosition{static_cast<uint16_t>(ref_id), position}, epialleles, coverage_filter);
+        }
+        return output.str();
+    };
+
+    // Workers merge at most this many reference sequences ahead of the one written next
+    size_t const max_pending = 2 * num_threads;
+
+    auto worker = [&] ()
+    {
+        try
+        {
+            for (size_t ref_id = next_ref++; ref_id < ref_ids.size(); ref_id = next_ref++)
+            {
+                {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    changed.wait(lock, [&] { return ref_id < num_written + max_pending || error; });
+                    if (error)
+                        return;
+                }
+
+                merged_reference result{};
+                if (pdr_output)
+                    result.pdr = merge_pdr(ref_id);
+                if (entropy_output)
+                    result.entropy = merge_entropy(ref_id);
+                result.done = true;
+
+                std::lock_guard<std::mutex> lock{mutex};
+                results[ref_id] = std::move(result);
+                changed.notify_all();
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (!error)
+                error = std::current_exception();
+            next_ref = ref_ids.size();
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min<size_t>(num_threads, ref_ids.size()); i++)
+        workers.emplace_back(worker);
+
+    for (size_t ref_id = 0; ref_id < ref_ids.size(); ref_id++)
+    {
+        merged_reference result{};
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            changed.wait(lock, [&] { return results[ref_id].done || error; });
+            if (error)
+                break;
+            result = std::move(results[ref_id]);
+        }
+
+        if (pdr_output)
+            *pdr_output << result.pdr;
+        if (entropy_output)
+            *entropy_output << result.entropy;
+
+        std::lock_guard<std::mutex> lock{mutex};
+        num_written = ref_id + 1;
+        changed.notify_all();
+    }
+
+    for (auto & thread : workers)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
@@ -0,0 +1,413 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Processing of reads on multiple threads while the BAM file is read
+// ==========================================================================
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "counts.hpp"
+#include "epiallele_cache.hpp"
+#include "mate_buffer.hpp"
+#include "process_record.hpp"
+#include "reference.hpp"
+#include "text_writer.hpp"
+
+// Reads (after filtering, clipping and pairing of mates) collected by the reading thread and processed by one worker
+struct read_batch
+{
+    struct read
+    {
+        read_type type;
+        uint16_t ref_id;
+        uint64_t position;
+        size_t bases_begin;
+        size_t length;
+        size_t name_begin;
+        size_t name_length;
+    };
+
+    uint64_t number{};
+    std::vector<seqan3::dna5> bases{};              // Bases of all reads, one after another
+    std::string names{};                            // Names of all reads, one after another
+    std::vector<read> reads{};
+    std::optional<GenomePosition> final_position{}; // Counts before it are final once this batch is counted
+
+    std::string output{};                           // Single read output of all reads
+    std::string cache{};                            // Epiallele cache records of all reads
+};
+
+// Reads are collected into batches by the reading thread, processed by the workers and their output is written in
+// the order of the reads by a writer thread. Every worker adds its reads to its own CpG and kmer counts, which are
+// merged into the total counts before counts are written, so output and counts are identical to processing the reads
+// on one thread.
+template <bool calc_pdr_score, bool calc_entropy_score>
+class read_pipeline
+{
+public:
+    read_pipeline(size_t const num_workers,
+                  text_writer & output_stream,
+                  std::deque<std::string> const & ref_ids,
+                  reference_genome & reference,
+                  bool const sorted,
+                  cpg_counts_t & all_CpGs,
+                  kmer_counts_t & all_kmers,
+                  epiallele_cache_writer * cache,
+                  std::function<void(GenomePosition const &)> write_final_counts) :
+        output_stream{output_stream},
+        ref_ids{ref_ids},
+        reference{reference},
+        sorted{sorted},
+        all_CpGs{all_CpGs},
+        all_kmers{all_kmers},
+        cache{cache},
+        write_final_counts{std::move(write_final_counts)},
+        max_batches{4 * num_workers},
+        worker_CpGs{num_workers},
+        worker_kmers{num_workers},
+        current{std::make_unique<read_batch>()}
+    {
+        for (size_t i = 0; i < num_workers; i++)
+            workers.emplace_back([this, i] () { run_worker(i); });
+        writer = std::thread{[this] () { run_writer(); }};
+    }
+
+    read_pipeline(read_pipeline const &) = delete;
+    read_pipeline & operator=(read_pipeline const &) = delete;
+
+    ~read_pipeline()
+    {
+        if (writer.joinable())
+        {
+            stop(nullptr);
+            join();
+        }
+    }
+
+    // Add a read to the current batch
+    void add(read_type const type, size_t const ref_id, read_view const & view, std::string const & id)
+    {
+        current->reads.push_back(read_batch::read{type,
+                                                  static_cast<uint16_t>(ref_id),
+                                                  view.position,
+                                                  current->bases.size(),
+                                                  view.size(),
+                                                  current->names.size(),
+                                                  id.size()});
+        current->bases.insert(current->bases.end(), view.first.begin(), view.first.end());
+        current->bases.insert(current->bases.end(), view.second.begin(), view.second.end());
+        current->names.append(id);
+
+        if (current->reads.size() >= batch_size)
+            submit();
+    }
+
+    // The counts before end are final once all reads added so far are counted
+    void final_position(GenomePosition const & end)
+    {
+        current->final_position = end;
+        submit();
+    }
+
+    // Process all reads added so far, wait for their output to be written and merge their counts into the total counts
+    void wait()
+    {
+        if (!current->reads.empty() || current->final_position)
+            submit();
+
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            batch_written.wait(lock, [this] () { return stopped || num_written == num_submitted; });
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        merge_counts();
+    }
+
+    // Process all remaining reads and wait for the output to be written
+    void finish()
+    {
+        if (!current->reads.empty() || current->final_position)
+            submit();
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            closed = true;
+        }
+        work_available.notify_all();
+        batch_done.notify_all();
+
+        join();
+
+        if (error)
+            std::rethrow_exception(error);
+
+        merge_counts();
+    }
+
+private:
+    static constexpr size_t batch_size = 4096;
+
+    text_writer & output_stream;
+    std::deque<std::string> const & ref_ids;
+    reference_genome & reference;
+    bool sorted;
+    cpg_counts_t & all_CpGs;
+    kmer_counts_t & all_kmers;
+    epiallele_cache_writer * cache;
+    std::function<void(GenomePosition const &)> write_final_counts;
+
+    // Batches that are submitted but not written yet, at most max_batches
+    size_t max_batches;
+    uint64_t num_submitted = 0;
+    uint64_t num_written = 0;
+
+    // Counts of the reads processed by every worker that are not merged into the total counts yet
+    concurrent_counts<cpg_counts_t> worker_CpGs;
+    concurrent_counts<kmer_counts_t> worker_kmers;
+
+    std::unique_ptr<read_batch> current;
+    std::deque<std::unique_ptr<read_batch> > work;
+    std::map<uint64_t, std::unique_ptr<read_batch> > done;
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable batch_done;
+    std::condition_variable batch_written;
+    bool closed = false;
+    bool stopped = false;
+    std::exception_ptr error{};
+
+    std::vector<std::thread> workers;
+    std::thread writer;
+
+    void submit()
+    {
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            batch_written.wait(lock, [this] () { return stopped || num_submitted - num_written < max_batches; });
+
+            if (error)
+                std::rethrow_exception(error);
+            if (stopped)
+                return;
+
+            current->number = num_submitted++;
+            work.push_back(std::move(current));
+        }
+        work_available.notify_one();
+
+        current = std::make_unique<read_batch>();
+    }
+
+    // Stop all threads after an error (or if the pipeline is destroyed without being finished)
+    void stop(std::exception_ptr const & exception)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (!error)
+                error = exception;
+            stopped = true;
+        }
+        work_available.notify_all();
+        batch_done.notify_all();
+        batch_written.notify_all();
+    }
+
+    void join()
+    {
+        for (auto & worker : workers)
+            worker.join();
+        writer.join();
+    }
+
+    void merge_counts()
+    {
+        if constexpr (calc_pdr_score)
+            worker_CpGs.merge_into(all_CpGs);
+        if constexpr (calc_entropy_score)
+            worker_kmers.merge_into(all_kmers);
+    }
+
+    void run_worker(size_t const worker)
+    {
+        try
+        {
+            reference_cache worker_reference{reference, sorted};
+
+            while (true)
+            {
+                std::unique_ptr<read_batch> batch;
+                {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    work_available.wait(lock, [this] () { return stopped || closed || !work.empty(); });
+
+                    if (stopped || work.empty())
+                        return;
+
+                    batch = std::move(work.front());
+                    work.pop_front();
+                }
+
+                process(*batch, worker, worker_reference);
+
+                {
+                    std::lock_guard<std::mutex> lock{mutex};
+                    done.emplace(batch->number, std::move(batch));
+                }
+                batch_done.notify_all();
+            }
+        }
+        catch (...)
+        {
+            stop(std::current_exception());
+        }
+    }
+
+    // Single read output of the reads of a batch, their scores are added to the counts of the worker
+    void process(read_batch & batch, size_t const worker, reference_cache & worker_reference)
+    {
+        // Buffers are reused for all reads of a thread
+        thread_local std::vector<uint16_t> cpg_pos;
+        thread_local methylation_pattern pattern;
+        thread_local std::string id;
+
+        std::ostringstream output;
+        text_writer writer{output, text_writer::default_capacity, output_stream.line_keys()};
+        std::span<seqan3::dna5 const> bases{batch.bases};
+
+        auto [CpGs_lock, CpGs] = worker_CpGs.local(worker);
+        auto [kmers_lock, kmers] = worker_kmers.local(worker);
+
+        for (read_batch::read const & read : batch.reads)
+        {
+            cpg_table const & cpgs = worker_reference[read.ref_id];
+            size_t first_cpg = 0;
+            id.assign(batch.names, read.name_begin, read.name_length);
+
+            bool skip = process_bam_record_impl(writer,
+                                                read.type,
+                                                read.ref_id,
+                                                read_view{read.position, bases.subspan(read.bases_begin, read.length)},
+                                                id,
+                                                ref_ids,
+                                                cpgs,
+                                                cpg_pos,
+                                                first_cpg,
+                                                pattern);
+
+            if (skip)
+                continue;
+
+            if (cache)
+                epiallele_cache_writer::encode_read(batch.cache, read.ref_id, first_cpg, pattern);
+
+            if constexpr (calc_pdr_score)
+                insert_CpG(read.ref_id, cpgs, first_cpg, CpGs, pattern);
+            if constexpr (calc_entropy_score)
+                insert_kmer(read.ref_id, cpgs, first_cpg, kmers, pattern);
+        }
+
+        writer.flush();
+        batch.output = std::move(output).str();
+    }
+
+    void run_writer()
+    {
+        try
+        {
+            while (true)
+            {
+                std::unique_ptr<read_batch> batch;
+                {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    batch_done.wait(lock, [this] ()
+                    {
+                        return stopped || done.contains(num_written) || (closed && num_written == num_submitted);
+                    });
+
+                    if (stopped || !done.contains(num_written))
+                        return;
+
+                    batch = std::move(done.extract(num_written).mapped());
+                }
+
+                output_stream << std::string_view{batch->output};
+                if (cache)
+                    cache->add_records(batch->cache);
+
+                // All batches up to this one are counted. Workers may have counted later batches already, but their
+                // reads start behind the final position and do not change the counts that are written.
+                if (batch->final_position)
+                {
+                    merge_counts();
+                    write_final_counts(batch->final_position.value());
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock{mutex};
+                    num_written++;
+                }
+                batch_written.notify_all();
+            }
+        }
+        catch (...)
+        {
+            stop(std::current_exception());
+        }
+    }
+};
+
+// Passes reads to a pipeline instead of processing them
+template <typename pipeline_t>
+struct pipeline_processor
+{
+    pipeline_t & pipeline;
+
+    // Positions in the output are only needed to pair mates read by different shards
+    std::streamoff position() const
+    {
+        return 0;
+    }
+
+    void operator()(read_type const & type, size_t const ref_id, read_view const & read, std::string const & id) const
+    {
+        pipeline.add(type, ref_id, read, id);
+    }
+
+    void operator()(read_type const & type, mate_read const & read) const
+    {
+        (*this)(type, read.ref_id, read_view{read.position, read.bases()}, read.id);
+    }
+};
@@ -0,0 +1,638 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Functions to process all records of a BAM file, serially or in shards
+// ==========================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "argument_parsing.hpp"
+#include "bam_index.hpp"
+#include "mate_buffer.hpp"
+#include "process_record.hpp"
+#include "reference.hpp"
+
+using seqan3::operator""_tag;
+using seqan3::operator""_cigar_operation;
+
+// Get the strand a read originates from using the tag set by the aligner
+template <align_type aligner, typename record_t>
+read_type get_read_type(record_t & rec)
+{
+    if constexpr (aligner == align_type::BSMAP)
+    {
+        return _read_tag_bsmap_to_enum(rec.tags().template get<"ZS"_tag>());
+    }
+    else if constexpr (aligner == align_type::BISMARK)
+    {
+        return _read_tag_bismark_to_enum(rec.tags().template get<"XG"_tag>());
+    }
+    else
+    {
+        // SEGEMEHL declares XB tag as string while GEM declares XB tag as char
+        // Therefore no overload for seqan3::sam_tag_type is possible and need to iterate through
+        // std::variant types
+        auto current_tag = rec.tags()["XB"_tag];
+
+        std::string xb_tag;
+
+        std::visit([&xb_tag] (auto && arg)
+        {
+            using T = std::remove_cvref_t<decltype(arg)>;
+
+            if constexpr(std::is_same_v<T, char>)
+            {
+                xb_tag = std::string(1, arg);
+            }
+            else if constexpr (std::is_same_v<T, std::string>)
+            {
+                xb_tag = arg;
+            }
+            else
+            {
+                throw "Invalid type for XB tag. Must be either string (segemehl) or char (GEM).";
+            }
+        }, current_tag);
+
+        if constexpr (aligner == align_type::SEGEMEHL)
+            return _read_tag_segemehl_to_enum(xb_tag);
+        else
+            return _read_tag_gem_to_enum(xb_tag);
+    }
+}
+
+// Processes reads into the single read output and the CpG and kmer counts
+template <typename score_tag_t>
+struct read_processor
+{
+    text_writer & output_stream;
+    std::deque<std::string> const & ref_ids;
+    reference_cache & reference;
+    cpg_counts_t & all_CpGs;
+    kmer_counts_t & all_kmers;
+
+    // Positions in the output are only needed to pair mates read by different shards
+    bool track_positions = false;
+
+    // Epialleles of the processed reads are added to the cache if there is one
+    epiallele_cache_writer * cache = nullptr;
+
+    std::streamoff position() const
+    {
+        return track_positions ? output_stream.position() : 0;
+    }
+
+    void operator()(read_type const & type, size_t const ref_id, read_view const & read, std::string const & id) const
+    {
+        process_bam_record(output_stream,
+                           type,
+                           ref_id,
+                           read,
+                           id,
+                           ref_ids,
+                           reference[ref_id],
+                           all_CpGs,
+                           all_kmers,
+                           cache,
+                           score_tag_t{});
+    }
+
+    void operator()(read_type const & type, mate_read const & read) const
+    {
+        (*this)(type, read.ref_id, read_view{read.position, read.bases()}, read.id);
+    }
+};
+
+// Process two mates together
+template <typename processor_t>
+void process_mates(mate_read const & stored_read, mate_read const & read, read_type const & rec_type, processor_t const & process)
+{
+    // Check if reads are overlapping
+    int overlap = std::min(stored_read.length + stored_read.position,
+                           read.length + read.position) -
+                  std::max(stored_read.position, read.position);
+
+    if (overlap >= 0 & (read.ref_id == stored_read.ref_id))
+    {
+        // First check if one read is included in the other - just process the longer one in this case
+        if (overlap == stored_read.length)
+        {
+            // First read included in second read
+            process(rec_type, read);
+        }
+        else if (overlap == read.length)
+        {
+            // Second read included in first read
+            process(rec_type, stored_read);
+        }
+        else
+        {
+            // Merge reads: the bases of the first read followed by the bases of the second read behind it
+            // Determine which read comes first
+            bool is_first = stored_read.position <= read.position;
+            auto & read1 = is_first ? stored_read : read;
+            auto & read2 = is_first ? read : stored_read;
+
+            process(rec_type, read1.ref_id, read_view{read1.position, read1.bases(), read2.bases().subspan(overlap)}, read1.id);
+        }
+    }
+    else
+    {
+        // Process both mates
+        process(rec_type, stored_read);
+        process(rec_type, read);
+    }
+}
+
+// Pair a read with its mate if that has already been read, otherwise keep it until the mate is read
+template <typename processor_t>
+void pair_mate(mate_buffer & mates, mate_read && read, processor_t const & process)
+{
+    std::optional<mate_read> mate = mates.take(read);
+
+    if (!mate)
+    {
+        mates.insert(std::move(read));
+        return;
+    }
+
+    if (read.indel)
+    {
+        // Read had indels: process stored mate on its own
+        if (!mate->indel)
+            process(read.type, mate.value());
+    }
+    else if (mate->indel)
+    {
+        // Mate had indels: process read on its own
+        process(read.type, read);
+    }
+    else
+    {
+        process_mates(mate.value(), read, read.type, process);
+    }
+}
+
+// Read of a pair with the alignment positions of the read and its mate
+template <typename record_t>
+mate_read make_mate_read(record_t & rec, read_type const type, bool const indel, uint64_t const order, std::streamoff const offset)
+{
+    // The read name is not needed in the record anymore
+    return mate_read{read_name_key(rec.id()),
+                     std::move(rec.id()),
+                     type,
+                     indel,
+                     static_cast<uint16_t>(rec.reference_id().value()),
+                     static_cast<uint64_t>(rec.reference_position().value()),
+                     static_cast<uint64_t>(rec.reference_position().value()),
+                     rec.mate_position() ? static_cast<uint64_t>(rec.mate_position().value()) : unknown_position,
+                     {},
+                     0,
+                     0,
+                     order,
+                     offset};
+}
+
+// Process a single BAM record
+template <bool rrbs, bool single_end, align_type aligner, typename record_t, typename processor_t>
+void process_alignment(record_t & rec,
+                       uint32_t const mapq_filter,
+                       mate_buffer & mates,
+                       uint64_t const order,
+                       processor_t const & process,
+                       bool const mate_skipped = false)
+{
+    // Check if read is properly mapped and paired (if PE mode), not vendor-failed, not supplementary
+    // or secondary alignment and not PCR duplicate
+    if ((!static_cast<bool>(rec.flag() & seqan3::sam_flag::paired) && !single_end) ||
+        static_cast<bool>(rec.flag() & seqan3::sam_flag::unmapped) ||
+        static_cast<bool>(rec.flag() & seqan3::sam_flag::secondary_alignment) ||
+        static_cast<bool>(rec.flag() & seqan3::sam_flag::failed_filter) ||
+        static_cast<bool>(rec.flag() & seqan3::sam_flag::duplicate) ||
+        static_cast<bool>(rec.flag() & seqan3::sam_flag::supplementary_alignment) ||
+        rec.mapping_quality() < mapq_filter)
+        return;
+
+    // Check if alignment contains indels: If yes, skip record.
+    using seqan3::get;
+    bool indel = false;
+    bool soft_clip = false;
+    for (auto c : rec.cigar_sequence())
+    {
+        if (get<seqan3::cigar::operation>(c) != 'M'_cigar_operation &&
+            get<seqan3::cigar::operation>(c) != 'H'_cigar_operation)
+        {
+            if (get<seqan3::cigar::operation>(c) == 'S'_cigar_operation)
+            {
+                soft_clip = true;
+            }
+            else
+            {
+                indel = true;
+                break;
+            }
+        }
+    }
+
+    // Mates that are unmapped, mapped to another reference sequence or skipped outside of the targets are not paired
+    bool unpaired_mate = mate_skipped ||
+                         static_cast<bool>(rec.flag() & seqan3::sam_flag::mate_unmapped) ||
+                         (rec.mate_reference_id() && rec.mate_reference_id() != rec.reference_id());
+
+    if (indel)
+    {
+        // Mate is processed on its own
+        if constexpr(!single_end)
+        {
+            if (!unpaired_mate)
+                pair_mate(mates, make_mate_read(rec, get_read_type<aligner>(rec), true, order, process.position()), process);
+        }
+        return;
+    }
+
+    // Bases of the read that are processed. Clipped bases are skipped without copying the sequence.
+    auto const & cigar = rec.cigar_sequence();
+    size_t begin = 0;
+    size_t length = rec.sequence().size();
+
+    // Check if alignment was soft clipped: If yes adapt read sequence
+    if (soft_clip)
+    {
+        if (get<seqan3::cigar::operation>(cigar[0]) == 'S'_cigar_operation)
+        {
+            // If 5p soft clipping
+            begin = get<uint32_t>(cigar[0]);
+        }
+        else if (get<seqan3::cigar::operation>(cigar[0]) == 'H'_cigar_operation &&
+                 get<seqan3::cigar::operation>(cigar[1]) == 'S'_cigar_operation)
+        {
+            // If 5p soft clipping after hard clipping
+            begin = get<uint32_t>(cigar[1]);
+        }
+        length -= begin;
+
+        if (get<seqan3::cigar::operation>(cigar[cigar.size() - 1]) == 'S'_cigar_operation)
+        {
+            // If 3p soft clipping
+            length -= get<uint32_t>(cigar[cigar.size() - 1]);
+        }
+        else if (get<seqan3::cigar::operation>(cigar[cigar.size() - 1]) == 'H'_cigar_operation &&
+                 get<seqan3::cigar::operation>(cigar[cigar.size() - 2]) == 'S'_cigar_operation)
+        {
+            // If 3p soft clipping before hard clipping
+            length -= get<uint32_t>(cigar[cigar.size() - 2]);
+        }
+    }
+
+    read_type rec_type = get_read_type<aligner>(rec);
+    uint64_t position = rec.reference_position().value();
+
+    // If RRBS mode, omit potentially artificial bases (should not be applied if already trimmed/accounted for)
+    if constexpr (rrbs)
+    {
+        if ((rec_type == read_type::FWD && !static_cast<bool>(rec.flag() & seqan3::sam_flag::on_reverse_strand)) ||
+            (rec_type == read_type::REV && static_cast<bool>(rec.flag() & seqan3::sam_flag::on_reverse_strand)))
+        {
+            length -= std::min<size_t>(length, 2);
+        }
+        else
+        {
+            begin += std::min<size_t>(length, 2);
+            length -= std::min<size_t>(length, 2);
+            position += 2;
+        }
+    }
+
+    // If mate is unmapped or on another reference sequence just process read immediately. This keeps reads on
+    // one reference sequence independent of all others.
+    if (single_end || unpaired_mate)
+    {
+        read_view read{position, std::span<seqan3::dna5 const>{rec.sequence()}.subspan(begin, length)};
+        process(rec_type, rec.reference_id().value(), read, rec.id());
+    }
+    else
+    {
+        mate_read read = make_mate_read(rec, rec_type, false, order, process.position());
+        read.position = position;
+        read.sequence = std::move(rec.sequence());
+        read.begin = begin;
+        read.length = length;
+        pair_mate(mates, std::move(read), process);
+    }
+}
+
+// Part of a reference sequence processed independently: all reads starting in [start, end)
+struct bam_shard
+{
+    size_t ref_id;
+    uint64_t start;
+    uint64_t end;
+};
+
+// Default for process_bam_file if nothing needs to be done at the position of a read
+struct ignore_position
+{
+    void operator()(GenomePosition const &) const
+    {}
+};
+
+// Process all records of a BAM file (or of one shard of it) and return the number of records read.
+// on_position is called with the position of every read before it is processed. When continuing from a checkpoint,
+// the reads of the position sorted file that start before resume_position were already processed and are skipped.
+template <bool rrbs,
+          bool single_end,
+          align_type aligner,
+          typename mapping_file_t,
+          typename processor_t,
+          typename position_handler_t = ignore_position>
+uint64_t process_bam_file(mapping_file_t & mapping_file,
+                          uint32_t const mapq_filter,
+                          target_regions const & targets,
+                          std::optional<bam_shard> const & shard,
+                          mate_buffer & mates,
+                          processor_t const & process,
+                          position_handler_t && on_position = {},
+                          std::optional<GenomePosition> const & resume_position = std::nullopt)
+{
+    uint64_t num_records = 0;
+
+    for (auto & rec : mapping_file)
+    {
+        if (resume_position && rec.reference_id() && rec.reference_position() &&
+            GenomePosition{static_cast<uint16_t>(rec.reference_id().value()),
+                           static_cast<uint64_t>(rec.reference_position().value())} < resume_position.value())
+            continue;
+
+        // Reads overlapping the boundary of a shard belong to the shard they start in. Shards are only used for
+        // indexed and therefore position sorted files, so no more reads of the shard follow the first read behind it.
+        if (shard)
+        {
+            if (!rec.reference_id())
+                break;
+
+            size_t const ref_id = static_cast<size_t>(rec.reference_id().value());
+            if (ref_id > shard->ref_id ||
+                (ref_id == shard->ref_id && static_cast<uint64_t>(rec.reference_position().value_or(0)) >= shard->end))
+                break;
+
+            if (ref_id < shard->ref_id || !rec.reference_position() ||
+                static_cast<uint64_t>(rec.reference_position().value()) < shard->start)
+                continue;
+        }
+
+        num_records++;
+
+        // Skip reads outside of the target regions before looking at them any further. A read whose mate (assumed to
+        // be as long as the read) is skipped this way is processed unpaired instead of waiting for it.
+        bool mate_skipped = false;
+        if (targets.active())
+        {
+            if (!rec.reference_id() || !rec.reference_position())
+                continue;
+
+            auto overlaps_target = [&] (uint64_t const start)
+            {
+                return targets.overlaps(rec.reference_id().value(), start, start + rec.sequence().size());
+            };
+
+            if (!overlaps_target(rec.reference_position().value()))
+                continue;
+            mate_skipped = rec.mate_reference_id() == rec.reference_id() && rec.mate_position() &&
+                           !overlaps_target(rec.mate_position().value());
+        }
+
+        if (rec.reference_id() && rec.reference_position())
+            on_position(GenomePosition{static_cast<uint16_t>(rec.reference_id().value()),
+                                       static_cast<uint64_t>(rec.reference_position().value())});
+
+        process_alignment<rrbs, single_end, aligner>(rec, mapq_filter, mates, num_records, process, mate_skipped);
+    }
+
+    return num_records;
+}
+
+// Add the counts of a shard to the total counts
+inline void merge_counts(cpg_counts_t & all_CpGs, cpg_counts_t & shard_CpGs)
+{
+    all_CpGs.merge(shard_CpGs);
+}
+
+inline void merge_counts(kmer_counts_t & all_kmers, kmer_counts_t & shard_kmers)
+{
+    all_kmers.merge(shard_kmers);
+}
+
+// Split the reference sequences (or only those with target regions) into shards of at most shard_size bp
+inline std::vector<bam_shard> make_shards(reference_genome const & reference,
+                                          target_regions const & targets,
+                                          uint64_t const shard_size)
+{
+    std::vector<bam_shard> shards;
+
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        if (targets.active() && targets.by_reference()[i].empty())
+            continue;
+
+        uint64_t length = std::max<uint64_t>(reference.length(i), 1);
+        uint64_t step = shard_size == 0 ? length : shard_size;
+
+        for (uint64_t start = 0; start < length; start += step)
+            shards.push_back(bam_shard{i, start, std::min(start + step, length)});
+    }
+
+    return shards;
+}
+
+// Process the shards of an indexed BAM file in parallel. The single read output of every shard is written to a
+// temporary file and appended to output_stream in the order of the shards, which gives the same output as
+// processing the whole file serially. on_shard_end is called with the end of every shard once its output is appended.
+template <bool rrbs,
+          bool single_end,
+          align_type aligner,
+          typename mapping_file_t,
+          typename score_tag_t,
+          typename position_handler_t = ignore_position>
+uint64_t process_bam_file_sharded(cmd_arguments const & args,
+                                  bam_index const & index,
+                                  std::vector<bam_shard> const & shards,
+                                  target_regions const & targets,
+                                  std::deque<std::string> const & ref_ids,
+                                  reference_genome & reference,
+                                  std::ostream & output_stream,
+                                  cpg_counts_t & all_CpGs,
+                                  kmer_counts_t & all_kmers,
+                                  mate_buffer & mates,
+                                  score_tag_t,
+                                  position_handler_t && on_shard_end = {})
+{
+    struct shard_result
+    {
+        std::filesystem::path output_file;
+        mate_buffer mates{true};
+        uint64_t num_records = 0;
+    };
+
+    std::vector<shard_result> results(shards.size());
+    std::atomic<size_t> next_shard{0};
+    std::mutex counts_mutex;
+    std::exception_ptr error{};
+
+    auto worker = [&] ()
+    {
+        try
+        {
+            // Shards are ordered by reference sequence, so a worker mostly needs one sequence at a time
+            reference_cache worker_reference{reference, true};
+
+            for (size_t i = next_shard++; i < shards.size(); i = next_shard++)
+            {
+                bam_shard const & shard = shards[i];
+                shard_result & result = results[i];
+
+                std::vector<bgzf_chunk> chunks;
+                if (targets.active())
+                {
+                    for (auto const & interval : targets.by_reference()[shard.ref_id])
+                    {
+                        if (interval.start >= shard.end || interval.end <= shard.start)
+                            continue;
+                        std::vector<bgzf_chunk> interval_chunks = index.query(shard.ref_id, interval.start, interval.end);
+                        chunks.insert(chunks.end(), interval_chunks.begin(), interval_chunks.end());
+                    }
+                }
+                else
+                {
+                    // Read from the first chunk that can contain reads of the shard until the first read behind it
+                    std::vector<bgzf_chunk> shard_chunks = index.query(shard.ref_id, shard.start, shard.end);
+                    if (!shard_chunks.empty())
+                        chunks.push_back(bgzf_chunk{shard_chunks.front().begin, std::numeric_limits<uint64_t>::max()});
+                }
+
+                bgzf_region_streambuf region_buffer{args.bam_file, bam_index::merge_chunks(std::move(chunks))};
+                std::istream region_stream{&region_buffer};
+                mapping_file_t mapping_file{region_stream, seqan3::format_bam{}};
+
+                result.output_file = args.output_file_single_reads.string() + ".shard" + std::to_string(i);
+                std::ofstream shard_output{result.output_file};
+                if (!shard_output.is_open())
+                    throw std::runtime_error("ERROR: Could not open temporary output file " + result.output_file.string() + ".");
+                text_writer shard_writer{shard_output, text_writer::default_capacity, args.sort_single_read};
+
+                cpg_counts_t shard_CpGs;
+                kmer_counts_t shard_kmers;
+                read_processor<score_tag_t> process{shard_writer, ref_ids, worker_reference, shard_CpGs, shard_kmers, true};
+
+                result.num_records = process_bam_file<rrbs, single_end, aligner>(mapping_file,
+                                                                                 args.mapq_filter,
+                                                                                 targets,
+                                                                                 shard,
+                                                                                 result.mates,
+                                                                                 process);
+
+                std::lock_guard<std::mutex> lock{counts_mutex};
+                merge_counts(all_CpGs, shard_CpGs);
+                merge_counts(all_kmers, shard_kmers);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock{counts_mutex};
+            if (!error)
+                error = std::current_exception();
+            next_shard = shards.size();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min<size_t>(args.threads, shards.size()); i++)
+        workers.emplace_back(worker);
+    for (auto & thread : workers)
+        thread.join();
+
+    if (error)
+    {
+        for (auto const & result : results)
+            if (!result.output_file.empty())
+                std::filesystem::remove(result.output_file);
+        std::rethrow_exception(error);
+    }
+
+    // Pair mates that were read by different shards in the order in which they would have been read serially.
+    // Their output is inserted at the position in the single read output where the second mate was read.
+    reference_cache mate_reference{reference, true};
+    uint64_t num_records = 0;
+    std::vector<char> buffer(1 << 20);
+
+    // Copy up to n bytes of a shard output
+    auto copy_output = [&] (std::ifstream & shard_output, std::streamoff n)
+    {
+        while (n > 0 && shard_output.read(buffer.data(), std::min<std::streamoff>(n, buffer.size())).gcount() > 0)
+        {
+            output_stream.write(buffer.data(), shard_output.gcount());
+            n -= shard_output.gcount();
+        }
+    };
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        shard_result & result = results[i];
+        num_records += result.num_records;
+
+        std::ifstream shard_output{result.output_file};
+        std::streamoff position = 0;
+
+        for (mate_read & read : result.mates.release())
+        {
+            std::ostringstream mate_output;
+            text_writer mate_writer{mate_output, 1 << 12, args.sort_single_read};
+            read_processor<score_tag_t> process{mate_writer, ref_ids, mate_reference, all_CpGs, all_kmers};
+            std::streamoff offset = read.offset;
+            pair_mate(mates, std::move(read), process);
+            mate_writer.flush();
+
+            if (mate_output.tellp() <= 0)
+                continue;
+
+            copy_output(shard_output, offset - position);
+            position = offset;
+            output_stream << mate_output.str();
+        }
+
+        copy_output(shard_output, std::numeric_limits<std::streamoff>::max());
+        shard_output.close();
+        std::filesystem::remove(result.output_file);
+
+        on_shard_end(GenomePosition{static_cast<uint16_t>(shards[i].ref_id), shards[i].end});
+    }
+
+    return num_records;
+}
@@ -21,113 +21,82 @@
 
 #pragma once
 
+#include <span>
+
+#include "counts.hpp"
+#include "epiallele_cache.hpp"
+#include "methylation_call.hpp"
 #include "methylation_scores.hpp"
+#include "output.hpp"
+#include "text_writer.hpp"
 
 using seqan3::operator""_dna5;
 using num_reads_t = uint32_t;
 using num_discordant_reads_t = uint32_t;
-using sum_transitions_t = double;
+using sum_transitions_t = uint64_t;
 using num_methyl_cpgs_t = uint32_t;
 
-// Find positions of all CpGs in a sequence
-template <typename ref_type>
-std::vector<uint16_t> find_cpg_pos(ref_type const & reference)
+// Find positions of all CpGs covered by a read relative to the read start, given the sorted CpG positions of the
+// reference sequence. first_cpg is set to the ordinal of the first of them among the CpGs of the reference sequence.
+void find_cpg_pos(std::span<uint32_t const> reference_cpgs,
+                  size_t const reference_position,
+                  size_t const read_length,
+                  size_t & first_cpg,
+                  std::vector<uint16_t> & occurrencs)
 {
-    std::vector<uint16_t> occurrencs;
-    seqan3::dna5_vector pattern = "CG"_dna5;
-    auto cpg_pos = std::search(reference.begin(), reference.end(), pattern.begin(), pattern.end());
-    while (cpg_pos != reference.end())
-    {
-        occurrencs.push_back(cpg_pos - reference.begin());
-        ++cpg_pos;
-        cpg_pos = std::search(cpg_pos, reference.end(), pattern.begin(), pattern.end());
-    }
-    return occurrencs;
+    occurrencs.clear();
+
+    // Both bases of the CpG must be covered by the read
+    auto first = std::lower_bound(reference_cpgs.begin(), reference_cpgs.end(), reference_position);
+    first_cpg = first - reference_cpgs.begin();
+
+    if (read_length < 2)
+        return;
+
+    auto last = std::lower_bound(first, reference_cpgs.end(), reference_position + read_length - 1);
+
+    for (auto it = first; it != last; ++it)
+        occurrencs.push_back(*it - reference_position);
 }
 
-// Insert CpG into map to store it until all BAM records are read
+// Add the read to the counts of its CpGs to store them until all BAM records are read
 void insert_CpG(size_t const & reference_id,
-                size_t const & reference_position,
-                std::map<GenomePosition, std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> > & all_CpGs,
-                std::vector<uint16_t> const & cpg_pos,
-                std::vector<uint16_t> const & cpg_config)
+                cpg_table const & reference_cpgs,
+                size_t const first_cpg,
+                cpg_counts_t & all_CpGs,
+                methylation_pattern const & pattern)
 {
-    for (size_t i; i < cpg_pos.size(); i++)
-    {
-        GenomePosition pos;
-        pos.ref_id = reference_id;
-        pos.start = reference_position + cpg_pos[i];
-
-        auto it = all_CpGs.find(pos);
-
-        if (it != all_CpGs.end())
-        {
-            std::get<0>(it->second)++;
-            std::get<1>(it->second) += calculate_discordance_per_read(cpg_config);
-            std::get<2>(it->second) += calculate_transitions_per_read(cpg_config);
-            std::get<3>(it->second) += cpg_config[i];
-        }
-        else
-        {
-            all_CpGs.insert(std::make_pair(pos, std::make_tuple(1, calculate_discordance_per_read(cpg_config), calculate_transitions_per_read(cpg_config), cpg_config[i])));
-        }
-    }
+    // Scores of the read are the same for all of its CpGs
+    num_discordant_reads_t const discordance = calculate_discordance_per_read(pattern);
+    sum_transitions_t const transitions = transitions_to_fixed_point(calculate_transitions_per_read(pattern));
+
+    all_CpGs.add_read(reference_id, reference_cpgs, first_cpg, pattern, discordance, transitions);
 }
 
-// Insert kmer into map to store it until all BAM records are read
+// Add the epialleles of the read to the counts of its kmers to store them until all BAM records are read
 void insert_kmer(size_t const & reference_id,
-                 size_t const & reference_position,
-                 std::map<GenomePosition, std::vector<uint32_t> > & all_kmers,
-                 std::vector<uint16_t> const & cpg_pos,
-                 std::vector<uint16_t> const & cpg_config)
+                 cpg_table const & reference_cpgs,
+                 size_t const first_cpg,
+                 kmer_counts_t & all_kmers,
+                 methylation_pattern const & pattern)
 {
-    if (cpg_pos.size() < 4)
-        return;
-
-    for (size_t i; i < (cpg_pos.size() - 3); i++)
-    {
-        GenomePosition pos;
-        pos.ref_id = reference_id;
-        pos.start = reference_position + cpg_pos[i];
-
-        auto it = all_kmers.find(pos);
-
-        if (it != all_kmers.end())
-        {
-            (it->second)[epiallele_pos_array[cpg_config[i]][cpg_config[i+1]][cpg_config[i+2]][cpg_config[i+3]]]++;
-        }
-        else
-        {
-            std::vector<uint32_t> epialleles(16, 0);
-            epialleles[epiallele_pos_array[cpg_config[i]][cpg_config[i+1]][cpg_config[i+2]][cpg_config[i+3]]]++;
-            all_kmers.insert(std::make_pair(pos, epialleles));
-        }
-    }
+    all_kmers.add_read(reference_id, reference_cpgs, first_cpg, pattern);
 }
 
 // Internal function to process a single BAM record
-bool process_bam_record_impl(std::ofstream & output_stream,
+bool process_bam_record_impl(text_writer & output_stream,
                              read_type const & tag,
                              size_t const & reference_id,
-                             size_t const & reference_position,
-                             seqan3::dna5_vector const & sequence,
+                             read_view const & read,
                              std::string const & id,
                              std::deque<std::string> const & ref_ids,
-                             std::vector<seqan3::dna5_vector> const & genome_seqs,
+                             cpg_table const & reference_cpgs,
                              std::vector<uint16_t> & cpg_pos,
-                             std::vector<uint16_t> & cpg_config)
+                             size_t & first_cpg,
+                             methylation_pattern & pattern)
 {
-    // Define look-up for methylated or unmethylated CpGs (depending on base that needs to be evaluated).
-    static constexpr std::array<uint16_t, 5> methyl_context = {0, 1, 1, 0, 0};
-    static constexpr std::array<char, 2> methyl_context_char = {'g', 'G'};
-
-    // Extract reference sequence matching the reads.
-    seqan3::dna5_vector ref_sequence = genome_seqs[reference_id]
-				                     | seqan3::views::slice(reference_position, reference_position + sequence.size())
-				                     | seqan3::ranges::to<seqan3::dna5_vector>();
-
     // Find all CpG positions
-    cpg_pos = find_cpg_pos(ref_sequence);
+    find_cpg_pos(*reference_cpgs, read.position, read.size(), first_cpg, cpg_pos);
 
     if (cpg_pos.size() < 3)
         return true;
@@ -135,183 +104,166 @@ bool process_bam_record_impl(std::ofstream & output_stream,
     // For every CpG determine unmethylated/methylated status.
     // For reads coming from the forward strand, the position of the 'C' needs to be evaluated.
     // For reads coming from the reverse strand, the position of the 'G' needs to be evaluated.
-    bool skip = false;
-    for (size_t i = 0; i < cpg_pos.size(); i++)
-    {
-        if (tag == read_type::REV)
-        {
-            if ((sequence[cpg_pos[i] + 1] == 'A'_dna5 || sequence[cpg_pos[i] + 1] == 'G'_dna5) && sequence[cpg_pos[i]] == 'C'_dna5)
-            {
-                cpg_config.push_back(methyl_context[sequence[cpg_pos[i] + 1].to_rank()]);
-            }
-            else
-            {
-                skip = true;
-                break;
-            }
-        }
-        else
-        {
-            if ((sequence[cpg_pos[i]] == 'C'_dna5 || sequence[cpg_pos[i]] == 'T'_dna5) && sequence[cpg_pos[i] + 1] == 'G'_dna5)
-            {
-                cpg_config.push_back(methyl_context[sequence[cpg_pos[i]].to_rank()]);
-            }
-            else
-            {
-                skip = true;
-                break;
-            }
-        }
-    }
-    if (skip)
-        return skip;
-
-    // Prepare output
-    uint16_t num_methyl_cpgs = std::accumulate(cpg_config.begin(), cpg_config.end(), 0);
+    if (!call_methylation(read, cpg_pos, tag == read_type::REV, pattern.bits))
+        return true;
 
-    output_stream << ref_ids[reference_id] << "\t"
-                  << reference_position << "\t"
-                  << reference_position + sequence.size() << "\t"
-                  << id << "\t";
+    pattern.size = cpg_pos.size();
 
-    for (auto i : cpg_config)
-        output_stream << methyl_context_char[i];
+    size_t const name_begin = write_record_single_read(output_stream, ref_ids[reference_id], read.position, read.position + read.size(), id, pattern);
 
-    output_stream << "\t"
-                  << cpg_config.size() << "\t"
-                  << num_methyl_cpgs << "\t"
-                  << calculate_discordance_per_read(cpg_config) << "\t"
-                  << calculate_transitions_per_read(cpg_config) << "\t"
-                  << static_cast<double>(num_methyl_cpgs) / cpg_config.size() << "\n";
+    // Lines of the sorted single read output are followed by their position and the location of the read name
+    if (output_stream.line_keys())
+        sorted_line_key{GenomePosition{static_cast<uint16_t>(reference_id), read.position},
+                        static_cast<uint32_t>(name_begin),
+                        static_cast<uint32_t>(id.size())}.write(output_stream);
 
-    return skip;
+    return false;
 }
 
 // Outer wrapper function overload for single read score only
-void process_bam_record(std::ofstream & output_stream,
+void process_bam_record(text_writer & output_stream,
                         read_type const & tag,
                         size_t const & reference_id,
-                        size_t const & reference_position,
-                        seqan3::dna5_vector const & sequence,
+                        read_view const & read,
                         std::string const & id,
                         std::deque<std::string> const & ref_ids,
-                        std::vector<seqan3::dna5_vector> const & genome_seqs,
-                        std::map<GenomePosition, std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> > & all_CpGs,
-                        std::map<GenomePosition, std::vector<uint32_t> > & all_kmers,
+                        cpg_table const & reference_cpgs,
+                        cpg_counts_t & all_CpGs,
+                        kmer_counts_t & all_kmers,
+                        epiallele_cache_writer * cache,
                         score_tag<false, false>)
 {
-    std::vector<uint16_t> cpg_pos;
-    std::vector<uint16_t> cpg_config;
-
-    process_bam_record_impl(output_stream,
-                            tag,
-                            reference_id,
-                            reference_position,
-                            sequence,
-                            id,
-                            ref_ids,
-                            genome_seqs,
-                            cpg_pos,
-                            cpg_config);
+    // Buffers are reused for all reads of a thread
+    thread_local std::vector<uint16_t> cpg_pos;
+    thread_local methylation_pattern pattern;
+    size_t first_cpg = 0;
+
+    bool skip = process_bam_record_impl(output_stream,
+                                        tag,
+                                        reference_id,
+                                        read,
+                                        id,
+                                        ref_ids,
+                                        reference_cpgs,
+                                        cpg_pos,
+                                        first_cpg,
+                                        pattern);
+
+    if (!skip && cache)
+        cache->add_read(reference_id, first_cpg, pattern);
 }
 
 // Outer wrapper function overload for PDR/RTS scores
-void process_bam_record(std::ofstream & output_stream,
+void process_bam_record(text_writer & output_stream,
                         read_type const & tag,
                         size_t const & reference_id,
-                        size_t const & reference_position,
-                        seqan3::dna5_vector const & sequence,
+                        read_view const & read,
                         std::string const & id,
                         std::deque<std::string> const & ref_ids,
-                        std::vector<seqan3::dna5_vector> const & genome_seqs,
-                        std::map<GenomePosition, std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> > & all_CpGs,
-                        std::map<GenomePosition, std::vector<uint32_t> > & all_kmers,
+                        cpg_table const & reference_cpgs,
+                        cpg_counts_t & all_CpGs,
+                        kmer_counts_t & all_kmers,
+                        epiallele_cache_writer * cache,
                         score_tag<true, false>)
 {
-    std::vector<uint16_t> cpg_pos;
-    std::vector<uint16_t> cpg_config;
+    // Buffers are reused for all reads of a thread
+    thread_local std::vector<uint16_t> cpg_pos;
+    thread_local methylation_pattern pattern;
+    size_t first_cpg = 0;
 
     bool skip = process_bam_record_impl(output_stream,
                                         tag,
                                         reference_id,
-                                        reference_position,
-                                        sequence,
+                                        read,
                                         id,
                                         ref_ids,
-                                        genome_seqs,
+                                        reference_cpgs,
                                         cpg_pos,
-                                        cpg_config);
+                                        first_cpg,
+                                        pattern);
 
     if (!skip)
     {
-        insert_CpG(reference_id, reference_position, all_CpGs, cpg_pos, cpg_config);
-    }
+        insert_CpG(reference_id, reference_cpgs, first_cpg, all_CpGs, pattern);
 
+        if (cache)
+            cache->add_read(reference_id, first_cpg, pattern);
+    }
 }
 
 // Outer wrapper function overload for entropy/epipolymorphism scores
-void process_bam_record(std::ofstream & output_stream,
+void process_bam_record(text_writer & output_stream,
                         read_type const & tag,
                         size_t const & reference_id,
-                        size_t const & reference_position,
-                        seqan3::dna5_vector const & sequence,
+                        read_view const & read,
                         std::string const & id,
                         std::deque<std::string> const & ref_ids,
-                        std::vector<seqan3::dna5_vector> const & genome_seqs,
-                        std::map<GenomePosition, std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> > & all_CpGs,
-                        std::map<GenomePosition, std::vector<uint32_t> > & all_kmers,
+                        cpg_table const & reference_cpgs,
+                        cpg_counts_t & all_CpGs,
+                        kmer_counts_t & all_kmers,
+                        epiallele_cache_writer * cache,
                         score_tag<false, true>)
 {
-    std::vector<uint16_t> cpg_pos;
-    std::vector<uint16_t> cpg_config;
+    // Buffers are reused for all reads of a thread
+    thread_local std::vector<uint16_t> cpg_pos;
+    thread_local methylation_pattern pattern;
+    size_t first_cpg = 0;
 
     bool skip = process_bam_record_impl(output_stream,
                                         tag,
                                         reference_id,
-                                        reference_position,
-                                        sequence,
+                                        read,
                                         id,
                                         ref_ids,
-                                        genome_seqs,
+                                        reference_cpgs,
                                         cpg_pos,
-                                        cpg_config);
+                                        first_cpg,
+                                        pattern);
 
     if (!skip)
     {
-        insert_kmer(reference_id, reference_position, all_kmers, cpg_pos, cpg_config);
+        insert_kmer(reference_id, reference_cpgs, first_cpg, all_kmers, pattern);
+
+        if (cache)
+            cache->add_read(reference_id, first_cpg, pattern);
     }
 }
 
 // Outer wrapper function overload for all scores
-void process_bam_record(std::ofstream & output_stream,
+void process_bam_record(text_writer & output_stream,
                         read_type const & tag,
                         size_t const & reference_id,
-                        size_t const & reference_position,
-                        seqan3::dna5_vector const & sequence,
+                        read_view const & read,
                         std::string const & id,
                         std::deque<std::string> const & ref_ids,
-                        std::vector<seqan3::dna5_vector> const & genome_seqs,
-                        std::map<GenomePosition, std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> > & all_CpGs,
-                        std::map<GenomePosition, std::vector<uint32_t> > & all_kmers,
+                        cpg_table const & reference_cpgs,
+                        cpg_counts_t & all_CpGs,
+                        kmer_counts_t & all_kmers,
+                        epiallele_cache_writer * cache,
                         score_tag<true, true>)
 {
-    std::vector<uint16_t> cpg_pos;
-    std::vector<uint16_t> cpg_config;
+    // Buffers are reused for all reads of a thread
+    thread_local std::vector<uint16_t> cpg_pos;
+    thread_local methylation_pattern pattern;
+    size_t first_cpg = 0;
 
     bool skip = process_bam_record_impl(output_stream,
                                         tag,
                                         reference_id,
-                                        reference_position,
-                                        sequence,
+                                        read,
                                         id,
                                         ref_ids,
-                                        genome_seqs,
+                                        reference_cpgs,
                                         cpg_pos,
-                                        cpg_config);
+                                        first_cpg,
+                                        pattern);
 
     if (!skip)
     {
-        insert_CpG(reference_id, reference_position, all_CpGs, cpg_pos, cpg_config);
-        insert_kmer(reference_id, reference_position, all_kmers, cpg_pos, cpg_config);
+        insert_CpG(reference_id, reference_cpgs, first_cpg, all_CpGs, pattern);
+        insert_kmer(reference_id, reference_cpgs, first_cpg, all_kmers, pattern);
+
+        if (cache)
+            cache->add_read(reference_id, first_cpg, pattern);
     }
 }
@@ -0,0 +1,465 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Reference genome that loads reference sequences on demand
+// ==========================================================================
+
+#pragma once
+
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <seqan3/alphabet/nucleotide/dna5.hpp>
+
+#include "data_structures.hpp"
+
+using seqan3::operator""_dna5;
+
+// Binary reference index written by 'RLM index'. Numbers are stored in native byte order:
+//   header     magic, byte order mark, version and number of reference sequences
+//   entries    one reference_index_entry per reference sequence
+//   data       names, packed sequences (two bases per byte, rank of the first base in the lower 4 bits) and
+//              sorted CpG positions (uint32_t) of all reference sequences, every block aligned to 8 bytes
+struct reference_index_header
+{
+    std::array<char, 8> magic;
+    uint32_t byte_order;
+    uint32_t version;
+    uint64_t num_sequences;
+};
+
+struct reference_index_entry
+{
+    uint64_t length;
+    uint64_t name_offset;
+    uint64_t name_length;
+    uint64_t sequence_offset;
+    uint64_t cpg_offset;
+    uint64_t num_cpgs;
+};
+
+inline constexpr std::array<char, 8> reference_index_magic{'R', 'L', 'M', 'I', 'D', 'X', '\0', '\0'};
+inline constexpr uint32_t reference_index_byte_order = 0x01020304;
+inline constexpr uint32_t reference_index_version = 1;
+
+// Find the positions of all CpGs in a reference sequence. Positions fit into 32 bits as BAM files cannot store larger
+// ones.
+inline std::vector<uint32_t> find_cpgs(seqan3::dna5_vector const & sequence)
+{
+    std::vector<uint32_t> cpgs;
+
+    for (size_t i = 0; i + 1 < sequence.size(); i++)
+    {
+        if (sequence[i] == 'C'_dna5 && sequence[i + 1] == 'G'_dna5)
+            cpgs.push_back(i);
+    }
+
+    return cpgs;
+}
+
+// Reference genome in a FASTA file or a binary reference index (.rlm). For FASTA files only the positions of the
+// reference sequences are read when opening the file, either from the FASTA index (<fasta>.fai, as written by
+// 'samtools faidx') or by scanning the file once. A binary reference index is mapped into memory, so it is read from
+// the page cache shared by all processes using it.
+// A reference sequence or its CpG positions are loaded when they are requested and freed as soon as nobody holds them
+// anymore.
+class reference_genome
+{
+public:
+    explicit reference_genome(std::filesystem::path const & fasta_file) :
+        fasta_file{fasta_file}
+    {
+        std::filesystem::path index_file = fasta_file.string() + ".fai";
+
+        if (fasta_file.extension() == ".rlm")
+            map_reference_index();
+        else if (std::filesystem::exists(index_file) &&
+                 std::filesystem::last_write_time(index_file) >= std::filesystem::last_write_time(fasta_file))
+            read_index(index_file);
+        else
+            scan_fasta();
+
+        locks = std::vector<std::mutex>(entries.size());
+    }
+
+    // Names of the reference sequences (up to the first whitespace)
+    std::vector<std::string> const & ids() const
+    {
+        return names;
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+    uint64_t length(size_t ref_id) const
+    {
+        return entries[ref_id].length;
+    }
+
+    // Get a reference sequence, loading it from the FASTA file if it is not held by anyone else. Thread-safe.
+    std::shared_ptr<seqan3::dna5_vector const> sequence(size_t ref_id)
+    {
+        std::lock_guard<std::mutex> lock{locks[ref_id]};
+
+        std::shared_ptr<seqan3::dna5_vector const> result = entries[ref_id].loaded.lock();
+        if (!result)
+        {
+            result = load(ref_id);
+            entries[ref_id].loaded = result;
+        }
+
+        return result;
+    }
+
+    // Get the sorted positions of all CpGs of a reference sequence. They are taken from the binary reference index
+    // or found in the reference sequence once. Thread-safe.
+    cpg_table cpg_positions(size_t ref_id)
+    {
+        std::lock_guard<std::mutex> lock{locks[ref_id]};
+
+        cpg_table result = entries[ref_id].cpgs.lock();
+        if (!result)
+        {
+            result = load_cpgs(ref_id);
+            entries[ref_id].cpgs = result;
+        }
+
+        return result;
+    }
+
+private:
+    struct fasta_entry
+    {
+        uint64_t length;
+        uint64_t offset;    // Offset of the first base in the file
+        uint64_t bytes;     // Number of bytes of the sequence including line breaks (packed bytes for an index)
+        uint64_t cpg_offset = 0;
+        uint64_t num_cpgs = 0;
+        std::weak_ptr<seqan3::dna5_vector const> loaded{};
+        std::weak_ptr<std::span<uint32_t const> const> cpgs{};
+    };
+
+    std::filesystem::path fasta_file;
+    std::vector<std::string> names;
+    std::vector<fasta_entry> entries;
+    std::vector<std::mutex> locks;
+
+    // Memory mapping of a binary reference index, unmapped when the reference genome is destroyed
+    std::shared_ptr<unsigned char const> mapped_index;
+    uint64_t mapped_size = 0;
+
+    // Map a binary reference index written by write_reference_index
+    void map_reference_index()
+    {
+        std::string const error = "Invalid reference index " + fasta_file.string() + ". Please recreate it with 'RLM index'.";
+
+        int fd = ::open(fasta_file.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Could not open reference index " + fasta_file.string() + ".");
+
+        struct stat file_stat;
+        if (::fstat(fd, &file_stat) != 0 || static_cast<uint64_t>(file_stat.st_size) < sizeof(reference_index_header))
+        {
+            ::close(fd);
+            throw std::runtime_error(error);
+        }
+
+        mapped_size = file_stat.st_size;
+        void * data = ::mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Could not map reference index " + fasta_file.string() + " into memory.");
+
+        uint64_t const size = mapped_size;
+        mapped_index = std::shared_ptr<unsigned char const>(static_cast<unsigned char const *>(data),
+                                                            [size] (unsigned char const * p)
+                                                            {
+                                                                ::munmap(const_cast<unsigned char *>(p), size);
+                                                            });
+
+        reference_index_header header;
+        std::memcpy(&header, mapped_index.get(), sizeof(header));
+
+        if (header.magic != reference_index_magic ||
+            header.byte_order != reference_index_byte_order ||
+            header.version != reference_index_version ||
+            header.num_sequences > (mapped_size - sizeof(header)) / sizeof(reference_index_entry))
+            throw std::runtime_error(error);
+
+        for (uint64_t i = 0; i < header.num_sequences; i++)
+        {
+            reference_index_entry entry;
+            std::memcpy(&entry, mapped_index.get() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+
+            if (entry.name_offset + entry.name_length > mapped_size ||
+                entry.sequence_offset + (entry.length + 1) / 2 > mapped_size ||
+                entry.cpg_offset + entry.num_cpgs * sizeof(uint32_t) > mapped_size)
+                throw std::runtime_error(error);
+
+            names.emplace_back(reinterpret_cast<char const *>(mapped_index.get() + entry.name_offset), entry.name_length);
+            entries.push_back(fasta_entry{entry.length,
+                                          entry.sequence_offset,
+                                          (entry.length + 1) / 2,
+                                          entry.cpg_offset,
+                                          entry.num_cpgs});
+        }
+    }
+
+    // Read the FASTA index: name, length, offset, bases per line and bytes per line of every sequence
+    void read_index(std::filesystem::path const & index_file)
+    {
+        std::ifstream index_stream{index_file};
+        std::string line;
+
+        while (std::getline(index_stream, line))
+        {
+            if (line.empty())
+                continue;
+
+            std::istringstream fields{line};
+            std::string name;
+            uint64_t length, offset, line_bases, line_width;
+
+            if (!(fields >> name >> length >> offset >> line_bases >> line_width) || line_bases == 0)
+                throw std::runtime_error("Invalid line in FASTA index " + index_file.string() + ": " + line);
+
+            uint64_t bytes = length / line_bases * line_width + length % line_bases;
+            names.push_back(name);
+            entries.push_back(fasta_entry{length, offset, bytes});
+        }
+    }
+
+    // Find the sequences in a FASTA file without index
+    void scan_fasta()
+    {
+        std::ifstream fasta_stream{fasta_file, std::ios::binary};
+        if (!fasta_stream.is_open())
+            throw std::runtime_error("Could not open reference genome " + fasta_file.string() + ".");
+
+        std::string line;
+        uint64_t position = 0;
+
+        while (std::getline(fasta_stream, line))
+        {
+            uint64_t line_start = position;
+            position += line.size() + 1;
+
+            if (!line.empty() && line[0] == '>')
+            {
+                if (!entries.empty())
+                    entries.back().bytes = line_start - entries.back().offset;
+
+                names.push_back(line.substr(1, line.find_first_of(" \t\r") - 1));
+                entries.push_back(fasta_entry{0, position, 0});
+            }
+            else if (!entries.empty())
+            {
+                for (char c : line)
+                    entries.back().length += !std::isspace(static_cast<unsigned char>(c));
+            }
+        }
+
+        if (!entries.empty())
+            entries.back().bytes = position - entries.back().offset;
+    }
+
+    std::shared_ptr<seqan3::dna5_vector const> load(size_t ref_id) const
+    {
+        fasta_entry const & entry = entries[ref_id];
+
+        if (mapped_index)
+            return unpack(entry);
+
+        std::ifstream fasta_stream{fasta_file, std::ios::binary};
+        std::string text(entry.bytes, '\0');
+        fasta_stream.seekg(entry.offset);
+        fasta_stream.read(text.data(), text.size());
+        text.resize(fasta_stream.gcount());
+
+        auto result = std::make_shared<seqan3::dna5_vector>();
+        result->reserve(entry.length);
+
+        for (char c : text)
+        {
+            if (!std::isspace(static_cast<unsigned char>(c)))
+                result->push_back(seqan3::assign_char_to(c, seqan3::dna5{}));
+        }
+
+        if (result->size() != entry.length)
+            throw std::runtime_error("Could not read reference sequence " + names[ref_id] + " from " + fasta_file.string() +
+                                     ". Is the FASTA index up to date?");
+
+        return result;
+    }
+
+    cpg_table load_cpgs(size_t ref_id) const
+    {
+        fasta_entry const & entry = entries[ref_id];
+
+        // The mapping is owned by the reference genome, which outlives all users of the CpG positions
+        if (mapped_index)
+            return std::make_shared<std::span<uint32_t const> const>(
+                reinterpret_cast<uint32_t const *>(mapped_index.get() + entry.cpg_offset), entry.num_cpgs);
+
+        std::shared_ptr<seqan3::dna5_vector const> sequence = entry.loaded.lock();
+        if (!sequence)
+            sequence = load(ref_id);
+
+        struct owned_cpgs
+        {
+            std::vector<uint32_t> positions;
+            std::span<uint32_t const> view;
+        };
+
+        auto cpgs = std::make_shared<owned_cpgs>();
+        cpgs->positions = find_cpgs(*sequence);
+        cpgs->view = cpgs->positions;
+
+        return cpg_table(cpgs, &cpgs->view);
+    }
+
+    // Unpack a reference sequence from the binary reference index
+    std::shared_ptr<seqan3::dna5_vector const> unpack(fasta_entry const & entry) const
+    {
+        unsigned char const * packed = mapped_index.get() + entry.offset;
+        auto result = std::make_shared<seqan3::dna5_vector>(entry.length);
+
+        for (uint64_t i = 0; i < entry.length; i++)
+        {
+            uint8_t rank = (packed[i / 2] >> (4 * (i % 2))) & 0xF;
+            seqan3::assign_rank_to(rank < seqan3::dna5::alphabet_size ? rank : 'N'_dna5.to_rank(), (*result)[i]);
+        }
+
+        return result;
+    }
+};
+
+// Write a binary reference index with the reference sequences packed into 4 bits per base and the positions of
+// all CpGs of every reference sequence, see reference_index_header
+void write_reference_index(reference_genome & reference, std::filesystem::path const & index_file)
+{
+    std::ofstream index_stream{index_file, std::ios::binary};
+    if (!index_stream.is_open())
+        throw std::runtime_error("Could not open " + index_file.string() + " for writing.");
+
+    auto write = [&index_stream] (void const * data, size_t size)
+    {
+        index_stream.write(static_cast<char const *>(data), size);
+    };
+
+    auto align = [&index_stream] ()
+    {
+        static constexpr std::array<char, 8> padding{};
+        uint64_t position = index_stream.tellp();
+        index_stream.write(padding.data(), (8 - position % 8) % 8);
+        return static_cast<uint64_t>(index_stream.tellp());
+    };
+
+    reference_index_header header{reference_index_magic, reference_index_byte_order, reference_index_version, reference.size()};
+    std::vector<reference_index_entry> entries(reference.size());
+
+    write(&header, sizeof(header));
+    write(entries.data(), entries.size() * sizeof(reference_index_entry));
+
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        if (reference.length(i) > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("Reference sequence " + reference.ids()[i] + " is too long for a reference index.");
+
+        entries[i].length = reference.length(i);
+        entries[i].name_offset = index_stream.tellp();
+        entries[i].name_length = reference.ids()[i].size();
+        write(reference.ids()[i].data(), reference.ids()[i].size());
+    }
+
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        std::shared_ptr<seqan3::dna5_vector const> sequence = reference.sequence(i);
+
+        std::vector<unsigned char> packed((sequence->size() + 1) / 2, 0);
+        std::vector<uint32_t> cpgs = find_cpgs(*sequence);
+
+        for (size_t j = 0; j < sequence->size(); j++)
+            packed[j / 2] |= seqan3::to_rank((*sequence)[j]) << (4 * (j % 2));
+
+        entries[i].sequence_offset = align();
+        write(packed.data(), packed.size());
+
+        entries[i].cpg_offset = align();
+        entries[i].num_cpgs = cpgs.size();
+        write(cpgs.data(), cpgs.size() * sizeof(uint32_t));
+    }
+
+    index_stream.seekp(sizeof(header));
+    write(entries.data(), entries.size() * sizeof(reference_index_entry));
+
+    if (!index_stream.good())
+        throw std::runtime_error("Could not write reference index " + index_file.string() + ".");
+}
+
+// Holds the CpG positions of the reference sequences one thread works on. For position sorted input only the current
+// reference sequence is kept, all others are released when the next one is requested.
+class reference_cache
+{
+public:
+    reference_cache(reference_genome & reference, bool const sorted) :
+        reference{reference},
+        sorted{sorted},
+        loaded(reference.size())
+    {}
+
+    cpg_table const & operator[](size_t ref_id)
+    {
+        if (!loaded[ref_id])
+        {
+            if (sorted && current < loaded.size())
+                loaded[current].reset();
+
+            loaded[ref_id] = reference.cpg_positions(ref_id);
+            current = ref_id;
+        }
+
+        return loaded[ref_id];
+    }
+
+private:
+    reference_genome & reference;
+    bool sorted;
+    std::vector<cpg_table> loaded;
+    size_t current = std::numeric_limits<size_t>::max();
+};
@@ -0,0 +1,143 @@
+// ==========================================================================
+//                                  RLM
+// ==========================================================================
+// Copyright (c) 2021-2025, Sara Hetzel <hetzel @ molgen.mpg.de>
+// Copyright (c) 2021-2025, Max-Planck-Institut für Molekulare Genetik
+// All rights reserved.
+//
+// This file is part of RLM.
+//
+// RLM is Free Software: you can redistribute it and/or modify it
+// under the terms found in the LICENSE[.md|.rst] file distributed
+// together with this file.
+//
+// RLM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// ==========================================================================
+// Buffered text output
+// ==========================================================================
+
+#pragma once
+
+#include <charconv>
+#include <concepts>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+// Text output formatted into a buffer and written to a stream in large blocks. Numbers are formatted with
+// std::to_chars exactly like a std::ostream with default settings does (floating point numbers with 6 significant
+// digits, as printf("%g")), without the overhead of the stream for every field.
+class text_writer
+{
+public:
+    static constexpr size_t default_capacity = 1 << 20;
+
+    // With line_keys, every line is followed by a binary key that the stream needs, e.g. the position of a line that is
+    // sorted later
+    explicit text_writer(std::ostream & stream, size_t const capacity = default_capacity, bool const line_keys = false) :
+        stream{stream},
+        buffer{std::make_unique_for_overwrite<char[]>(capacity)},
+        current{buffer.get()},
+        last{buffer.get() + capacity},
+        keys{line_keys}
+    {}
+
+    text_writer(text_writer const &) = delete;
+    text_writer & operator=(text_writer const &) = delete;
+
+    ~text_writer()
+    {
+        flush();
+    }
+
+    text_writer & operator<<(std::string_view const text)
+    {
+        if (text.size() > static_cast<size_t>(last - current))
+        {
+            flush();
+
+            // Text that does not fit into the buffer is written directly
+            if (text.size() > static_cast<size_t>(last - current))
+            {
+                stream.write(text.data(), text.size());
+                num_written += text.size();
+                return *this;
+            }
+        }
+
+        std::memcpy(current, text.data(), text.size());
+        current += text.size();
+        return *this;
+    }
+
+    text_writer & operator<<(char const c)
+    {
+        reserve(1);
+        *current++ = c;
+        return *this;
+    }
+
+    template <std::integral number_t>
+    text_writer & operator<<(number_t const number)
+    {
+        reserve(max_number_length);
+        current = std::to_chars(current, last, number).ptr;
+        return *this;
+    }
+
+    text_writer & operator<<(double const number)
+    {
+        reserve(max_number_length);
+        current = std::to_chars(current, last, number, std::chars_format::general, 6).ptr;
+        return *this;
+    }
+
+    // Write the buffer to the stream
+    void flush()
+    {
+        if (current == buffer.get())
+            return;
+
+        stream.write(buffer.get(), current - buffer.get());
+        num_written += current - buffer.get();
+        current = buffer.get();
+    }
+
+    // Number of characters written to the writer, including those that are not written to the stream yet
+    uint64_t size() const
+    {
+        return num_written + (current - buffer.get());
+    }
+
+    bool line_keys() const
+    {
+        return keys;
+    }
+
+    // Position in the stream including the text that is not written yet
+    std::streamoff position() const
+    {
+        return static_cast<std::streamoff>(stream.tellp()) + (current - buffer.get());
+    }
+
+private:
+    // Longest integer (with sign) or floating point number with 6 significant digits
+    static constexpr size_t max_number_length = 32;
+
+    std::ostream & stream;
+    std::unique_ptr<char[]> buffer;
+    char * current;
+    char * last;
+    bool keys;
+    uint64_t num_written = 0;
+
+    void reserve(size_t const n)
+    {
+        if (static_cast<size_t>(last - current) < n)
+            flush();
+    }
+};
@@ -20,46 +20,470 @@
 // ==========================================================================
 
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <fstream>
+#include <limits>
 #include <numeric>
+#include <optional>
 #include <map>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <sharg/all.hpp>
 
 #include <seqan3/core/debug_stream.hpp>
-#include <seqan3/io/sequence_file/input.hpp>
+#include <seqan3/alphabet/nucleotide/dna5.hpp>
 #include <seqan3/io/sam_file/all.hpp>
 #include <seqan3/utility/views/slice.hpp>
 
 #include "../include/argument_parsing.hpp"
+#include "../include/bam_index.hpp"
+#include "../include/batch.hpp"
+#include "../include/checkpoint.hpp"
+#include "../include/columnar_output.hpp"
 #include "../include/data_structures.hpp"
+#include "../include/epiallele_cache.hpp"
+#include "../include/line_log.hpp"
 #include "../include/methylation_scores.hpp"
 #include "../include/output.hpp"
+#include "../include/partial_counts.hpp"
+#include "../include/pipeline.hpp"
+#include "../include/process_bam_file.hpp"
 #include "../include/process_record.hpp"
+#include "../include/reference.hpp"
+#include "../include/text_writer.hpp"
 
 using seqan3::operator""_tag;
 using seqan3::operator""_dna5;
 using seqan3::operator""_cigar_operation;
 
 // Forward declaration
+int process_sample(cmd_arguments & args, reference_genome & reference);
+
 template <bool calc_pdr_score,  bool calc_entropy_score>
-int arg_conv1(cmd_arguments & args);
+int arg_conv1(cmd_arguments & args, reference_genome & reference);
 
 template <bool calc_pdr_score,  bool calc_entropy_score, bool rrbs>
-int arg_conv2(cmd_arguments & args);
+int arg_conv2(cmd_arguments & args, reference_genome & reference);
 
 template <bool calc_pdr_score,  bool calc_entropy_score, bool rrbs, bool single_end>
-int arg_conv3(cmd_arguments & args);
+int arg_conv3(cmd_arguments & args, reference_genome & reference);
 
 template <bool calc_pdr_score,  bool calc_entropy_score, bool rrbs, bool single_end, align_type aligner>
-int real_main(cmd_arguments & args);
+int real_main(cmd_arguments & args, reference_genome & reference);
+
+// Create a binary reference index
+int index_main(int argc, char ** argv)
+{
+    sharg::parser parser{"RLM-index", argc, argv};
+    index_arguments args{};
+
+    initialise_index_argument_parser(parser, args);
+
+    try
+    {
+         parser.parse();
+    }
+    catch (sharg::parser_error const & ext)
+    {
+        seqan3::debug_stream << "Parsing error. " << ext.what() << "\n";
+        return -1;
+    }
+
+    if (args.index_file.empty())
+        args.index_file = args.fasta_file.string() + ".rlm";
+
+    try
+    {
+        std::cout << "Reading the reference genome" << std::endl;
+        reference_genome reference{args.fasta_file};
+
+        std::cout << "Writing the reference index to " << args.index_file.string() << std::endl;
+        write_reference_index(reference, args.index_file);
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Convert a binary single read output to text
+int view_main(int argc, char ** argv)
+{
+    sharg::parser parser{"RLM-view", argc, argv};
+    view_arguments args{};
+
+    initialise_view_argument_parser(parser, args);
+
+    try
+    {
+         parser.parse();
+    }
+    catch (sharg::parser_error const & ext)
+    {
+        seqan3::debug_stream << "Parsing error. " << ext.what() << "\n";
+        return -1;
+    }
+
+    try
+    {
+        columnar_reader reader{args.input_file};
+
+        std::optional<named_region> region{};
+        if (!args.region.empty())
+            region = parse_region(args.region);
+
+        // Without an output file, the reads are written to the standard output
+        output_file file;
+        if (!args.output_file.empty())
+            file.open(args.output_file);
+        std::ostream & output_stream = args.output_file.empty() ? std::cout : file.stream();
+
+        write_header_read_info(output_stream);
+        {
+            text_writer writer{output_stream};
+            reader.view(writer, region);
+        }
+
+        file.finish();
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Compute the scores from an epiallele cache
+int rescore_main(int argc, char ** argv)
+{
+    sharg::parser parser{"RLM-rescore", argc, argv};
+    rescore_arguments args{};
+
+    initialise_rescore_argument_parser(parser, args);
+
+    try
+    {
+         parser.parse();
+    }
+    catch (sharg::parser_error const & ext)
+    {
+        seqan3::debug_stream << "Parsing error. " << ext.what() << "\n";
+        return -1;
+    }
+
+    bool const calc_pdr_score = args.score != "entropy";
+    bool const calc_entropy_score = args.score != "pdr";
+
+    try
+    {
+        std::cout << "Reading the reference genome index" << std::endl;
+        reference_genome reference{args.fasta_file};
+
+        epiallele_cache_reader cache{args.cache_file};
+        std::deque<std::string> const & ref_ids = cache.references();
+
+        if (ref_ids.size() != reference.size() || !std::equal(ref_ids.begin(), ref_ids.end(), reference.ids().begin()))
+            throw std::runtime_error("ERROR: Different reference sequences in the reference genome and the epiallele cache.");
+
+        output_file pdr_file;
+        if (calc_pdr_score)
+        {
+            pdr_file.open(args.output_file_pdr, args.threads, args.index && output_file::is_compressed(args.output_file_pdr));
+            write_header_pdr(pdr_file.stream());
+        }
+
+        output_file entropy_file;
+        if (calc_entropy_score)
+        {
+            entropy_file.open(args.output_file_entropy, args.threads, args.index && output_file::is_compressed(args.output_file_entropy));
+            write_header_entropy(entropy_file.stream());
+        }
+
+        cpg_counts_t all_CpGs;
+        kmer_counts_t all_kmers;
+
+        // Counts are written at the same positions as by the run that wrote the cache
+        auto write_counts = [&] (GenomePosition const & end)
+        {
+            if (calc_pdr_score)
+                write_final_records_pdr(pdr_file.stream(), ref_ids, all_CpGs, end, args.coverage_filter);
+            if (calc_entropy_score)
+                write_final_records_entropy(entropy_file.stream(), ref_ids, all_kmers, end, args.coverage_filter);
+        };
+
+        std::cout << "Reading the epiallele cache" << std::endl;
+        auto start_time = std::chrono::steady_clock::now();
+
+        reference_cache sequences{reference, cache.sorted()};
+        uint64_t num_reads = cache.read([&] (size_t const ref_id, size_t const first_cpg, methylation_pattern const & pattern)
+        {
+            cpg_table const & cpgs = sequences[ref_id];
+            if (calc_pdr_score)
+                insert_CpG(ref_id, cpgs, first_cpg, all_CpGs, pattern);
+            if (calc_entropy_score)
+                insert_kmer(ref_id, cpgs, first_cpg, all_kmers, pattern);
+        }, write_counts);
+
+        write_counts(genome_end);
+        pdr_file.finish();
+        entropy_file.finish();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        std::cout << "Processed " << num_reads << " reads in " << elapsed.count() << " s" << std::endl;
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Compute the scores from the partial counts of several runs
+int merge_main(int argc, char ** argv)
+{
+    sharg::parser parser{"RLM-merge", argc, argv};
+    merge_arguments args{};
+
+    initialise_merge_argument_parser(parser, args);
+
+    try
+    {
+         parser.parse();
+    }
+    catch (sharg::parser_error const & ext)
+    {
+        seqan3::debug_stream << "Parsing error. " << ext.what() << "\n";
+        return -1;
+    }
+
+    bool const calc_pdr_score = args.score != "entropy";
+    bool const calc_entropy_score = args.score != "pdr";
+
+    try
+    {
+        std::cout << "Reading " << args.partial_files.size() << " partial counts file(s)" << std::endl;
+
+        std::vector<partial_counts_reader> partials;
+        for (auto const & partial_file : args.partial_files)
+        {
+            partials.emplace_back(partial_file);
+            partial_counts_reader const & partial = partials.back();
+
+            if (partial.references() != partials.front().references())
+                throw std::runtime_error("ERROR: " + partial.path().string() + " has different reference sequences than " +
+                                         partials.front().path().string() + ".");
+            if (calc_pdr_score && !partial.has_counts(partial_counts_kind::pdr))
+                throw std::runtime_error("ERROR: " + partial.path().string() + " has no counts of the 'pdr' score.");
+            if (calc_entropy_score && !partial.has_counts(partial_counts_kind::entropy))
+                throw std::runtime_error("ERROR: " + partial.path().string() + " has no counts of the 'entropy' score.");
+        }
+
+        output_file pdr_file;
+        if (calc_pdr_score)
+        {
+            pdr_file.open(args.output_file_pdr, args.threads, args.index && output_file::is_compressed(args.output_file_pdr));
+            write_header_pdr(pdr_file.stream());
+        }
+
+        output_file entropy_file;
+        if (calc_entropy_score)
+        {
+            entropy_file.open(args.output_file_entropy, args.threads, args.index && output_file::is_compressed(args.output_file_entropy));
+            write_header_entropy(entropy_file.stream());
+        }
+
+        std::cout << "Merging the counts" << std::endl;
+        auto start_time = std::chrono::steady_clock::now();
+
+        merge_partial_counts(partials,
+                             calc_pdr_score ? &pdr_file.stream() : nullptr,
+                             calc_entropy_score ? &entropy_file.stream() : nullptr,
+                             args.coverage_filter,
+                             args.threads);
+
+        pdr_file.finish();
+        entropy_file.finish();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        std::cout << "Merged the counts in " << elapsed.count() << " s" << std::endl;
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Process the BAM files of several samples with one reference genome
+int batch_main(int argc, char ** argv)
+{
+    sharg::parser parser{"RLM-batch", argc, argv};
+    batch_arguments args{};
+
+    initialise_batch_argument_parser(parser, args);
+
+    try
+    {
+         parser.parse();
+    }
+    catch (sharg::parser_error const & ext)
+    {
+        seqan3::debug_stream << "Parsing error. " << ext.what() << "\n";
+        return -1;
+    }
+
+    try
+    {
+        std::cout << "Starting RLM" << std::endl;
+
+        // Options of a single BAM file that write or read further files per run are not available for a batch
+        cmd_arguments const & base = args.sample;
+        if (base.sharded || base.shard_size > 0 || !base.cache_file.empty() || !base.partial_file.empty() ||
+            !base.checkpoint_file.empty() || base.resume || base.index)
+            throw std::runtime_error("ERROR: Sharding, epiallele caches, partial counts, checkpoints and output indexes are not "
+                                     "supported by 'RLM batch'.");
+
+        std::vector<batch_sample> samples = read_sample_sheet(args.sample_sheet);
+        for (batch_sample const & sample : samples)
+        {
+            if (!std::filesystem::exists(sample.bam_file))
+                throw std::runtime_error("ERROR: BAM file " + sample.bam_file.string() + " does not exist.");
+        }
+
+        // The reference genome is opened once for all samples. Samples working on the same reference sequence share
+        // its CpG positions.
+        std::cout << "Reading the reference genome index" << std::endl;
+        reference_genome reference{args.sample.fasta_file};
+
+        // All samples running at once share --threads. Every sample gets an equal part, of which --workers process its
+        // reads and the others decompress its BAM file and compress its outputs. The number of decompression threads
+        // is set once before any sample starts, the samples do not change it.
+        size_t const num_jobs = std::min<size_t>(args.jobs, samples.size());
+        uint32_t const threads_per_sample = args.threads / num_jobs;
+        if (threads_per_sample < args.sample.workers + 1)
+            throw std::runtime_error("ERROR: --threads must be at least " + std::to_string(num_jobs * (args.sample.workers + 1)) +
+                                     " to process " + std::to_string(num_jobs) + " sample(s) at once with " +
+                                     std::to_string(args.sample.workers) + " worker(s) each.");
+        args.sample.threads = threads_per_sample - args.sample.workers;
+        seqan3::contrib::bgzf_thread_count = args.sample.threads;
+
+        bool const calc_pdr_score = args.sample.score == "pdr" || args.sample.score == "all";
+        bool const calc_entropy_score = args.sample.score == "entropy" || args.sample.score == "all";
+
+        // Counts of BAM files that are not sorted by position (according to their header, like for a single BAM file)
+        // may span the whole genome, whose CpGs are only counted if needed
+        std::vector<uint64_t> estimated_memory;
+        uint64_t num_genome_cpgs = 0;
+        for (batch_sample const & sample : samples)
+        {
+            seqan3::sam_file_input<seqan3::sam_file_input_default_traits<>, seqan3::fields<seqan3::field::id>> sample_file{sample.bam_file};
+            bool const sorted = sample_file.header().sorting == "coordinate";
+            if (!sorted && (calc_pdr_score || calc_entropy_score) && args.memory > 0 && num_genome_cpgs == 0)
+                num_genome_cpgs = count_genome_cpgs(reference);
+
+            estimated_memory.push_back(estimate_sample_memory(sorted, calc_pdr_score, calc_entropy_score, num_genome_cpgs));
+        }
+
+        std::cout << "Processing " << samples.size() << " sample(s), " << num_jobs << " at once with " << threads_per_sample
+                  << " thread(s) each" << std::endl;
+        auto start_time = std::chrono::steady_clock::now();
+
+        // The progress messages of every sample start with its output prefix and are written line by line, so those of
+        // samples processed at once are not mixed
+        std::mutex log_mutex;
+        size_t num_finished = 0;
+        auto process = [&] (size_t const i) -> bool
+        {
+            batch_sample const & sample = samples[i];
+            std::string const extension = args.compress ? ".bed.gz" : ".bed";
+
+            cmd_arguments sample_args = args.sample;
+            sample_args.bam_file = sample.bam_file;
+            sample_args.output_file_single_reads = sample.output_prefix + "_single_read_info" + extension;
+            sample_args.output_file_pdr = sample.output_prefix + "_pdr" + extension;
+            sample_args.output_file_entropy = sample.output_prefix + "_entropy" + extension;
+            sample_args.log_prefix = sample.output_prefix + ": ";
+
+            line_log progress{};
+            progress << "Starting sample " << sample.bam_file.string() << " (" << i + 1 << "/" << samples.size() << ")" << std::endl;
+
+            std::string error{};
+            try
+            {
+                if (process_sample(sample_args, reference) != 0)
+                    error = "The BAM file does not match the reference genome.";
+            }
+            catch (const char * e)
+            {
+                error = e;
+            }
+            catch (std::exception const & e)
+            {
+                error = e.what();
+            }
+
+            std::lock_guard<std::mutex> lock{log_mutex};
+            if (!error.empty())
+            {
+                std::cerr << "Error in sample " << sample.bam_file.string() << ": " << error << std::endl;
+                return false;
+            }
+
+            progress << "Finished sample " << sample.bam_file.string() << " (" << ++num_finished << " of " << samples.size()
+                     << " finished)" << std::endl;
+            return true;
+        };
+
+        size_t const num_failed = process_samples(samples, estimated_memory, num_jobs, args.memory << 20, process);
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        std::cout << "Processed " << samples.size() - num_failed << " of " << samples.size() << " sample(s) in "
+                  << elapsed.count() << " s" << std::endl;
+
+        if (num_failed > 0)
+            throw std::runtime_error("ERROR: " + std::to_string(num_failed) + " sample(s) failed.");
+
+        std::cout << "Terminating RLM" << std::endl;
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
 
 // Main function to parse arguments and set template arguments depending on input score selected
 int main(int argc, char ** argv)
 {
+    // 'RLM index' creates a binary reference index, 'RLM view' converts a binary single read output to text,
+    // 'RLM rescore' computes the scores from an epiallele cache, 'RLM merge' from partial counts, 'RLM batch'
+    // processes the BAM files of several samples, all other calls process a BAM file
+    if (argc > 1 && std::string_view{argv[1]} == "index")
+        return index_main(argc - 1, argv + 1);
+    if (argc > 1 && std::string_view{argv[1]} == "view")
+        return view_main(argc - 1, argv + 1);
+    if (argc > 1 && std::string_view{argv[1]} == "rescore")
+        return rescore_main(argc - 1, argv + 1);
+    if (argc > 1 && std::string_view{argv[1]} == "merge")
+        return merge_main(argc - 1, argv + 1);
+    if (argc > 1 && std::string_view{argv[1]} == "batch")
+        return batch_main(argc - 1, argv + 1);
+
     // The argument parser
     sharg::parser parser{"RLM", argc, argv};
     cmd_arguments args{};
@@ -76,92 +500,124 @@ int main(int argc, char ** argv)
         return -1;
     }
 
-    // Get score enum
-    score_type score = _score_name_to_enum(args.score);
-
     try
     {
-        switch (score)
-        {
-            case score_type::SINGLE_READ:  return arg_conv1<false, false>(args);
-            case score_type::PDR:          return arg_conv1<true, false>(args);
-            case score_type::ENTROPY:      return arg_conv1<false, true>(args);
-            case score_type::ALL:          return arg_conv1<true, true>(args);
-            default: throw "Undefined score requested.";
-        }
+        std::cout << "Starting RLM" << std::endl;
+
+        // Set threads for BAM decompression
+        seqan3::contrib::bgzf_thread_count = args.sharded ? 1 : args.threads;
+
+        // Open genome reference file, sequences are loaded when the first read on them is processed
+        std::cout << "Reading the reference genome index" << std::endl;
+
+        reference_genome reference{args.fasta_file};
+
+        int result = process_sample(args, reference);
+        if (result == 0)
+            std::cout << "Terminating RLM" << std::endl;
+
+        return result;
     }
     catch (const char * e)
     {
         std::cerr << "Error: " << e << std::endl;
         return -1;
     }
+    catch (std::exception const & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+}
+
+// Process the BAM file of one sample. The reference genome may be shared by several samples processed at once.
+int process_sample(cmd_arguments & args, reference_genome & reference)
+{
+    // Get score enum
+    score_type score = _score_name_to_enum(args.score);
+
+    switch (score)
+    {
+        case score_type::SINGLE_READ:  return arg_conv1<false, false>(args, reference);
+        case score_type::PDR:          return arg_conv1<true, false>(args, reference);
+        case score_type::ENTROPY:      return arg_conv1<false, true>(args, reference);
+        case score_type::ALL:          return arg_conv1<true, true>(args, reference);
+        default: throw "Undefined score requested.";
+    }
 }
 
 template <bool calc_pdr_score,  bool calc_entropy_score>
-int arg_conv1(cmd_arguments & args)
+int arg_conv1(cmd_arguments & args, reference_genome & reference)
 {
     sequencing_type type = _sequencing_type_to_enum(args.rrbs);
     switch (type)
     {
-        case sequencing_type::RRBS:  return arg_conv2<calc_pdr_score, calc_entropy_score, true>(args);
-        case sequencing_type::WGBS:  return arg_conv2<calc_pdr_score, calc_entropy_score, false>(args);
+        case sequencing_type::RRBS:  return arg_conv2<calc_pdr_score, calc_entropy_score, true>(args, reference);
+        case sequencing_type::WGBS:  return arg_conv2<calc_pdr_score, calc_entropy_score, false>(args, reference);
         default: throw "Undefined sequencing type requested.";
     }
 }
 
 template <bool calc_pdr_score,  bool calc_entropy_score, bool rrbs>
-int arg_conv2(cmd_arguments & args)
+int arg_conv2(cmd_arguments & args, reference_genome & reference)
 {
     mate_type type = _mate_type_to_enum(args.mode);
     switch (type)
     {
-        case mate_type::SE:  return arg_conv3<calc_pdr_score, calc_entropy_score, rrbs, true>(args);
-        case mate_type::PE:  return arg_conv3<calc_pdr_score, calc_entropy_score, rrbs, false>(args);
+        case mate_type::SE:  return arg_conv3<calc_pdr_score, calc_entropy_score, rrbs, true>(args, reference);
+        case mate_type::PE:  return arg_conv3<calc_pdr_score, calc_entropy_score, rrbs, false>(args, reference);
         default: throw "Undefined sequencing mode requested.";
     }
 }
 
 template <bool calc_pdr_score,  bool calc_entropy_score, bool rrbs, bool single_end>
-int arg_conv3(cmd_arguments & args)
+int arg_conv3(cmd_arguments & args, reference_genome & reference)
 {
     align_type type = _aligner_name_to_enum(args.aligner);
 
     switch (type)
     {
-        case align_type::BSMAP:     return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::BSMAP>(args);
-        case align_type::BISMARK:   return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::BISMARK>(args);
-        case align_type::SEGEMEHL:  return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::SEGEMEHL>(args);
-        case align_type::GEM:       return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::GEM>(args);
+        case align_type::BSMAP:     return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::BSMAP>(args, reference);
+        case align_type::BISMARK:   return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::BISMARK>(args, reference);
+        case align_type::SEGEMEHL:  return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::SEGEMEHL>(args, reference);
+        case align_type::GEM:       return real_main<calc_pdr_score, calc_entropy_score, rrbs, single_end, align_type::GEM>(args, reference);
         default: throw "Undefined alignment tool requested.";
     }
 }
 
+// Options of a run that change its output, a checkpoint is only used by a run with the same options. The number of
+// threads and workers does not change the output, so they may differ.
+std::string checkpoint_options(cmd_arguments const & args)
+{
+    std::ostringstream options;
+    options << args.bam_file.string() << '\n'
+            << std::filesystem::file_size(args.bam_file) << '\n'
+            << args.fasta_file.string() << '\n'
+            << args.targets_file.string() << '\n'
+            << args.region << '\n'
+            << args.mode << '\n'
+            << args.score << '\n'
+            << args.aligner << '\n'
+            << args.mapq_filter << '\n'
+            << args.coverage_filter << '\n'
+            << args.rrbs << args.collated << '\n'
+            << args.output_file_single_reads.string() << '\n'
+            << args.output_file_pdr.string() << '\n'
+            << args.output_file_entropy.string() << '\n'
+            << args.cache_file.string() << '\n'
+            << args.partial_file.string() << '\n';
+    return options.str();
+}
+
 // Real main function containing the program
 template <bool calc_pdr_score, bool calc_entropy_score, bool rrbs, bool single_end, align_type aligner>
-int real_main(cmd_arguments & args)
+int real_main(cmd_arguments & args, reference_genome & reference)
 {
-    std::cout << "Starting RLM" << std::endl;
-
-    // Set threads for BAM decompression
-    seqan3::contrib::bgzf_thread_count = 1;
-
-    // Load genome reference file
-    std::cout << "Reading the reference genome" << std::endl;
-
-    seqan3::sequence_file_input reference_file{args.fasta_file};
-    reference_file.options.truncate_ids = true;
-
-    std::vector<std::string> genome_seqs_ids{};
-    std::vector<seqan3::dna5_vector> genome_seqs{};
-
-    for (auto && record : reference_file)
-    {
-        genome_seqs_ids.push_back(std::move(record.id()));
-        genome_seqs.push_back(std::move(record.sequence()));
-    }
+    // Progress messages, which start with the output prefix of the sample in a batch
+    line_log progress{args.log_prefix};
 
     // Initialize BAM file stream
-    std::cout << "Opening the bam file" << std::endl;
+    progress << "Opening the bam file" << std::endl;
 
     using field_type = seqan3::fields<seqan3::field::id,
                                       seqan3::field::flag,
@@ -170,421 +626,547 @@ int real_main(cmd_arguments & args)
                                       seqan3::field::mapq,
                                       seqan3::field::seq,
                                       seqan3::field::cigar,
+                                      seqan3::field::mate,
                                       seqan3::field::tags>;
-    seqan3::sam_file_input mapping_file{args.bam_file, field_type{}};
+    using mapping_file_t = seqan3::sam_file_input<seqan3::sam_file_input_default_traits<>,
+                                                  field_type,
+                                                  seqan3::type_list<seqan3::format_sam, seqan3::format_bam>>;
 
-    // Validate whether reference genome and BAM file have the same order of chromosomes
-    try
-    {
-        if (mapping_file.header().ref_ids().size() != genome_seqs_ids.size())
-            throw "Different number of sequences in references and BAM file.";
+    // Collect target regions if processing should be restricted to them
+    bool restrict_to_targets = !args.region.empty() || !args.targets_file.empty();
+    std::vector<named_region> regions{};
 
-        for (size_t i = 0; i < mapping_file.header().ref_ids().size(); i++)
-        {
-            if (mapping_file.header().ref_ids()[i] != genome_seqs_ids[i])
-                throw "Different reference sequence order or different reference sequences in fasta and BAM file.";
-        }
-    }
-    catch (const char * e)
+    if (!args.region.empty())
+        regions.push_back(parse_region(args.region));
+
+    if (!args.targets_file.empty())
     {
-        std::cerr << "Error: " << e << std::endl;
-        return -1;
+        std::vector<named_region> target_bed = read_target_bed(args.targets_file);
+        regions.insert(regions.end(), target_bed.begin(), target_bed.end());
     }
 
-    // Map used to store reads until mate is read
-    using record_t = std::ranges::range_value_t<decltype(mapping_file)>;
-    std::map<std::string, record_t> records;
+    // Checkpoints store the position of the next read, from which a resumed run continues through the BAM index.
+    // Outputs are continued by appending to them, which is only possible for uncompressed text files.
+    bool const checkpoints = !args.checkpoint_file.empty();
 
-    // Store set with mates that have indels to immediately process and not store them later
-    std::set<std::string> mates_with_indels;
+    if (args.resume && !checkpoints)
+        throw "--resume requires --checkpoint.";
 
-    // Map to store CpGs
-    using num_reads_t = uint32_t;
-    using num_discordant_reads_t = uint32_t;
-    using sum_transitions_t = double;
-    using num_methyl_cpgs_t = uint32_t;
+    if (checkpoints && args.sharded)
+        throw "--checkpoint can not be combined with --sharded.";
 
-    std::map<GenomePosition, std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> > all_CpGs;
+    if (checkpoints && args.sort_single_read)
+        throw "--checkpoint can not be combined with --sort_single_read.";
 
-    // Map to store 4-mers with epialleles
-    std::map<GenomePosition, std::vector<uint32_t> > all_kmers;
+    if (checkpoints && (output_file::is_compressed(args.output_file_single_reads) ||
+                        output_file::is_compressed(args.output_file_pdr) ||
+                        output_file::is_compressed(args.output_file_entropy) ||
+                        is_columnar_file(args.output_file_single_reads)))
+        throw "--checkpoint requires uncompressed text outputs.";
 
-    // Set mode for calculations
-    using score_tag = score_tag<calc_pdr_score, calc_entropy_score>;
+    // If the BAM file is indexed, only read the BGZF blocks overlapping the targets
+    std::optional<std::filesystem::path> index_file{};
+    if ((restrict_to_targets || args.sharded || checkpoints) && args.bam_file.extension() == ".bam")
+        index_file = bam_index::find(args.bam_file);
+
+    if (checkpoints && !index_file)
+        throw "Checkpoints require a BAM file sorted by position with an index (.bai or .csi).";
 
-    std::ofstream output_stream;
-    output_stream.open(args.output_file_single_reads);
-    write_header_read_info(output_stream);
-
-    std::cout << "Starting BAM file processing" << std::endl;
-
-    for (auto & rec : mapping_file)
-    {
-        // Check if read is properly mapped and paired (if PE mode), not vendor-failed, not supplementary
-        // or secondary alignment and not PCR duplicate
-        if ((!static_cast<bool>(rec.flag() & seqan3::sam_flag::paired) && args.mode == "PE") ||
-            static_cast<bool>(rec.flag() & seqan3::sam_flag::unmapped) ||
-            static_cast<bool>(rec.flag() & seqan3::sam_flag::secondary_alignment) ||
-            static_cast<bool>(rec.flag() & seqan3::sam_flag::failed_filter) ||
-            static_cast<bool>(rec.flag() & seqan3::sam_flag::duplicate) ||
-            static_cast<bool>(rec.flag() & seqan3::sam_flag::supplementary_alignment) ||
-            rec.mapping_quality() < args.mapq_filter)
-            continue;
-
-        // Set tag depending on aligner
-        read_type rec_type;
-
-        // Check if alignment contains indels: If yes, skip record.
-        using seqan3::get;
-        bool indel = false;
-        bool soft_clip = false;
-        for (auto c : rec.cigar_sequence())
+    std::string const run_options = checkpoints ? checkpoint_options(args) : std::string{};
+    std::optional<checkpoint> resume_state{};
+    if (args.resume)
+    {
+        if (std::filesystem::exists(args.checkpoint_file))
         {
-            if (get<seqan3::cigar::operation>(c) != 'M'_cigar_operation &&
-                get<seqan3::cigar::operation>(c) != 'H'_cigar_operation)
-            {
-                if (get<seqan3::cigar::operation>(c) == 'S'_cigar_operation)
-                {
-                    soft_clip = true;
-                }
-                else
-                {
-                    indel = true;
-                    break;
-                }
-            }
+            resume_state = read_checkpoint(args.checkpoint_file, run_options, reference, args.collated);
+            if (resume_state->output_sizes.size() != num_checkpoint_outputs)
+                throw std::runtime_error("ERROR: The checkpoint is corrupt.");
+            progress << "Resuming from checkpoint at " << reference.ids()[resume_state->read_position.ref_id] << ":"
+                     << resume_state->read_position.start + 1 << std::endl;
+        }
+        else
+        {
+            progress << "No checkpoint found, starting from the beginning" << std::endl;
         }
+    }
+
+    if (args.sharded && !index_file)
+        throw "Sharded processing requires an indexed BAM file (.bai or .csi).";
 
-        if (indel)
+    if (args.sharded && args.collated)
+        throw "--collated can not be combined with --sharded.";
+
+    if (args.sharded && args.workers > 0)
+        throw "--workers can not be combined with --sharded.";
+
+    std::optional<bam_index> index{};
+    std::unique_ptr<bgzf_region_streambuf> region_buffer{};
+    std::istream region_stream{nullptr};
+    target_regions targets{};
+
+    if (index_file)
+    {
+        index.emplace(index_file.value());
+
+        if (restrict_to_targets)
         {
-            if constexpr(!single_end)
-            {
-                if (records.find(rec.id()) != records.end())
-                {
-                    process_bam_record(output_stream,
-                                       rec_type,
-                                       records.at(rec.id()).reference_id().value(),
-                                       records.at(rec.id()).reference_position().value(),
-                                       records.at(rec.id()).sequence(),
-                                       records.at(rec.id()).id(),
-                                       mapping_file.header().ref_ids(),
-                                       genome_seqs,
-                                       all_CpGs,
-                                       all_kmers,
-                                       score_tag{});
-                    records.erase(rec.id());
-                }
+            progress << "Reading target regions through BAM index " << index_file->string() << std::endl;
 
-                else if (mates_with_indels.find(rec.id()) != mates_with_indels.end())
-                    mates_with_indels.erase(rec.id());
-                else
-                    mates_with_indels.insert(rec.id());
-            }
-            continue;
+            bgzf_reader header_reader{args.bam_file};
+            uint64_t header_end;
+            targets = target_regions{regions, read_bam_header(header_reader, header_end)};
         }
 
-        // Check if alignment was soft clipped: If yes adapt read sequence
-        if (soft_clip)
+        // Shards query the index themselves
+        if ((restrict_to_targets && !args.sharded) || resume_state)
         {
-            if (get<seqan3::cigar::operation>(rec.cigar_sequence()[0]) == 'S'_cigar_operation)
+            std::vector<bgzf_chunk> chunks;
+            if (restrict_to_targets)
             {
-                // If 5p soft clipping
-                rec.sequence() = rec.sequence()
-                               | seqan3::views::slice(get<uint32_t>(rec.cigar_sequence()[0]), rec.sequence().size())
-                               | seqan3::ranges::to<seqan3::dna5_vector>();
+                for (size_t i = 0; i < targets.by_reference().size(); i++)
+                {
+                    for (auto const & interval : targets.by_reference()[i])
+                    {
+                        std::vector<bgzf_chunk> interval_chunks = index->query(i, interval.start, interval.end);
+                        chunks.insert(chunks.end(), interval_chunks.begin(), interval_chunks.end());
+                    }
+                }
             }
-            else if (get<seqan3::cigar::operation>(rec.cigar_sequence()[0]) == 'H'_cigar_operation &&
-                     get<seqan3::cigar::operation>(rec.cigar_sequence()[1]) == 'S'_cigar_operation)
+            else
             {
-                // If 5p soft clipping after hard clipping
-                rec.sequence() = rec.sequence()
-                               | seqan3::views::slice(get<uint32_t>(rec.cigar_sequence()[1]), rec.sequence().size())
-                               | seqan3::ranges::to<seqan3::dna5_vector>();
+                chunks.push_back(bgzf_chunk{0, std::numeric_limits<uint64_t>::max()});
             }
 
-            if (get<seqan3::cigar::operation>(rec.cigar_sequence()[rec.cigar_sequence().size() - 1]) == 'S'_cigar_operation)
-            {
-                // If 3p soft clipping
-                rec.sequence() = rec.sequence()
-                               | seqan3::views::slice(0, rec.sequence().size() - get<uint32_t>(rec.cigar_sequence()[rec.cigar_sequence().size() - 1]))
-                               | seqan3::ranges::to<seqan3::dna5_vector>();
-            }
-            else if (get<seqan3::cigar::operation>(rec.cigar_sequence()[rec.cigar_sequence().size() - 1]) == 'H'_cigar_operation &&
-                     get<seqan3::cigar::operation>(rec.cigar_sequence()[rec.cigar_sequence().size() - 2]) == 'S'_cigar_operation)
+            // A resumed run starts reading at the first block with reads at the position of the checkpoint, reads
+            // before that position in the same block are skipped while processing
+            if (resume_state)
             {
-                // If 3p soft clipping before hard clipping
-                rec.sequence() = rec.sequence()
-                               | seqan3::views::slice(0, rec.sequence().size() - get<uint32_t>(rec.cigar_sequence()[rec.cigar_sequence().size() - 2]))
-                               | seqan3::ranges::to<seqan3::dna5_vector>();
+                GenomePosition const & position = resume_state->read_position;
+                std::vector<bgzf_chunk> resume_chunks = index->query(position.ref_id, position.start, position.start + 1);
+                uint64_t const resume_offset = resume_chunks.empty() ? 0 : resume_chunks.front().begin;
+
+                for (auto & chunk : chunks)
+                    chunk.begin = std::max(chunk.begin, resume_offset);
+                std::erase_if(chunks, [] (bgzf_chunk const & chunk) { return chunk.begin >= chunk.end; });
             }
-        }
 
-        if constexpr (aligner == align_type::BSMAP)
-        {
-            rec_type = _read_tag_bsmap_to_enum(rec.tags().get<"ZS"_tag>());
+            region_buffer = std::make_unique<bgzf_region_streambuf>(args.bam_file, bam_index::merge_chunks(std::move(chunks)));
+            region_stream.rdbuf(region_buffer.get());
         }
-        else if constexpr (aligner == align_type::BISMARK)
+    }
+    else if (restrict_to_targets)
+    {
+        progress << "No BAM index found, scanning the whole file for reads overlapping the target regions" << std::endl;
+    }
+
+    mapping_file_t mapping_file = region_buffer ? mapping_file_t{region_stream, seqan3::format_bam{}, field_type{}}
+                                                : mapping_file_t{args.bam_file, field_type{}};
+
+    if (restrict_to_targets && !index_file)
+        targets = target_regions{regions, mapping_file.header().ref_ids()};
+
+    // Validate whether reference genome and BAM file have the same order of chromosomes
+    try
+    {
+        if (mapping_file.header().ref_ids().size() != reference.size())
+            throw "Different number of sequences in references and BAM file.";
+
+        for (size_t i = 0; i < mapping_file.header().ref_ids().size(); i++)
         {
-            rec_type = _read_tag_bismark_to_enum(rec.tags().get<"XG"_tag>());
+            if (mapping_file.header().ref_ids()[i] != reference.ids()[i])
+                throw "Different reference sequence order or different reference sequences in fasta and BAM file.";
         }
+    }
+    catch (const char * e)
+    {
+        std::cerr << "Error: " << e << std::endl;
+        return -1;
+    }
+
+    if (args.sort_single_read && mapping_file.header().sorting != "coordinate")
+        throw "--sort_single_read requires a BAM file sorted by position.";
+
+    if (checkpoints && mapping_file.header().sorting != "coordinate")
+        throw "Checkpoints require a BAM file sorted by position with an index (.bai or .csi).";
+
+    // Counts of all CpGs
+    cpg_counts_t all_CpGs = resume_state ? std::move(resume_state->all_CpGs) : cpg_counts_t{};
+
+    // Map to store 4-mers with epialleles
+    kmer_counts_t all_kmers = resume_state ? std::move(resume_state->all_kmers) : kmer_counts_t{};
+
+    // Set mode for calculations
+    using score_tag = score_tag<calc_pdr_score, calc_entropy_score>;
+
+    // Outputs ending in .gz are compressed and can be indexed if their lines are sorted by position
+    bool const index_single_read = args.index && args.sort_single_read && output_file::is_compressed(args.output_file_single_reads);
+    bool const index_pdr = args.index && calc_pdr_score && output_file::is_compressed(args.output_file_pdr);
+    bool const index_entropy = args.index && calc_entropy_score && output_file::is_compressed(args.output_file_entropy);
+
+    if (args.index && !index_single_read && !index_pdr && !index_entropy)
+    {
+        if (output_file::is_compressed(args.output_file_single_reads))
+            throw "--index requires --sort_single_read to index the 'single_read' output.";
+        throw "--index requires an output file compressed with BGZF (ending in .gz).";
+    }
+    if (args.index && !index_single_read && output_file::is_compressed(args.output_file_single_reads))
+        progress << "The 'single_read' output is not indexed because it is not sorted, use --sort_single_read to index it" << std::endl;
+
+    // All output files are written by background threads. Outputs of a resumed run are continued from their size at
+    // the checkpoint and already have their headers.
+    output_file single_read_file;
+    if (resume_state)
+        single_read_file.resume(args.output_file_single_reads, resume_state->output_sizes[0]);
+    else
+        single_read_file.open(args.output_file_single_reads, args.threads, index_single_read);
+
+    // The single read output is written as text or, for .rlmc files, converted to the binary columnar format
+    std::optional<columnar_output_buffer> columnar_output{};
+    std::ostream columnar_output_stream{nullptr};
+    if (is_columnar_file(args.output_file_single_reads))
+    {
+        if (!single_read_file.stream())
+            throw std::runtime_error("ERROR: Could not open single read information output file.");
+
+        columnar_output.emplace(single_read_file.stream(), mapping_file.header().ref_ids());
+        columnar_output_stream.rdbuf(&columnar_output.value());
+
+        // Lines that can not be converted stop the run instead of only failing the stream
+        columnar_output_stream.exceptions(std::ios::badbit);
+    }
+    else if (!resume_state)
+    {
+        write_header_read_info(single_read_file.stream());
+    }
+
+    // With --emit_partial, the raw counts are written for 'RLM merge' instead of the 'pdr' and 'entropy' outputs
+    output_file partial_file;
+    std::optional<partial_counts_writer> partial{};
+    if (!args.partial_file.empty())
+    {
+        if (!calc_pdr_score && !calc_entropy_score)
+            throw "--emit_partial requires the 'pdr' or 'entropy' score.";
+
+        if (resume_state)
+            partial_file.resume(args.partial_file, resume_state->output_sizes[4]);
         else
-        {
-            // SEGEMEHL declares XB tag as string while GEM declares XB tag as char
-            // Therefore no overload for seqan3::sam_tag_type is possible and need to iterate through
-            // std::variant types
-            try
-            {
-                auto current_tag = rec.tags()["XB"_tag];
+            partial_file.open(args.partial_file);
+        if (!partial_file.stream())
+            throw std::runtime_error("ERROR: Could not open partial counts file.");
 
-                std::string xb_tag;
+        partial.emplace(partial_file.stream(), mapping_file.header().ref_ids(), calc_pdr_score, calc_entropy_score, resume_state.has_value());
+    }
 
-                std::visit([&xb_tag] (auto && arg)
-                {
-                    using T = std::remove_cvref_t<decltype(arg)>;
+    output_file pdr_file;
+    if (calc_pdr_score && !partial && resume_state)
+    {
+        pdr_file.resume(args.output_file_pdr, resume_state->output_sizes[1]);
+    }
+    else if (calc_pdr_score && !partial)
+    {
+        pdr_file.open(args.output_file_pdr, args.threads, index_pdr);
+        write_header_pdr(pdr_file.stream());
+    }
 
-                    if constexpr(std::is_same_v<T, char>)
-                    {
-                        xb_tag = std::string(1, arg);
-                    }
-                    else if constexpr (std::is_same_v<T, std::string>)
-                    {
-                        xb_tag = arg;
-                    }
-                    else
-                    {
-                        throw "Invalid type for XB tag. Must be either string (segemehl) or char (GEM).";
-                    }
-                }, current_tag);
+    output_file entropy_file;
+    if (calc_entropy_score && !partial && resume_state)
+    {
+        entropy_file.resume(args.output_file_entropy, resume_state->output_sizes[2]);
+    }
+    else if (calc_entropy_score && !partial)
+    {
+        entropy_file.open(args.output_file_entropy, args.threads, index_entropy);
+        write_header_entropy(entropy_file.stream());
+    }
 
-                if constexpr (aligner == align_type::SEGEMEHL)
-                    rec_type = _read_tag_segemehl_to_enum(xb_tag);
-                else
-                    rec_type = _read_tag_gem_to_enum(xb_tag);
-            }
-            catch (const char * e)
-            {
-                std::cerr << "Error: " << e << std::endl;
-                return -1;
-            }
-        }
+    std::ostream & single_read_output = columnar_output ? columnar_output_stream : single_read_file.stream();
+    std::ostream & pdr_output = pdr_file.stream();
+    std::ostream & entropy_output = entropy_file.stream();
+
+    // The single read output is written in processing order or sorted by position and read name
+    sorted_line_buffer sorted_output{single_read_output};
+    std::ostream sorted_output_stream{&sorted_output};
+    std::ostream & single_read_stream = args.sort_single_read ? sorted_output_stream : single_read_output;
+    text_writer single_read_writer{single_read_stream, text_writer::default_capacity, args.sort_single_read};
+
+    // The CpG patterns of all reads are written for 'RLM rescore' if requested
+    output_file cache_file;
+    std::optional<epiallele_cache_writer> cache{};
+    if (!args.cache_file.empty())
+    {
+        if (args.sharded)
+            throw "--cache can not be combined with --sharded.";
 
-        // If RRBS mode, omit potentially artificial bases (should not be applied if already trimmed/accounted for)
-        if constexpr (rrbs)
+        if (resume_state)
+            cache_file.resume(args.cache_file, resume_state->output_sizes[3]);
+        else
+            cache_file.open(args.cache_file);
+        if (!cache_file.stream())
+            throw std::runtime_error("ERROR: Could not open epiallele cache file.");
+
+        cache.emplace(cache_file.stream(),
+                      mapping_file.header().ref_ids(),
+                      mapping_file.header().sorting == "coordinate",
+                      resume_state.has_value());
+    }
+    epiallele_cache_writer * const cache_writer = cache ? &cache.value() : nullptr;
+
+    // Write and remove the counts before end as scores or as partial counts
+    auto write_scores = [&] (GenomePosition const & end)
+    {
+        if (partial)
         {
-            if ((rec_type == read_type::FWD && !static_cast<bool>(rec.flag() & seqan3::sam_flag::on_reverse_strand)) ||
-                (rec_type == read_type::REV && static_cast<bool>(rec.flag() & seqan3::sam_flag::on_reverse_strand)))
-            {
-                rec.sequence() = rec.sequence()
-                               | seqan3::views::slice(0, rec.sequence().size() - 2)
-                               | seqan3::ranges::to<seqan3::dna5_vector>();
-            }
-            else
-            {
-                rec.sequence() = rec.sequence()
-                               | seqan3::views::slice(2, rec.sequence().size())
-                               | seqan3::ranges::to<seqan3::dna5_vector>();
-                rec.reference_position().value() = rec.reference_position().value() + 2;
-            }
+            if constexpr (calc_pdr_score)
+                partial->write_pdr(all_CpGs, end);
+            if constexpr (calc_entropy_score)
+                partial->write_entropy(all_kmers, end);
+            return;
         }
 
-        if constexpr (single_end)
+        if constexpr (calc_pdr_score)
+            write_final_records_pdr(pdr_output, mapping_file.header().ref_ids(), all_CpGs, end, args.coverage_filter);
+        if constexpr (calc_entropy_score)
+            write_final_records_entropy(entropy_output, mapping_file.header().ref_ids(), all_kmers, end, args.coverage_filter);
+    };
+
+    progress << "Starting BAM file processing" << std::endl;
+
+    // Count records to report the processing speed
+    uint64_t num_records = 0;
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Reads stored until their mate is read
+    mate_buffer mates = resume_state ? std::move(resume_state->mates) : mate_buffer{false, args.collated};
+
+    // Write a checkpoint at a flush point if the last one is at least checkpoint_interval seconds ago. All reads before
+    // position are processed and all output of them is written, only the counts behind the flush point are kept.
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    uint32_t num_checkpoints = 0;
+    auto write_checkpoint_at = [&] (GenomePosition const & position)
+    {
+        single_read_writer.flush();
+        if (cache)
+            cache->flush();
+
+        // Same order as the outputs are resumed in
+        std::vector<std::streamoff> output_sizes{single_read_file.sync(),
+                                                 pdr_file.sync(),
+                                                 entropy_file.sync(),
+                                                 cache_file.sync(),
+                                                 partial_file.sync()};
+
+        // Tests interrupt the run here, the outputs already contain lines behind the last checkpoint
+        if (num_checkpoints == args.stop_after_checkpoints && args.stop_after_checkpoints > 0)
+            std::_Exit(EXIT_FAILURE);
+
+        write_checkpoint(args.checkpoint_file, run_options, position, output_sizes, mates, all_CpGs, all_kmers);
+        ++num_checkpoints;
+        last_checkpoint = std::chrono::steady_clock::now();
+    };
+    auto checkpoint_due = [&] ()
+    {
+        return checkpoints && std::chrono::steady_clock::now() - last_checkpoint >= std::chrono::seconds{args.checkpoint_interval};
+    };
+
+    if (args.sharded)
+    {
+        // Sorted single read output is written once all pairs starting before the end of a shard are processed
+        auto release_sorted_output = [&] (GenomePosition const & shard_end)
+        {
+            if (args.sort_single_read)
+                sorted_output.release(mates.first_open_position(shard_end));
+        };
+
+        std::vector<bam_shard> shards = make_shards(reference, targets, args.shard_size);
+        progress << "Processing " << shards.size() << " shard(s)" << std::endl;
+
+        num_records = process_bam_file_sharded<rrbs, single_end, aligner, mapping_file_t>(args,
+                                                                                         index.value(),
+                                                                                         shards,
+                                                                                         targets,
+                                                                                         mapping_file.header().ref_ids(),
+                                                                                         reference,
+                                                                                         single_read_stream,
+                                                                                         all_CpGs,
+                                                                                         all_kmers,
+                                                                                         mates,
+                                                                                         score_tag{},
+                                                                                         release_sorted_output);
+    }
+    else
+    {
+        // Reference sequences can be released as soon as the reads on them are processed if the input is sorted
+        bool sorted = mapping_file.header().sorting == "coordinate";
+        reference_cache sequences{reference, sorted};
+        read_processor<score_tag> process{single_read_writer, mapping_file.header().ref_ids(), sequences, all_CpGs, all_kmers, false, cache_writer};
+
+        // For position sorted input, stored reads whose mate was expected before the current position are dropped
+        // every flush_interval bp, whatever is computed. If there are any, CpGs and kmers (and sorted single read lines)
+        // are also written and removed at these points once they are final. Reads before the position of the last
+        // check would need counts that were already written.
+        uint64_t const flush_interval = args.flush_interval;
+        bool write_counts_early = calc_pdr_score || calc_entropy_score || args.sort_single_read || cache || checkpoints;
+        GenomePosition last_flush{0, 0};
+
+        // A resumed run continues with the first read that was not processed before the checkpoint
+        std::optional<GenomePosition> resume_position{};
+        if (resume_state)
         {
-            process_bam_record(output_stream,
-                               rec_type,
-                               rec.reference_id().value(),
-                               rec.reference_position().value(),
-                               rec.sequence(),
-                               rec.id(),
-                               mapping_file.header().ref_ids(),
-                               genome_seqs,
-                               all_CpGs,
-                               all_kmers,
-                               score_tag{});
+            resume_position = resume_state->read_position;
+            last_flush = resume_state->read_position;
         }
-        else
+
+        // Returns the end of the counts that are final if it is time to write them
+        auto flush_point = [&] (GenomePosition const & position) -> std::optional<GenomePosition>
         {
-            if (static_cast<bool>(rec.flag() & seqan3::sam_flag::mate_unmapped))
-            {
-                // If mate is unmapped just process read immediately
-                process_bam_record(output_stream,
-                                   rec_type,
-                                   rec.reference_id().value(),
-                                   rec.reference_position().value(),
-                                   rec.sequence(),
-                                   rec.id(),
-                                   mapping_file.header().ref_ids(),
-                                   genome_seqs,
-                                   all_CpGs,
-                                   all_kmers,
-                                   score_tag{});
-                continue;
-            }
-            else if (mates_with_indels.find(rec.id()) != mates_with_indels.end())
+            if (position < last_flush)
+                throw "BAM file is not sorted by position although its header states so.";
+
+            if (position.ref_id == last_flush.ref_id && position.start < last_flush.start + flush_interval)
+                return std::nullopt;
+            last_flush = position;
+
+            return mates.first_open_position(position);
+        };
+
+        auto write_counts = [&] (GenomePosition const & end)
+        {
+            // 'RLM rescore' writes the counts at the same positions
+            if (cache)
+                cache->final_position(end);
+            if (args.sort_single_read)
             {
-                // If mate had indel just process read immediately
-                process_bam_record(output_stream,
-                                   rec_type,
-                                   rec.reference_id().value(),
-                                   rec.reference_position().value(),
-                                   rec.sequence(),
-                                   rec.id(),
-                                   mapping_file.header().ref_ids(),
-                                   genome_seqs,
-                                   all_CpGs,
-                                   all_kmers,
-                                   score_tag{});
-                mates_with_indels.erase(rec.id());
-                continue;
+                single_read_writer.flush();
+                sorted_output.release(end);
             }
+            write_scores(end);
+        };
 
-            // Check if mate has already been read
-            if (!records.insert(std::make_pair(rec.id(), rec)).second)
+        if (args.workers > 0)
+        {
+            // Counts are written by the pipeline once all reads before the flush point are counted
+            read_pipeline<calc_pdr_score, calc_entropy_score> pipeline{args.workers,
+                                                                       single_read_writer,
+                                                                       mapping_file.header().ref_ids(),
+                                                                       reference,
+                                                                       sorted,
+                                                                       all_CpGs,
+                                                                       all_kmers,
+                                                                       cache_writer,
+                                                                       write_counts};
+            pipeline_processor<decltype(pipeline)> pipeline_process{pipeline};
+
+            auto write_final_counts = [&] (GenomePosition const & position)
             {
-                // Check if reads are overlapping
-                int overlap = std::min(records.at(rec.id()).sequence().size() + records.at(rec.id()).reference_position().value(),
-                                       rec.sequence().size() + rec.reference_position().value()) -
-                              std::max(records.at(rec.id()).reference_position().value(), rec.reference_position().value());
-
-                if (overlap >= 0 & (rec.reference_id().value() == records.at(rec.id()).reference_id().value()))
+                if (std::optional<GenomePosition> end = flush_point(position); end && write_counts_early)
                 {
-                    // First check if one read is included in the other - just process the longer one in this case
-                    if (overlap == records.at(rec.id()).sequence().size())
-                    {
-                        // First read included in second read
-                        process_bam_record(output_stream,
-                                           rec_type,
-                                           rec.reference_id().value(),
-                                           rec.reference_position().value(),
-                                           rec.sequence(),
-                                           rec.id(),
-                                           mapping_file.header().ref_ids(),
-                                           genome_seqs,
-                                           all_CpGs,
-                                           all_kmers,
-                                           score_tag{});
+                    pipeline.final_position(end.value());
 
-                    }
-                    else if (overlap == rec.sequence().size())
-                    {
-                        // Second read included in first read
-                        process_bam_record(output_stream,
-                                           rec_type,
-                                           records.at(rec.id()).reference_id().value(),
-                                           records.at(rec.id()).reference_position().value(),
-                                           records.at(rec.id()).sequence(),
-                                           records.at(rec.id()).id(),
-                                           mapping_file.header().ref_ids(),
-                                           genome_seqs,
-                                           all_CpGs,
-                                           all_kmers,
-                                           score_tag{});
-                    }
-                    else
+                    if (checkpoint_due())
                     {
-                        // Merge reads
-                        // Determine which read comes first
-                        bool is_first = records.at(rec.id()).reference_position().value() <= rec.reference_position().value();
-                        auto & rec1 = is_first ? records.at(rec.id()) : rec;
-                        auto & rec2 = is_first ? rec : records.at(rec.id());
-
-                        seqan3::dna5_vector second_seq_part = rec2.sequence()
-                                                            | seqan3::views::slice(overlap, rec2.sequence().size())
-                                                            | seqan3::ranges::to<seqan3::dna5_vector>();
-                        rec1.sequence().insert(rec1.sequence().end(), second_seq_part.begin(), second_seq_part.end());
-
-                        process_bam_record(output_stream,
-                                           rec_type,
-                                           rec1.reference_id().value(),
-                                           rec1.reference_position().value(),
-                                           rec1.sequence(),
-                                           rec1.id(),
-                                           mapping_file.header().ref_ids(),
-                                           genome_seqs,
-                                           all_CpGs,
-                                           all_kmers,
-                                           score_tag{});
+                        pipeline.wait();
+                        write_checkpoint_at(position);
                     }
                 }
-                else
+            };
+
+            if (sorted)
+                num_records = process_bam_file<rrbs, single_end, aligner>(mapping_file, args.mapq_filter, targets, std::nullopt, mates, pipeline_process, write_final_counts, resume_position);
+            else
+                num_records = process_bam_file<rrbs, single_end, aligner>(mapping_file, args.mapq_filter, targets, std::nullopt, mates, pipeline_process);
+
+            pipeline.finish();
+        }
+        else
+        {
+            auto write_final_counts = [&] (GenomePosition const & position)
+            {
+                if (std::optional<GenomePosition> end = flush_point(position); end && write_counts_early)
                 {
-                    // Process both mate records
-                    // Record already stored in map
-                    process_bam_record(output_stream,
-                                       rec_type,
-                                       records.at(rec.id()).reference_id().value(),
-                                       records.at(rec.id()).reference_position().value(),
-                                       records.at(rec.id()).sequence(),
-                                       records.at(rec.id()).id(),
-                                       mapping_file.header().ref_ids(),
-                                       genome_seqs,
-                                       all_CpGs,
-                                       all_kmers,
-                                       score_tag{});
-                    // Current record
-                    process_bam_record(output_stream,
-                                       rec_type,
-                                       rec.reference_id().value(),
-                                       rec.reference_position().value(),
-                                       rec.sequence(),
-                                       rec.id(),
-                                       mapping_file.header().ref_ids(),
-                                       genome_seqs,
-                                       all_CpGs,
-                                       all_kmers,
-                                       score_tag{});
+                    write_counts(end.value());
+
+                    if (checkpoint_due())
+                        write_checkpoint_at(position);
                 }
+            };
 
-                // Remove from map, now not used anymore
-                records.erase(rec.id());
-            }
+            if (sorted)
+                num_records = process_bam_file<rrbs, single_end, aligner>(mapping_file, args.mapq_filter, targets, std::nullopt, mates, process, write_final_counts, resume_position);
             else
-            {
-                continue;
-            }
+                num_records = process_bam_file<rrbs, single_end, aligner>(mapping_file, args.mapq_filter, targets, std::nullopt, mates, process);
         }
     }
 
-    output_stream.close();
-    std::cout << "Finished BAM file processing" << std::endl;
-    std::cout << "Finished writing 'single_read' output" << std::endl;
+    single_read_writer.flush();
+    sorted_output.release(genome_end);
+    if (columnar_output)
+        columnar_output->finish();
+    single_read_file.finish();
 
-    if constexpr (calc_pdr_score)
+    if (cache)
     {
-        std::cout << "Starting PDR and RTS calculations" << std::endl;
+        cache->flush();
+        cache_file.finish();
+    }
 
-        std::ofstream output_stream_pdr;
-        output_stream_pdr.open(args.output_file_pdr);
-        write_header_pdr(output_stream_pdr);
+    // Reads whose mate was never read (e.g. filtered out) are not processed
+    mates.drop_all();
 
-        for (auto it = all_CpGs.begin(); it != all_CpGs.end(); it++)
-        {
-            write_record_pdr(output_stream_pdr, mapping_file.header().ref_ids(), it->first, it->second, args.coverage_filter);
-        }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    progress << "Finished BAM file processing" << std::endl;
+    progress << "Processed " << num_records << " records in " << elapsed.count() << " s ("
+             << num_records / std::max(elapsed.count(), 1e-9) << " records/s, "
+             << args.threads << (args.sharded ? " worker" : " decompression") << " thread(s))" << std::endl;
+    if constexpr (!single_end)
+    {
+        progress << "Dropped " << mates.num_orphans() << " read(s) whose mate was not found" << std::endl;
+        progress << "At most " << mates.peak_size() << " read(s) waited for their mate at once" << std::endl;
+    }
+    progress << "Finished writing 'single_read' output" << std::endl;
+    if (cache)
+        progress << "Finished writing epiallele cache" << std::endl;
 
-        output_stream_pdr.close();
+    if (partial)
+    {
+        write_scores(genome_end);
+        partial->finish();
+        partial_file.finish();
 
-        std::cout << "Finished writing 'pdr' output" << std::endl;
+        progress << "Finished writing partial counts" << std::endl;
     }
-
-    if constexpr (calc_entropy_score)
+    else
     {
-        std::cout << "Starting entropy and epipolymorphism calculations" << std::endl;
+        if constexpr (calc_pdr_score)
+        {
+            progress << "Starting PDR and RTS calculations" << std::endl;
 
-        std::ofstream output_stream_entropy;
-        output_stream_entropy.open(args.output_file_entropy);
-        write_header_entropy(output_stream_entropy);
+            write_final_records_pdr(pdr_output, mapping_file.header().ref_ids(), all_CpGs, genome_end, args.coverage_filter);
 
-        for (auto it = all_kmers.begin(); it != all_kmers.end(); it++)
-        {
-            write_record_entropy(output_stream_entropy, mapping_file.header().ref_ids(), it->first, it->second, args.coverage_filter);
+            pdr_file.finish();
+
+            progress << "Finished writing 'pdr' output" << std::endl;
         }
 
-        output_stream_entropy.close();
+        if constexpr (calc_entropy_score)
+        {
+            progress << "Starting entropy and epipolymorphism calculations" << std::endl;
+
+            write_final_records_entropy(entropy_output, mapping_file.header().ref_ids(), all_kmers, genome_end, args.coverage_filter);
 
-        std::cout << "Finished writing 'entropy' output" << std::endl;
+            entropy_file.finish();
+
+            progress << "Finished writing 'entropy' output" << std::endl;
+        }
     }
 
-    std::cout << "Terminating RLM" << std::endl;
+    // Time the processing waited because the output could not be written fast enough
+    double const stall_seconds = single_read_file.stall_seconds() + pdr_file.stall_seconds() + entropy_file.stall_seconds() +
+                                 cache_file.stall_seconds() + partial_file.stall_seconds();
+    progress << "Waited " << stall_seconds << " s for output to be written" << std::endl;
+
+    // The checkpoint is not needed anymore once all outputs are complete
+    if (checkpoints)
+        std::filesystem::remove(args.checkpoint_file);
 
     return 0;
 }
@@ -0,0 +1,44 @@
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../../include/async_output.hpp"
+
+TEST(async_output, order)
+{
+    // Small buffers and a short queue make the writing thread wait for the background thread
+    std::ostringstream output;
+    std::string expected;
+    {
+        async_output_buffer buffer{output, "test.bed", 16, 1};
+        std::ostream stream{&buffer};
+
+        for (int i = 0; i < 10000; i++)
+        {
+            std::string line = "line " + std::to_string(i) + "\n";
+            stream << line;
+            expected += line;
+        }
+        stream << 'x';
+        expected += 'x';
+
+        buffer.finish();
+        EXPECT_GE(buffer.stall_seconds(), 0);
+    }
+
+    EXPECT_EQ(output.str(), expected);
+}
+
+TEST(async_output, error)
+{
+    std::ostringstream output;
+    output.setstate(std::ios::badbit);
+
+    async_output_buffer buffer{output, "test.bed"};
+    std::ostream stream{&buffer};
+    stream << "lost";
+
+    EXPECT_THROW(buffer.finish(), std::runtime_error);
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/batch.hpp"
+
+TEST(batch, sample_sheet)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "batch_sample_sheet.tsv";
+    {
+        std::ofstream sheet{file};
+        sheet << "# bam\tprefix\n"
+              << "data/sample1.bam\tout/sample1\n"
+              << "\n"
+              << "data/sample2.bam\r\n";
+    }
+
+    std::vector<batch_sample> samples = read_sample_sheet(file);
+    ASSERT_EQ(samples.size(), 2u);
+    EXPECT_EQ(samples[0].bam_file, "data/sample1.bam");
+    EXPECT_EQ(samples[0].output_prefix, "out/sample1");
+    EXPECT_EQ(samples[1].bam_file, "data/sample2.bam");
+    EXPECT_EQ(samples[1].output_prefix, "data/sample2");
+
+    // Samples must not overwrite the outputs of each other
+    {
+        std::ofstream sheet{file};
+        sheet << "sample1.bam\tout\n"
+              << "sample2.bam\tout\n";
+    }
+    EXPECT_THROW(read_sample_sheet(file), std::runtime_error);
+
+    {
+        std::ofstream sheet{file};
+        sheet << "# no samples\n";
+    }
+    EXPECT_THROW(read_sample_sheet(file), std::runtime_error);
+
+    std::filesystem::remove(file);
+}
+
+TEST(batch, memory_budget)
+{
+    std::vector<batch_sample> samples(12);
+    std::vector<uint64_t> estimated_memory{300, 100, 100, 100, 500, 100, 100, 100, 100, 100, 100, 100};
+
+    for (uint64_t memory_budget : {0, 250, 400})
+    {
+        std::atomic<size_t> running{0};
+        std::atomic<uint64_t> reserved{0};
+        std::atomic<size_t> max_running{0};
+        std::atomic<bool> over_budget{false};
+        std::vector<size_t> started;
+        std::mutex mutex;
+
+        size_t num_failed = process_samples(samples, estimated_memory, 4, memory_budget, [&] (size_t const i)
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                started.push_back(i);
+            }
+
+            size_t const now_running = ++running;
+            uint64_t const now_reserved = reserved += estimated_memory[i];
+            if (memory_budget > 0 && now_running > 1 && now_reserved > memory_budget)
+                over_budget = true;
+            max_running = std::max<size_t>(max_running, now_running);
+
+            std::this_thread::sleep_for(std::chrono::milliseconds{5});
+
+            reserved -= estimated_memory[i];
+            running--;
+            return i != 3;
+        });
+
+        EXPECT_EQ(num_failed, 1u);
+        EXPECT_FALSE(over_budget);
+        EXPECT_LE(max_running, 4u);
+
+        // Every sample is processed once
+        std::vector<size_t> expected(samples.size());
+        std::iota(expected.begin(), expected.end(), 0);
+        std::sort(started.begin(), started.end());
+        EXPECT_EQ(started, expected);
+    }
+}
+
+TEST(batch, memory_estimate)
+{
+    // Only the counts of files that are not sorted by position may span the whole genome
+    EXPECT_EQ(estimate_sample_memory(true, true, true, 1000), batch_sample_base_memory);
+    EXPECT_EQ(estimate_sample_memory(false, false, false, 1000), batch_sample_base_memory);
+    EXPECT_EQ(estimate_sample_memory(false, true, false, 1000), batch_sample_base_memory + 20000);
+    EXPECT_EQ(estimate_sample_memory(false, true, true, 1000), batch_sample_base_memory + 84000);
+}
@@ -0,0 +1,122 @@
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../../include/bam_index.hpp"
+#include "../../include/output.hpp"
+
+// Uncompressed content of a BGZF file (at least length bytes of it), starting at a virtual file offset
+std::string read_bgzf(std::filesystem::path const & file, uint64_t const voffset = 0, size_t const length = std::string::npos)
+{
+    bgzf_reader reader{file};
+    reader.seek(voffset);
+
+    std::string content;
+    while (content.size() < length && reader.fill())
+    {
+        content.append(reader.block_data() + reader.block_offset(), reader.block_size() - reader.block_offset());
+        reader.skip(reader.block_size() - reader.block_offset());
+    }
+    return content;
+}
+
+TEST(bgzf_output, round_trip)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "bgzf_output_round_trip.bed.gz";
+    std::string expected = "#chr\tstart\tend\n";
+    {
+        output_file output;
+        output.open(file, 3);
+        output.stream() << expected;
+
+        // Several groups of blocks compressed in parallel
+        for (int i = 0; i < 200000; i++)
+        {
+            std::string line = "chr1\t" + std::to_string(i) + "\t" + std::to_string(i + 1) + "\n";
+            output.stream() << line;
+            expected += line;
+        }
+
+        output.finish();
+    }
+
+    EXPECT_EQ(read_bgzf(file), expected);
+    std::filesystem::remove(file);
+}
+
+TEST(bgzf_output, index)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "bgzf_output_index.bed.gz";
+    {
+        output_file output;
+        output.open(file, 2, true);
+        output.stream() << "#chr\tstart\tend\n";
+        for (std::string chr : {"chr1", "chr2"})
+            for (int i = 0; i < 50000; i++)
+                output.stream() << chr << '\t' << i * 100 << '\t' << i * 100 + 2 << "\tvalue\n";
+        output.finish();
+    }
+
+    bgzf_reader index{file.string() + ".tbi"};
+    char magic[4];
+    index.read(magic, 4);
+    EXPECT_EQ(std::string(magic, 4), std::string("TBI\1", 4));
+    ASSERT_EQ(index.read<int32_t>(), 2);
+
+    // BED settings: format, columns of sequence, start and end, meta character, skipped lines
+    EXPECT_EQ(index.read<int32_t>(), 0x10000);
+    EXPECT_EQ(index.read<int32_t>(), 1);
+    EXPECT_EQ(index.read<int32_t>(), 2);
+    EXPECT_EQ(index.read<int32_t>(), 3);
+    EXPECT_EQ(index.read<int32_t>(), '#');
+    EXPECT_EQ(index.read<int32_t>(), 0);
+    std::string names(index.read<int32_t>(), '\0');
+    index.read(names.data(), names.size());
+    EXPECT_EQ(names, std::string("chr1\0chr2\0", 10));
+
+    // Every chunk and window of the linear index starts at a line of its reference sequence
+    for (std::string chr : {"chr1\t", "chr2\t"})
+    {
+        int32_t n_bins = index.read<int32_t>();
+        EXPECT_GT(n_bins, 0);
+        for (int32_t i = 0; i < n_bins; i++)
+        {
+            index.read<uint32_t>();
+            int32_t n_chunks = index.read<int32_t>();
+            for (int32_t j = 0; j < n_chunks; j++)
+            {
+                uint64_t begin = index.read<uint64_t>();
+                uint64_t end = index.read<uint64_t>();
+                EXPECT_LT(begin, end);
+                EXPECT_EQ(read_bgzf(file, begin, 5).substr(0, 5), chr);
+            }
+        }
+
+        // 5000000 bp in windows of 16384 bp
+        int32_t n_intervals = index.read<int32_t>();
+        EXPECT_EQ(n_intervals, 306);
+        for (int32_t i = 0; i < n_intervals; i++)
+        {
+            std::string line = read_bgzf(file, index.read<uint64_t>(), 16);
+            EXPECT_EQ(line.substr(0, 5), chr);
+            EXPECT_EQ(std::stoul(line.substr(5)) / 16384, static_cast<unsigned long>(i));
+        }
+    }
+
+    std::filesystem::remove(file);
+    std::filesystem::remove(file.string() + ".tbi");
+}
+
+TEST(bgzf_output, unsorted)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "bgzf_output_unsorted.bed.gz";
+
+    output_file output;
+    output.open(file, 1, true);
+    output.stream() << "chr1\t100\t102\nchr1\t50\t52\n";
+
+    EXPECT_THROW(output.finish(), std::runtime_error);
+    std::filesystem::remove(file);
+}
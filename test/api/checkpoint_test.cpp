@@ -0,0 +1,116 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/checkpoint.hpp"
+#include "../../include/output.hpp"
+
+using seqan3::operator""_dna5;
+
+// A reference with many CpGs on two sequences
+std::filesystem::path write_checkpoint_reference()
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "checkpoint_reference.fa";
+    std::ofstream fasta_stream{file};
+    fasta_stream << ">chr1\n";
+    for (size_t i = 0; i < 20000; i++)
+        fasta_stream << "ACGTTCG" << (i % 10 == 9 ? "\n" : "");
+    fasta_stream << "\n>chr2\n";
+    for (size_t i = 0; i < 5000; i++)
+        fasta_stream << "TCGA" << (i % 10 == 9 ? "\n" : "");
+    fasta_stream << "\n";
+    return file;
+}
+
+void add_checkpoint_reads(cpg_counts_t & all_CpGs, kmer_counts_t & all_kmers, reference_genome & reference)
+{
+    for (size_t i = 0; i < 10000; i++)
+    {
+        methylation_pattern pattern = make_methylation_pattern({i % 2 == 0, i % 3 == 0, i % 5 == 0, i % 7 == 0, true});
+        size_t const ref_id = i < 8000 ? 0 : 1;
+        cpg_table cpgs = reference.cpg_positions(ref_id);
+        all_CpGs.add_read(ref_id, cpgs, i % 8000 * 3, pattern, i % 2, i % 11);
+        all_kmers.add_read(ref_id, cpgs, i % 8000 * 3, pattern);
+    }
+}
+
+mate_read make_checkpoint_read(std::string const & id, uint64_t const position, uint64_t const mate_position)
+{
+    mate_read read{read_name_key(id), id, read_type::FWD, false, 0, position, position, mate_position};
+    read.sequence = "ACGTNACGT"_dna5;
+    read.length = read.sequence.size();
+    read.order = position;
+    return read;
+}
+
+TEST(checkpoint, round_trip)
+{
+    std::filesystem::path fasta = write_checkpoint_reference();
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "checkpoint_round_trip.ckpt";
+    reference_genome reference{fasta};
+    std::deque<std::string> ref_ids{"chr1", "chr2"};
+
+    // Counts of some CpGs are written before the checkpoint
+    cpg_counts_t all_CpGs;
+    kmer_counts_t all_kmers;
+    add_checkpoint_reads(all_CpGs, all_kmers, reference);
+    std::ostringstream written;
+    write_final_records_pdr(written, ref_ids, all_CpGs, GenomePosition{0, 30000}, 1);
+    write_final_records_entropy(written, ref_ids, all_kmers, GenomePosition{0, 30000}, 1);
+
+    mate_buffer mates;
+    mates.insert(make_checkpoint_read("read1", 100, 150));
+    mates.insert(make_checkpoint_read("read2", 120, 40000));
+
+    write_checkpoint(file, "options", GenomePosition{0, 35000}, {1234, 0, 56}, mates, all_CpGs, all_kmers);
+    EXPECT_FALSE(std::filesystem::exists(file.string() + ".tmp"));
+
+    checkpoint state = read_checkpoint(file, "options", reference, false);
+    EXPECT_EQ(state.read_position, (GenomePosition{0, 35000}));
+    EXPECT_EQ(state.output_sizes, (std::vector<std::streamoff>{1234, 0, 56}));
+
+    // The restored mates are paired like the stored ones
+    EXPECT_EQ(state.mates.size(), 2u);
+    std::optional<mate_read> mate = state.mates.take(make_checkpoint_read("read2", 40000, 120));
+    ASSERT_TRUE(mate);
+    EXPECT_EQ(mate->position, 120u);
+    EXPECT_EQ(mate->sequence, "ACGTNACGT"_dna5);
+
+    // The restored counts give the same scores as the stored ones
+    std::ostringstream expected;
+    std::ostringstream restored;
+    write_final_records_pdr(expected, ref_ids, all_CpGs, genome_end, 1);
+    write_final_records_entropy(expected, ref_ids, all_kmers, genome_end, 1);
+    write_final_records_pdr(restored, ref_ids, state.all_CpGs, genome_end, 1);
+    write_final_records_entropy(restored, ref_ids, state.all_kmers, genome_end, 1);
+    EXPECT_GT(restored.str().size(), 0u);
+    EXPECT_EQ(restored.str(), expected.str());
+
+    std::filesystem::remove(file);
+    std::filesystem::remove(fasta);
+}
+
+TEST(checkpoint, invalid)
+{
+    std::filesystem::path fasta = write_checkpoint_reference();
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "checkpoint_invalid.ckpt";
+    reference_genome reference{fasta};
+
+    cpg_counts_t all_CpGs;
+    kmer_counts_t all_kmers;
+    add_checkpoint_reads(all_CpGs, all_kmers, reference);
+    write_checkpoint(file, "options", GenomePosition{1, 10}, {0, 0, 0}, mate_buffer{}, all_CpGs, all_kmers);
+
+    // A checkpoint of a run with other options is not used
+    EXPECT_THROW(read_checkpoint(file, "other options", reference, false), std::runtime_error);
+
+    std::filesystem::resize_file(file, std::filesystem::file_size(file) - 1);
+    EXPECT_THROW(read_checkpoint(file, "options", reference, false), std::runtime_error);
+
+    std::filesystem::remove(file);
+    std::filesystem::remove(fasta);
+}
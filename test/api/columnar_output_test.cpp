@@ -0,0 +1,124 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../../include/columnar_output.hpp"
+
+// Single read output of reads on two reference sequences, filling several blocks
+std::string single_read_lines()
+{
+    std::ostringstream stream;
+    {
+        text_writer output{stream};
+        methylation_pattern pattern;
+
+        for (uint64_t i = 0; i < 150000; i++)
+        {
+            pattern.size = 3 + i % 70;
+            pattern.bits.assign((pattern.size + 63) / 64, 0x9e3779b97f4a7c15 * (i + 1));
+            pattern.bits.back() &= pattern.size % 64 == 0 ? ~uint64_t{0} : (uint64_t{1} << (pattern.size % 64)) - 1;
+
+            // The second reference sequence is not sorted by position
+            uint64_t const start = i < 100000 ? i * 10 : (i * 7919) % 50000;
+            write_record_single_read(output, i < 100000 ? "chr1" : "chr2", start, start + 100 + i % 200, "read" + std::to_string(i), pattern);
+        }
+    }
+    return stream.str();
+}
+
+TEST(columnar_output, round_trip)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "columnar_output_round_trip.rlmc";
+    std::string lines = single_read_lines();
+    {
+        std::ofstream output_stream{file, std::ios::binary};
+        columnar_output_buffer buffer{output_stream, {"chr1", "chr2", "chr3"}};
+        std::ostream stream{&buffer};
+        stream << "#chr\tstart\tend\n" << lines;
+        buffer.finish();
+    }
+
+    columnar_reader reader{file};
+    EXPECT_EQ(reader.references(), (std::deque<std::string>{"chr1", "chr2", "chr3"}));
+
+    std::ostringstream result;
+    {
+        text_writer output{result};
+        reader.view(output);
+    }
+    EXPECT_EQ(result.str(), lines);
+
+    std::filesystem::remove(file);
+}
+
+TEST(columnar_output, region)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "columnar_output_region.rlmc";
+    std::string lines = single_read_lines();
+    {
+        std::ofstream output_stream{file, std::ios::binary};
+        columnar_output_buffer buffer{output_stream, {"chr1", "chr2"}};
+        std::ostream stream{&buffer};
+        stream << lines;
+        buffer.finish();
+    }
+
+    columnar_reader reader{file};
+    for (named_region region : {named_region{"chr1", 700000, 700050},
+                                named_region{"chr1", 0, 10},
+                                named_region{"chr2", 20000, 20500},
+                                named_region{"chr2", 60000, 70000}})
+    {
+        std::ostringstream result;
+        {
+            text_writer output{result};
+            reader.view(output, region);
+        }
+
+        std::string expected;
+        std::istringstream input{lines};
+        for (std::string line; std::getline(input, line);)
+        {
+            std::istringstream fields{line};
+            std::string chr;
+            uint64_t start, end;
+            fields >> chr >> start >> end;
+            if (chr == region.chr && start < region.end && end > region.start)
+                expected += line + "\n";
+        }
+
+        EXPECT_EQ(result.str(), expected);
+    }
+
+    std::filesystem::remove(file);
+}
+
+TEST(columnar_output, invalid_line)
+{
+    std::ostringstream output_stream;
+    for (std::string line : {"chr1\t100\t200\tread1\tgGg\t3\t1\t0\t0\t0.333333\n",
+                             "chr3\t100\t200\tread1\tgGg\t3\t1\t0\t0\t0.333333\n",
+                             "chr1\t1x0\t200\tread1\tgGg\t3\t1\t0\t0\t0.333333\n",
+                             "chr1\t100\t\tread1\tgGg\t3\t1\t0\t0\t0.333333\n",
+                             "chr1\t100\t200\tread1\tgGg\t4\t1\t0\t0\t0.333333\n",
+                             "chr1\t100\t200\tread1\tgNg\t3\t1\t0\t0\t0.333333\n",
+                             "chr1\t100\t200\tread1\tgGg\t3\n"})
+    {
+        columnar_output_buffer buffer{output_stream, {"chr1", "chr2"}};
+        std::ostream stream{&buffer};
+        stream.exceptions(std::ios::badbit);
+
+        // Only the first line is valid
+        if (line.starts_with("chr1\t100\t200\tread1\tgGg\t3\t1\t"))
+        {
+            EXPECT_NO_THROW(stream << line);
+        }
+        else
+        {
+            EXPECT_THROW(stream << line, std::runtime_error);
+        }
+    }
+}
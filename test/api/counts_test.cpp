@@ -0,0 +1,130 @@
+#include <array>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/counts.hpp"
+
+using cpg_record_t = std::pair<GenomePosition, std::tuple<num_reads_t, num_discordant_reads_t, sum_transitions_t, num_methyl_cpgs_t> >;
+
+std::vector<cpg_record_t> extract_all(cpg_counts & counts, GenomePosition const & end)
+{
+    std::vector<cpg_record_t> records;
+    counts.extract(end, [&] (GenomePosition const & pos, auto const & ... position_counts)
+    {
+        records.emplace_back(pos, std::make_tuple(position_counts...));
+    });
+    return records;
+}
+
+TEST(counts, cpgs)
+{
+    std::vector<uint32_t> positions{10, 20, 30, 40, 50, 60};
+    cpg_table cpgs = std::make_shared<std::span<uint32_t const> const>(positions);
+
+    cpg_counts counts;
+    counts.add_read(1, cpgs, 2, make_methylation_pattern({1, 1, 0}), 1, 5);
+    counts.add_read(1, cpgs, 1, make_methylation_pattern({1, 1, 1}), 0, 0);
+
+    // Reads added in another order, e.g. by another shard
+    cpg_counts other;
+    other.add_read(1, cpgs, 3, make_methylation_pattern({0, 0, 1}), 1, 7);
+    other.add_read(0, cpgs, 0, make_methylation_pattern({1, 0, 1}), 1, 2);
+    counts.merge(other);
+
+    EXPECT_TRUE(extract_all(other, genome_end).empty());
+
+    // Counts are extracted in order of the position and removed
+    std::vector<cpg_record_t> first = extract_all(counts, GenomePosition{1, 40});
+    std::vector<cpg_record_t> expected_first{{GenomePosition{0, 10}, {1, 1, 2, 1}},
+                                             {GenomePosition{0, 20}, {1, 1, 2, 0}},
+                                             {GenomePosition{0, 30}, {1, 1, 2, 1}},
+                                             {GenomePosition{1, 20}, {1, 0, 0, 1}},
+                                             {GenomePosition{1, 30}, {2, 1, 5, 2}}};
+    EXPECT_EQ(first, expected_first);
+
+    std::vector<cpg_record_t> second = extract_all(counts, genome_end);
+    std::vector<cpg_record_t> expected_second{{GenomePosition{1, 40}, {3, 2, 12, 2}},
+                                              {GenomePosition{1, 50}, {2, 2, 12, 0}},
+                                              {GenomePosition{1, 60}, {1, 1, 7, 1}}};
+    EXPECT_EQ(second, expected_second);
+
+    EXPECT_TRUE(extract_all(counts, genome_end).empty());
+}
+
+using kmer_record_t = std::pair<GenomePosition, epiallele_counts_t>;
+
+std::vector<kmer_record_t> extract_all(kmer_counts & counts, GenomePosition const & end)
+{
+    std::vector<kmer_record_t> records;
+    counts.extract(end, [&] (GenomePosition const & pos, epiallele_counts_t const & epialleles)
+    {
+        records.emplace_back(pos, epialleles);
+    });
+    return records;
+}
+
+TEST(counts, kmers)
+{
+    std::vector<uint32_t> positions{10, 20, 30, 40, 50, 60};
+    cpg_table cpgs = std::make_shared<std::span<uint32_t const> const>(positions);
+
+    kmer_counts counts;
+    counts.add_read(0, cpgs, 1, make_methylation_pattern({1, 1, 0, 1, 0}));
+    counts.add_read(0, cpgs, 0, make_methylation_pattern({0, 0, 0}));
+
+    kmer_counts other;
+    other.add_read(0, cpgs, 1, make_methylation_pattern({1, 1, 0, 1}));
+    counts.merge(other);
+
+    EXPECT_TRUE(extract_all(other, genome_end).empty());
+
+    // 1101 twice and 1010 once
+    epiallele_counts_t first{};
+    first[epiallele_pos_array[1][1][0][1]] = 2;
+    epiallele_counts_t second{};
+    second[epiallele_pos_array[1][0][1][0]] = 1;
+
+    std::vector<kmer_record_t> expected{{GenomePosition{0, 20}, first}, {GenomePosition{0, 30}, second}};
+    EXPECT_EQ(extract_all(counts, genome_end), expected);
+}
+
+TEST(counts, concurrent)
+{
+    std::vector<uint32_t> positions(1000);
+    for (size_t i = 0; i < positions.size(); i++)
+        positions[i] = 10 * i;
+    cpg_table cpgs = std::make_shared<std::span<uint32_t const> const>(positions);
+
+    auto add_read = [&] (cpg_counts & counts, size_t const i)
+    {
+        counts.add_read(i % 2, cpgs, (7 * i) % 990, make_methylation_pattern({i % 3 == 0, true, i % 5 == 0}), i % 2, i);
+    };
+
+    cpg_counts serial;
+    for (size_t i = 0; i < 4000; i++)
+        add_read(serial, i);
+
+    // Reads are added by several threads at once and merged in between
+    cpg_counts total;
+    concurrent_counts<cpg_counts> counts{4};
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < 4; thread++)
+    {
+        threads.emplace_back([&, thread] ()
+        {
+            for (size_t i = thread; i < 4000; i += 4)
+            {
+                auto [lock, local] = counts.local(thread);
+                add_read(local, i);
+            }
+        });
+    }
+    counts.merge_into(total);
+    for (auto & thread : threads)
+        thread.join();
+    counts.merge_into(total);
+
+    EXPECT_EQ(extract_all(total, genome_end), extract_all(serial, genome_end));
+}
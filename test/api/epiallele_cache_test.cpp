@@ -0,0 +1,106 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/epiallele_cache.hpp"
+
+TEST(epiallele_cache, round_trip)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "epiallele_cache_round_trip.rlme";
+
+    struct read_record
+    {
+        size_t ref_id;
+        size_t first_cpg;
+        methylation_pattern pattern;
+    };
+
+    // Patterns of all lengths up to several words, some added as encoded records like the batches of the workers
+    std::vector<read_record> reads;
+    for (size_t i = 0; i < 5000; i++)
+    {
+        methylation_pattern pattern;
+        pattern.size = 3 + i % 150;
+        pattern.bits.assign((pattern.size + 63) / 64, 0x9e3779b97f4a7c15 * (i + 1));
+        pattern.bits.back() &= pattern.size % 64 == 0 ? ~uint64_t{0} : (uint64_t{1} << (pattern.size % 64)) - 1;
+        reads.push_back(read_record{i < 3000 ? 0u : 1u, i * 1000003 % 400000000, pattern});
+    }
+
+    {
+        std::ofstream output_stream{file, std::ios::binary};
+        epiallele_cache_writer cache{output_stream, {"chr1", "chr2"}, true};
+
+        std::string records;
+        for (size_t i = 0; i < reads.size(); i++)
+        {
+            if (i / 10 % 2 == 0)
+                cache.add_read(reads[i].ref_id, reads[i].first_cpg, reads[i].pattern);
+            else
+                epiallele_cache_writer::encode_read(records, reads[i].ref_id, reads[i].first_cpg, reads[i].pattern);
+
+            if (i % 10 == 9)
+            {
+                cache.add_records(records);
+                records.clear();
+            }
+            if (i == 2999)
+                cache.final_position(GenomePosition{1, 0});
+        }
+        cache.final_position(GenomePosition{1, 123456789});
+    }
+
+    epiallele_cache_reader cache{file};
+    EXPECT_EQ(cache.references(), (std::deque<std::string>{"chr1", "chr2"}));
+    EXPECT_TRUE(cache.sorted());
+
+    size_t num_read = 0;
+    std::vector<std::pair<size_t, GenomePosition>> positions;
+    uint64_t num_reads = cache.read([&] (size_t const ref_id, size_t const first_cpg, methylation_pattern const & pattern)
+    {
+        ASSERT_LT(num_read, reads.size());
+        EXPECT_EQ(ref_id, reads[num_read].ref_id);
+        EXPECT_EQ(first_cpg, reads[num_read].first_cpg);
+        EXPECT_EQ(pattern.size, reads[num_read].pattern.size);
+        EXPECT_EQ(pattern.bits, reads[num_read].pattern.bits);
+        num_read++;
+    },
+    [&] (GenomePosition const & end)
+    {
+        positions.emplace_back(num_read, end);
+    });
+
+    EXPECT_EQ(num_reads, reads.size());
+    EXPECT_EQ(num_read, reads.size());
+    ASSERT_EQ(positions.size(), 2u);
+    EXPECT_EQ(positions[0].first, 3000u);
+    EXPECT_EQ(positions[0].second.ref_id, 1);
+    EXPECT_EQ(positions[0].second.start, 0u);
+    EXPECT_EQ(positions[1].first, reads.size());
+    EXPECT_EQ(positions[1].second.start, 123456789u);
+
+    std::filesystem::remove(file);
+}
+
+TEST(epiallele_cache, truncated)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "epiallele_cache_truncated.rlme";
+    {
+        std::ofstream output_stream{file, std::ios::binary};
+        epiallele_cache_writer cache{output_stream, {"chr1"}, false};
+
+        methylation_pattern pattern;
+        pattern.size = 100;
+        pattern.bits = {~uint64_t{0}, 0xf};
+        cache.add_read(0, 42, pattern);
+    }
+    std::filesystem::resize_file(file, std::filesystem::file_size(file) - 1);
+
+    epiallele_cache_reader cache{file};
+    EXPECT_FALSE(cache.sorted());
+    EXPECT_THROW(cache.read([] (size_t, size_t, methylation_pattern const &) {}, [] (GenomePosition const &) {}), std::runtime_error);
+
+    std::filesystem::remove(file);
+}
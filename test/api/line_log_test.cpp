@@ -0,0 +1,50 @@
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/line_log.hpp"
+
+TEST(line_log, prefix)
+{
+    std::ostringstream output;
+    {
+        line_log progress{"sample1: ", output};
+        progress << "Processed " << 10 << " records" << std::endl;
+        progress << "Finished\n";
+        progress << "No line end";
+    }
+
+    EXPECT_EQ(output.str(), "sample1: Processed 10 records\nsample1: Finished\nsample1: No line end");
+}
+
+TEST(line_log, concurrent)
+{
+    // Lines written at once by several logs are not mixed
+    std::ostringstream output;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; i++)
+    {
+        threads.emplace_back([&output, i] ()
+        {
+            line_log progress{"sample" + std::to_string(i) + ": ", output};
+            for (size_t j = 0; j < 1000; j++)
+                progress << "line " << j << " of " << "sample" << i << std::endl;
+        });
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    std::istringstream lines{output.str()};
+    std::string line;
+    size_t num_lines = 0;
+    while (std::getline(lines, line))
+    {
+        std::string const sample = line.substr(0, line.find(':'));
+        EXPECT_EQ(line.substr(line.rfind(' ') + 1), sample);
+        num_lines++;
+    }
+    EXPECT_EQ(num_lines, 4000u);
+}
@@ -0,0 +1,87 @@
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../../include/mate_buffer.hpp"
+
+using seqan3::operator""_dna5;
+
+mate_read make_read(std::string const & id, uint64_t const position, uint64_t const mate_position, uint64_t const order)
+{
+    mate_read read{read_name_key(id), id, read_type::FWD, false, 1, position, position, mate_position};
+    read.sequence = "ACGTNACGT"_dna5;
+    read.length = read.sequence.size();
+    read.order = order;
+    return read;
+}
+
+TEST(mate_buffer, pairing)
+{
+    mate_buffer mates;
+    mates.insert(make_read("read1", 100, 150, 0));
+    mates.insert(make_read("read2", 120, 130, 1));
+
+    // Same name, but not aligned where the stored read expects its mate
+    EXPECT_FALSE(mates.take(make_read("read1", 160, 100, 2)));
+
+    std::optional<mate_read> mate = mates.take(make_read("read1", 150, 100, 3));
+    ASSERT_TRUE(mate);
+    EXPECT_EQ(mate->id, "read1");
+    EXPECT_EQ(mate->position, 100u);
+    EXPECT_EQ(mate->order, 0u);
+    EXPECT_EQ(mate->sequence, "ACGTNACGT"_dna5);
+    EXPECT_EQ(mates.size(), 1u);
+}
+
+TEST(mate_buffer, clipped_bases)
+{
+    // Only the processed bases are stored
+    mate_buffer mates;
+    mate_read read = make_read("read1", 100, 150, 0);
+    read.begin = 2;
+    read.length = 5;
+    mates.insert(std::move(read));
+
+    std::optional<mate_read> mate = mates.take(make_read("read1", 150, 100, 1));
+    ASSERT_TRUE(mate);
+    EXPECT_EQ(mate->sequence, "GTNAC"_dna5);
+    EXPECT_EQ(mate->bases().size(), 5u);
+}
+
+TEST(mate_buffer, orphans)
+{
+    mate_buffer mates{true};
+    mates.insert(make_read("read1", 100, 90, 0));
+    mates.insert(make_read("read2", 120, 130, 1));
+    mates.insert(make_read("read3", 110, 200, 2));
+
+    // The mate of read1 was expected before, so it will never be read
+    EXPECT_EQ(mates.first_open_position(GenomePosition{1, 125}), (GenomePosition{1, 110}));
+    EXPECT_EQ(mates.num_orphans(), 1u);
+
+    std::vector<mate_read> reads = mates.release();
+    ASSERT_EQ(reads.size(), 2u);
+    EXPECT_EQ(reads[0].id, "read2");
+    EXPECT_EQ(reads[1].id, "read3");
+
+    mates.insert(std::move(reads[0]));
+    mates.drop_all();
+    EXPECT_EQ(mates.num_orphans(), 2u);
+    EXPECT_EQ(mates.size(), 0u);
+}
+
+TEST(mate_buffer, peak_size)
+{
+    mate_buffer mates{true};
+    for (uint64_t i = 0; i < 20; i++)
+    {
+        mates.insert(make_read("read" + std::to_string(i), i * 100, i * 100 + 50, i));
+
+        // Every read whose mate was expected before the current position is dropped
+        mates.first_open_position(GenomePosition{1, i * 100 + 10});
+    }
+
+    EXPECT_EQ(mates.num_orphans(), 19u);
+    EXPECT_EQ(mates.size(), 1u);
+    EXPECT_EQ(mates.peak_size(), 2u);
+}
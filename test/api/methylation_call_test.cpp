@@ -0,0 +1,100 @@
+#include <random>
+#include <span>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/methylation_call.hpp"
+
+using seqan3::operator""_dna5;
+
+// Methylation call of a single CpG as done before the vectorized call
+bool call_cpg(seqan3::dna5_vector const & sequence, uint16_t const position, bool const reverse, bool & methylated)
+{
+    if (reverse)
+    {
+        methylated = sequence[position + 1] == 'G'_dna5;
+        return sequence[position] == 'C'_dna5 && (sequence[position + 1] == 'A'_dna5 || sequence[position + 1] == 'G'_dna5);
+    }
+
+    methylated = sequence[position] == 'C'_dna5;
+    return (sequence[position] == 'C'_dna5 || sequence[position] == 'T'_dna5) && sequence[position + 1] == 'G'_dna5;
+}
+
+TEST(methylation_call, forward_and_reverse)
+{
+    seqan3::dna5_vector sequence = "CGTGCATGCANG"_dna5;
+    std::vector<uint64_t> methylation;
+
+    EXPECT_TRUE(call_methylation(sequence, {0, 2, 6}, false, methylation));
+    EXPECT_EQ(methylation, (std::vector<uint64_t>{0b001}));
+    EXPECT_FALSE(call_methylation(sequence, {0, 2, 4}, false, methylation));
+
+    EXPECT_TRUE(call_methylation(sequence, {0, 4, 8}, true, methylation));
+    EXPECT_EQ(methylation, (std::vector<uint64_t>{0b001}));
+    EXPECT_FALSE(call_methylation(sequence, {0, 4, 10}, true, methylation));
+}
+
+TEST(methylation_call, random_reads)
+{
+    std::mt19937 generator{42};
+
+    for (size_t read_length : {20, 150, 250, 1000})
+    {
+        for (size_t n = 0; n < 200; n++)
+        {
+            // Mostly methylated or unmethylated CpGs with a few sequencing errors
+            seqan3::dna5_vector sequence(read_length);
+            for (auto & base : sequence)
+                base.assign_rank(generator() % 5);
+
+            bool reverse = n % 2;
+            std::vector<uint16_t> cpg_pos;
+            for (size_t i = generator() % 3; i + 1 < read_length; i += 2 + generator() % 4)
+            {
+                cpg_pos.push_back(i);
+                if (generator() % 64)
+                {
+                    bool methylated = generator() % 2;
+                    sequence[i] = reverse || methylated ? 'C'_dna5 : 'T'_dna5;
+                    sequence[i + 1] = !reverse || methylated ? 'G'_dna5 : 'A'_dna5;
+                }
+            }
+
+            bool expected_valid = true;
+            std::vector<uint64_t> expected_methylation((cpg_pos.size() + 63) / 64, 0);
+            for (size_t i = 0; i < cpg_pos.size(); i++)
+            {
+                bool methylated;
+                expected_valid &= call_cpg(sequence, cpg_pos[i], reverse, methylated);
+                expected_methylation[i / 64] |= static_cast<uint64_t>(methylated) << (i % 64);
+            }
+
+            std::vector<uint64_t> methylation;
+            bool valid = call_methylation(sequence, cpg_pos, reverse, methylation);
+
+            EXPECT_EQ(valid, expected_valid);
+            if (expected_valid)
+            {
+                EXPECT_EQ(methylation, expected_methylation);
+            }
+
+            std::vector<uint64_t> scalar_methylation((cpg_pos.size() + 63) / 64, 0);
+            EXPECT_EQ(call_methylation_scalar(reinterpret_cast<uint8_t const *>(sequence.data()),
+                                              0, cpg_pos.data(), 0, cpg_pos.size(), reverse, scalar_methylation.data()),
+                      valid);
+            EXPECT_EQ(scalar_methylation, methylation);
+
+            // Same read given in two parts, e.g. two overlapping mates
+            size_t split = generator() % read_length;
+            std::span<seqan3::dna5 const> bases{sequence};
+            std::vector<uint64_t> split_methylation;
+            EXPECT_EQ(call_methylation(read_view{0, bases.first(split), bases.subspan(split)}, cpg_pos, reverse, split_methylation),
+                      valid);
+            if (valid)
+            {
+                EXPECT_EQ(split_methylation, methylation);
+            }
+        }
+    }
+}
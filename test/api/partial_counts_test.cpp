@@ -0,0 +1,92 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/partial_counts.hpp"
+
+// Reads on two reference sequences, overlapping reads are split between the parts
+void add_reads(cpg_counts & all_CpGs, kmer_counts & all_kmers, cpg_table const & cpgs, size_t const part, size_t const num_parts)
+{
+    for (size_t i = part; i < 20000; i += num_parts)
+    {
+        methylation_pattern pattern = make_methylation_pattern({i % 2 == 0, i % 3 == 0, i % 5 == 0, i % 7 == 0, true});
+        size_t const ref_id = i < 15000 ? 0 : 1;
+        all_CpGs.add_read(ref_id, cpgs, i % 15000 * 2, pattern, i % 2, i % 11);
+        all_kmers.add_read(ref_id, cpgs, i % 15000 * 2, pattern);
+    }
+}
+
+TEST(partial_counts, merge)
+{
+    std::vector<uint32_t> positions(30010);
+    for (size_t i = 0; i < positions.size(); i++)
+        positions[i] = 10 + i * 17;
+    cpg_table cpgs = std::make_shared<std::span<uint32_t const> const>(positions);
+    std::deque<std::string> ref_ids{"chr1", "chr2", "chr3"};
+
+    // Scores of all reads
+    std::ostringstream expected_pdr;
+    std::ostringstream expected_entropy;
+    {
+        cpg_counts all_CpGs;
+        kmer_counts all_kmers;
+        add_reads(all_CpGs, all_kmers, cpgs, 0, 1);
+        write_final_records_pdr(expected_pdr, ref_ids, all_CpGs, genome_end, 2);
+        write_final_records_entropy(expected_entropy, ref_ids, all_kmers, genome_end, 2);
+    }
+
+    // Partial counts of three parts of the reads, written in several steps like for a sorted BAM file
+    std::vector<partial_counts_reader> partials;
+    for (size_t part = 0; part < 3; part++)
+    {
+        std::filesystem::path file = std::filesystem::temp_directory_path() / ("partial_counts_merge" + std::to_string(part) + ".rlmp");
+        {
+            cpg_counts all_CpGs;
+            kmer_counts all_kmers;
+            add_reads(all_CpGs, all_kmers, cpgs, part, 3);
+
+            std::ofstream output_stream{file, std::ios::binary};
+            partial_counts_writer partial{output_stream, ref_ids, true, true};
+            for (GenomePosition end : {GenomePosition{0, 100000}, GenomePosition{1, 0}, genome_end})
+            {
+                partial.write_pdr(all_CpGs, end);
+                partial.write_entropy(all_kmers, end);
+            }
+            partial.finish();
+        }
+        partials.emplace_back(file);
+    }
+
+    EXPECT_EQ(partials[0].references(), ref_ids);
+    EXPECT_TRUE(partials[0].has_counts(partial_counts_kind::pdr));
+    EXPECT_TRUE(partials[0].has_counts(partial_counts_kind::entropy));
+
+    for (size_t num_threads : {1, 4})
+    {
+        std::ostringstream pdr;
+        std::ostringstream entropy;
+        merge_partial_counts(partials, &pdr, &entropy, 2, num_threads);
+
+        EXPECT_EQ(pdr.str(), expected_pdr.str());
+        EXPECT_EQ(entropy.str(), expected_entropy.str());
+    }
+
+    for (partial_counts_reader const & partial : partials)
+        std::filesystem::remove(partial.path());
+}
+
+TEST(partial_counts, truncated)
+{
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "partial_counts_truncated.rlmp";
+    {
+        std::ofstream output_stream{file, std::ios::binary};
+        partial_counts_writer partial{output_stream, {"chr1"}, true, false};
+    }
+
+    EXPECT_THROW(partial_counts_reader{file}, std::runtime_error);
+    std::filesystem::remove(file);
+}
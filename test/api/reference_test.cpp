@@ -0,0 +1,40 @@
+#include <fstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/reference.hpp"
+
+TEST(reference, find_cpgs)
+{
+    EXPECT_EQ(find_cpgs("ACGTTCGCG"_dna5), (std::vector<uint32_t>{1, 5, 7}));
+    EXPECT_EQ(find_cpgs("CGNCGCA"_dna5), (std::vector<uint32_t>{0, 3}));
+    EXPECT_EQ(find_cpgs("GCAC"_dna5), (std::vector<uint32_t>{}));
+    EXPECT_EQ(find_cpgs("C"_dna5), (std::vector<uint32_t>{}));
+}
+
+TEST(reference, cpg_positions)
+{
+    // Line breaks inside a CpG must not hide it
+    std::ofstream fasta_stream{"reference_test.fa"};
+    fasta_stream << ">chr1 first\nACGTC\nGNNCG\nA\n>chr2\nTTTT\nCG\n";
+    fasta_stream.close();
+
+    reference_genome fasta{"reference_test.fa"};
+    write_reference_index(fasta, "reference_test.rlm");
+    reference_genome index{"reference_test.rlm"};
+
+    for (reference_genome * reference : {&fasta, &index})
+    {
+        EXPECT_EQ(reference->ids(), (std::vector<std::string>{"chr1", "chr2"}));
+        EXPECT_EQ(reference->length(0), 11u);
+        EXPECT_EQ(reference->length(1), 6u);
+
+        auto chr1 = reference->cpg_positions(0);
+        auto chr2 = reference->cpg_positions(1);
+        EXPECT_EQ(std::vector<uint32_t>(chr1->begin(), chr1->end()), (std::vector<uint32_t>{1, 4, 8}));
+        EXPECT_EQ(std::vector<uint32_t>(chr2->begin(), chr2->end()), (std::vector<uint32_t>{4}));
+
+        EXPECT_EQ(*reference->sequence(0), "ACGTCGNNCGA"_dna5);
+    }
+}
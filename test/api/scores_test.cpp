@@ -106,3 +106,42 @@ TEST(scores, methylation_kmer)
     double dname4 = calculate_avg_kmer_methylation_across_reads(vec4, 16);
     EXPECT_EQ(static_cast<double>((8 + 8 * 4)) / (16 * 4), dname4);
 }
+
+TEST(scores, methylation_pattern)
+{
+    // Patterns spanning several words: alternating blocks of methylated and unmethylated CpGs
+    for (size_t size : {3, 63, 64, 65, 128, 130})
+    {
+        std::vector<uint16_t> cpg_config(size);
+        uint32_t methylated = 0;
+        uint32_t transitions = 0;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            cpg_config[i] = (i / 5) % 2;
+            methylated += cpg_config[i];
+            transitions += i > 0 && cpg_config[i] != cpg_config[i - 1];
+        }
+
+        methylation_pattern pattern = make_methylation_pattern(cpg_config);
+
+        EXPECT_EQ(count_methylated_cpgs(pattern), methylated);
+        EXPECT_EQ(count_transitions(pattern), transitions);
+        EXPECT_EQ(calculate_transitions_per_read(pattern), static_cast<double>(transitions) / (size - 1));
+
+        for (size_t i = 0; i + 3 < size; i++)
+        {
+            uint16_t kmer = cpg_config[i] | cpg_config[i + 1] << 1 | cpg_config[i + 2] << 2 | cpg_config[i + 3] << 3;
+            EXPECT_EQ(pattern.kmer(i), kmer);
+        }
+    }
+
+    // A change between the last CpG of a word and the first CpG of the next word is a transition
+    std::vector<uint16_t> cpg_config(70, 0);
+    cpg_config[64] = 1;
+    EXPECT_EQ(count_transitions(make_methylation_pattern(cpg_config)), 2u);
+    cpg_config[63] = 1;
+    EXPECT_EQ(count_transitions(make_methylation_pattern(cpg_config)), 2u);
+    cpg_config.resize(64);
+    EXPECT_EQ(count_transitions(make_methylation_pattern(cpg_config)), 1u);
+}
@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/output.hpp"
+
+TEST(sorted_line_buffer, release)
+{
+    std::ostringstream sorted;
+    sorted_line_buffer buffer{sorted};
+    std::ostream stream{&buffer};
+
+    std::vector<std::string> expected;
+    methylation_pattern pattern = make_methylation_pattern({true, false, true});
+    {
+        // A small buffer splits lines and keys across several writes
+        text_writer writer{stream, 16, true};
+        for (uint64_t i = 0; i < 5000; i++)
+        {
+            // Reads are sorted by position only up to 100 bp, some have the same position
+            uint16_t const ref_id = i < 4000 ? 0 : 1;
+            std::string const chr = ref_id == 0 ? "chr1" : "chr2";
+            uint64_t const start = (i % 4000) * 10 + (i * 7919) % 100;
+            std::string const id = "read" + std::to_string((i * 31) % 997);
+
+            size_t const name_begin = write_record_single_read(writer, chr, start, start + 100, id, pattern);
+            sorted_line_key{GenomePosition{ref_id, start}, static_cast<uint32_t>(name_begin), static_cast<uint32_t>(id.size())}.write(writer);
+
+            std::ostringstream line;
+            text_writer line_writer{line};
+            write_record_single_read(line_writer, chr, start, start + 100, id, pattern);
+            line_writer.flush();
+            expected.push_back(line.str());
+
+            if (i % 500 == 499)
+            {
+                writer.flush();
+                buffer.release(GenomePosition{ref_id, start > 100 ? start - 100 : 0});
+                EXPECT_LT(buffer.size(), 520u);
+            }
+        }
+    }
+    buffer.release(genome_end);
+    EXPECT_EQ(buffer.size(), 0u);
+
+    // Sorted by position, name and line
+    auto line_key = [] (std::string const & line)
+    {
+        std::istringstream fields{line};
+        std::string chr, name;
+        uint64_t start, end;
+        fields >> chr >> start >> end >> name;
+        return std::tuple{chr, start, name, line};
+    };
+    std::sort(expected.begin(), expected.end(), [&] (std::string const & a, std::string const & b) { return line_key(a) < line_key(b); });
+
+    std::string expected_output;
+    for (std::string const & line : expected)
+        expected_output += line;
+    EXPECT_EQ(sorted.str(), expected_output);
+}
@@ -0,0 +1,62 @@
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../../include/text_writer.hpp"
+
+TEST(text_writer, numbers)
+{
+    // Numbers are formatted like a std::ostream with default settings
+    std::vector<double> doubles{0, 1, -1, 0.5, 1.0 / 3, 2.0 / 3, 0.1, 1e-5, 1.23456789e-7, 123456, 1234567, 1e15, 0.999999,
+                                0.9999995, 12.5, std::numeric_limits<double>::min(), std::numeric_limits<double>::max(),
+                                std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), std::nan("")};
+    for (int i = 1; i < 1000; i++)
+        doubles.push_back(std::log(i) / i);
+
+    std::ostringstream expected;
+    std::ostringstream output;
+    {
+        text_writer writer{output, 64};
+
+        for (double const number : doubles)
+        {
+            expected << number << "\t";
+            writer << number << "\t";
+        }
+
+        for (uint64_t const number : {uint64_t{0}, uint64_t{7}, uint64_t{1234567890123}, std::numeric_limits<uint64_t>::max()})
+        {
+            expected << number << '\n';
+            writer << number << '\n';
+        }
+
+        expected << -42 << static_cast<uint16_t>(65535) << static_cast<uint32_t>(4000000000);
+        writer << -42 << static_cast<uint16_t>(65535) << static_cast<uint32_t>(4000000000);
+    }
+
+    EXPECT_EQ(output.str(), expected.str());
+}
+
+TEST(text_writer, buffering)
+{
+    std::ostringstream output;
+    text_writer writer{output, 64};
+
+    // Text is only written once the buffer is full or flushed, longer text is written directly
+    writer << "chr1" << '\t' << 10;
+    EXPECT_EQ(output.str(), "");
+    EXPECT_EQ(writer.position(), 7);
+
+    std::string long_text(100, 'x');
+    writer << long_text;
+    EXPECT_EQ(output.str(), "chr1\t10" + long_text);
+
+    writer << "end";
+    writer.flush();
+    EXPECT_EQ(output.str(), "chr1\t10" + long_text + "end");
+    EXPECT_EQ(writer.position(), 110);
+}
@@ -1,5 +1,10 @@
+#include <algorithm>
 #include <string>
+#include <filesystem>
 #include <fstream>
+#include <sstream>
+
+#include <zlib.h>
 
 #include "cli_test.hpp"
 
@@ -90,6 +95,37 @@ TEST_F(RLM, clipped_reads)
         EXPECT_EQ(output_vec[i], control_vec[i]);
 }
 
+TEST_F(RLM, collated)
+{
+    // Mates are adjacent in the BAM file, so every read is paired with the one before it
+    cli_test_result result = execute_app("RLM", "-b", data("test_clipped_reads.bam"), "-r", data("chrM.fa"), "-m", "PE", "-s", "single_read", "-a", "bsmap", "--collated");
+
+    std::ifstream output ("output_single_read_info.bed");
+    std::ifstream control (data("control_clipped_reads.bed"));
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    while (std::getline(control, line))
+    {
+        control_vec.push_back(line);
+    }
+    control.close();
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+
+    for (size_t i = 0; i < output_vec.size(); i++)
+        EXPECT_EQ(output_vec[i], control_vec[i]);
+}
+
 TEST_F(RLM, invalid_mate)
 {
     cli_test_result result = execute_app("RLM", "-b", data("test_invalid_mate.bam"), "-r", data("chrM.fa"), "-m", "PE", "-s", "single_read", "-a", "bsmap");
@@ -208,3 +244,717 @@ TEST_F(RLM, rrbs)
     for (size_t i = 0; i < output_vec.size(); i++)
         EXPECT_EQ(output_vec[i], control_vec[i]);
 }
+
+TEST_F(RLM, region)
+{
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap", "--region", "chr_test:5000-8000");
+
+    std::ifstream output ("output_single_read_info.bed");
+    std::ifstream control (data("control_single_reads.bed"));
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    // Keep header and reads overlapping chr_test:4999-8000 (0-based)
+    while (std::getline(control, line))
+    {
+        std::istringstream iss(line);
+        std::string chr;
+        uint64_t start, end;
+        if (line[0] == '#' || (iss >> chr >> start >> end && start < 8000 && end > 4999))
+            control_vec.push_back(line);
+    }
+    control.close();
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(output_vec.size(), static_cast<size_t>(37));
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+
+    for (size_t i = 0; i < output_vec.size(); i++)
+        EXPECT_EQ(output_vec[i], control_vec[i]);
+}
+
+TEST_F(RLM, targets)
+{
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads_name_sorted.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap", "--targets", data("test_targets.bed"));
+
+    std::ifstream output ("output_single_read_info.bed");
+    std::ifstream control (data("control_single_reads.bed"));
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    // Keep header and reads overlapping the targets chr_test:7000-7600 and chr_test:12000-12500 (0-based)
+    while (std::getline(control, line))
+    {
+        std::istringstream iss(line);
+        std::string chr;
+        uint64_t start, end;
+        if (line[0] == '#' || (iss >> chr >> start >> end && ((start < 7600 && end > 7000) || (start < 12500 && end > 12000))))
+            control_vec.push_back(line);
+    }
+    control.close();
+
+    std::sort(output_vec.begin(), output_vec.end());
+    std::sort(control_vec.begin(), control_vec.end());
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(output_vec.size(), static_cast<size_t>(36));
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+
+    for (size_t i = 0; i < output_vec.size(); i++)
+        EXPECT_EQ(output_vec[i], control_vec[i]);
+}
+
+TEST_F(RLM, sharded)
+{
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap", "--sharded", "-t", "4", "--shard_size", "2000");
+
+    std::ifstream output ("output_single_read_info.bed");
+    std::ifstream control (data("control_single_reads.bed"));
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    while (std::getline(control, line))
+    {
+        control_vec.push_back(line);
+    }
+    control.close();
+
+    // Output of the shards is merged in the order of the serial run
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+
+    for (size_t i = 0; i < output_vec.size(); i++)
+        EXPECT_EQ(output_vec[i], control_vec[i]);
+}
+
+TEST_F(RLM, scores_position_sorted)
+{
+    // Scores of position sorted input are written while the file is read and must not differ from name sorted input
+    cli_test_result result_sorted = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                                "-p", "pdr_sorted.bed", "-e", "entropy_sorted.bed");
+    cli_test_result result_name_sorted = execute_app("RLM", "-b", data("test_single_reads_name_sorted.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                                     "-p", "pdr_name_sorted.bed", "-e", "entropy_name_sorted.bed");
+
+    EXPECT_EQ(result_sorted.exit_code, 0);
+    EXPECT_EQ(result_name_sorted.exit_code, 0);
+
+    for (auto const & [sorted_file, name_sorted_file] : {std::pair{"pdr_sorted.bed", "pdr_name_sorted.bed"},
+                                                         std::pair{"entropy_sorted.bed", "entropy_name_sorted.bed"}})
+    {
+        std::ifstream output (sorted_file);
+        std::ifstream control (name_sorted_file);
+
+        std::string line;
+        std::vector<std::string> output_vec;
+        std::vector<std::string> control_vec;
+
+        while (std::getline(output, line))
+        {
+            output_vec.push_back(line);
+        }
+        output.close();
+
+        while (std::getline(control, line))
+        {
+            control_vec.push_back(line);
+        }
+        control.close();
+
+        EXPECT_GT(output_vec.size(), static_cast<size_t>(1));
+        EXPECT_RANGE_EQ(output_vec, control_vec);
+    }
+}
+
+TEST_F(RLM, reference_index)
+{
+    // The reference sequence is read at the positions given in the FASTA index
+    std::filesystem::copy_file(data("chrM.fa"), "chrM_indexed.fa", std::filesystem::copy_options::overwrite_existing);
+    std::ofstream index ("chrM_indexed.fa.fai");
+    index << "chrM\t16299\t6\t50\t51\n";
+    index.close();
+
+    cli_test_result result = execute_app("RLM", "-b", data("test_skipped_reads.sam"), "-r", "chrM_indexed.fa", "-m", "PE", "-s", "single_read", "-a", "bsmap");
+
+    std::ifstream output ("output_single_read_info.bed");
+    std::ifstream control (data("control_skipped_reads.bed"));
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    while (std::getline(control, line))
+    {
+        control_vec.push_back(line);
+    }
+    control.close();
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+}
+
+TEST_F(RLM, binary_reference_index)
+{
+    // Reads are processed identically with the reference index created by 'RLM index'
+    cli_test_result result_index = execute_app("RLM", "index", "-r", data("chrM.fa"), "-o", "chrM.rlm");
+    cli_test_result result = execute_app("RLM", "-b", data("test_skipped_reads.sam"), "-r", "chrM.rlm", "-m", "PE", "-s", "single_read", "-a", "bsmap");
+
+    std::ifstream output ("output_single_read_info.bed");
+    std::ifstream control (data("control_skipped_reads.bed"));
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    while (std::getline(control, line))
+    {
+        control_vec.push_back(line);
+    }
+    control.close();
+
+    EXPECT_EQ(result_index.exit_code, 0);
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+}
+
+TEST_F(RLM, workers)
+{
+    // Reads processed by worker threads are written and counted in the order of the input
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                         "-o", "single_read_serial.bed", "-p", "pdr_serial.bed", "-e", "entropy_serial.bed");
+    cli_test_result result_workers = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                                 "-o", "single_read_workers.bed", "-p", "pdr_workers.bed", "-e", "entropy_workers.bed", "--workers", "3");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result_workers.exit_code, 0);
+
+    for (auto const & [workers_file, serial_file] : {std::pair{"single_read_workers.bed", "single_read_serial.bed"},
+                                                     std::pair{"pdr_workers.bed", "pdr_serial.bed"},
+                                                     std::pair{"entropy_workers.bed", "entropy_serial.bed"}})
+    {
+        std::ifstream output (workers_file);
+        std::ifstream control (serial_file);
+
+        std::string line;
+        std::vector<std::string> output_vec;
+        std::vector<std::string> control_vec;
+
+        while (std::getline(output, line))
+        {
+            output_vec.push_back(line);
+        }
+        output.close();
+
+        while (std::getline(control, line))
+        {
+            control_vec.push_back(line);
+        }
+        control.close();
+
+        EXPECT_GT(output_vec.size(), static_cast<size_t>(1));
+        EXPECT_RANGE_EQ(output_vec, control_vec);
+    }
+}
+
+TEST_F(RLM, sort_single_read)
+{
+    // Pairs are written in the order of their position and read name instead of the order in which they are processed
+    cli_test_result result = execute_app("RLM", "-b", data("test_overlap_reads.bam"), "-r", data("chrM.fa"), "-m", "PE", "-s", "single_read", "-a", "bsmap", "--sort_single_read");
+
+    std::ifstream output ("output_single_read_info.bed");
+    std::ifstream control (data("control_overlap_reads.bed"));
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    while (std::getline(control, line))
+    {
+        control_vec.push_back(line);
+    }
+    control.close();
+
+    // All reads are on chrM: sort by start and read name, keeping the header first
+    auto field = [] (std::string const & line, size_t const column)
+    {
+        size_t begin = 0;
+        for (size_t i = 0; i < column; i++)
+            begin = line.find('\t', begin) + 1;
+        return line.substr(begin, line.find('\t', begin) - begin);
+    };
+    std::stable_sort(control_vec.begin() + 1, control_vec.end(), [&] (std::string const & a, std::string const & b)
+    {
+        return std::pair{std::stoul(field(a, 1)), field(a, 3)} < std::pair{std::stoul(field(b, 1)), field(b, 3)};
+    });
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+
+    // Input that is not sorted by position can not be sorted with a bounded buffer
+    cli_test_result result_name_sorted = execute_app("RLM", "-b", data("test_single_reads_name_sorted.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap", "--sort_single_read");
+
+    EXPECT_NE(result_name_sorted.exit_code, 0);
+}
+
+TEST_F(RLM, compressed_output)
+{
+    // Outputs ending in .gz are compressed with BGZF and indexed with --index, their content is unchanged
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                         "-o", "single_read_plain.bed", "-p", "pdr_plain.bed", "-e", "entropy_plain.bed", "--sort_single_read");
+    cli_test_result result_compressed = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                                    "-o", "single_read_compressed.bed.gz", "-p", "pdr_compressed.bed.gz", "-e", "entropy_compressed.bed.gz",
+                                                    "-t", "2", "--sort_single_read", "--index");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result_compressed.exit_code, 0);
+
+    for (auto const & [compressed_file, plain_file] : {std::pair{"single_read_compressed.bed.gz", "single_read_plain.bed"},
+                                                       std::pair{"pdr_compressed.bed.gz", "pdr_plain.bed"},
+                                                       std::pair{"entropy_compressed.bed.gz", "entropy_plain.bed"}})
+    {
+        // gzip reads all BGZF blocks as members of one file
+        gzFile output = gzopen(compressed_file, "rb");
+        ASSERT_NE(output, nullptr);
+        std::string content;
+        char buffer[4096];
+        for (int n = gzread(output, buffer, sizeof(buffer)); n > 0; n = gzread(output, buffer, sizeof(buffer)))
+            content.append(buffer, n);
+        gzclose(output);
+
+        std::ifstream control (plain_file);
+        std::stringstream control_content;
+        control_content << control.rdbuf();
+
+        EXPECT_GT(content.size(), static_cast<size_t>(0));
+        EXPECT_EQ(content, control_content.str());
+        EXPECT_TRUE(std::filesystem::exists(std::string{compressed_file} + ".tbi"));
+    }
+
+    // Only compressed output can be indexed
+    cli_test_result result_plain_index = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "pdr", "-a", "bsmap",
+                                                     "-p", "pdr_plain_index.bed", "--index");
+
+    EXPECT_NE(result_plain_index.exit_code, 0);
+}
+
+TEST_F(RLM, columnar_output)
+{
+    // The binary single read output is converted back to the text output by 'RLM view'
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap",
+                                         "-o", "single_read_text.bed");
+    cli_test_result result_columnar = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap",
+                                                  "-o", "single_read_columnar.rlmc");
+    cli_test_result result_view = execute_app("RLM", "view", "-i", "single_read_columnar.rlmc", "-o", "single_read_view.bed");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result_columnar.exit_code, 0);
+    EXPECT_EQ(result_view.exit_code, 0);
+
+    std::ifstream output ("single_read_view.bed");
+    std::ifstream control ("single_read_text.bed");
+
+    std::string line;
+    std::vector<std::string> output_vec;
+    std::vector<std::string> control_vec;
+
+    while (std::getline(output, line))
+    {
+        output_vec.push_back(line);
+    }
+    output.close();
+
+    while (std::getline(control, line))
+    {
+        control_vec.push_back(line);
+    }
+    control.close();
+
+    EXPECT_GT(output_vec.size(), static_cast<size_t>(1));
+    EXPECT_RANGE_EQ(output_vec, control_vec);
+
+    // The reference sequence of the region must be in the file
+    cli_test_result result_region = execute_app("RLM", "view", "-i", "single_read_columnar.rlmc", "--region", "no_such_chr:1-100");
+
+    EXPECT_NE(result_region.exit_code, 0);
+}
+
+TEST_F(RLM, rescore)
+{
+    // The scores computed from the epiallele cache are the same as computed from the BAM file
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                         "-p", "pdr_bam.bed", "-e", "entropy_bam.bed", "--cache", "epialleles.rlme");
+    cli_test_result result_rescore = execute_app("RLM", "rescore", "-i", "epialleles.rlme", "-r", data("test_ref.fa"), "-s", "all", "-c", "1",
+                                                 "-p", "pdr_cache.bed", "-e", "entropy_cache.bed");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result_rescore.exit_code, 0);
+
+    for (auto [output_file, control_file] : {std::pair{"pdr_cache.bed", "pdr_bam.bed"}, std::pair{"entropy_cache.bed", "entropy_bam.bed"}})
+    {
+        std::ifstream output (output_file);
+        std::ifstream control (control_file);
+
+        std::string line;
+        std::vector<std::string> output_vec;
+        std::vector<std::string> control_vec;
+
+        while (std::getline(output, line))
+        {
+            output_vec.push_back(line);
+        }
+        output.close();
+
+        while (std::getline(control, line))
+        {
+            control_vec.push_back(line);
+        }
+        control.close();
+
+        EXPECT_GT(output_vec.size(), static_cast<size_t>(1));
+        EXPECT_RANGE_EQ(output_vec, control_vec);
+    }
+
+    // The reference genome must have the reference sequences of the cache
+    cli_test_result result_reference = execute_app("RLM", "rescore", "-i", "epialleles.rlme", "-r", data("chrM.fa"), "-s", "all");
+
+    EXPECT_NE(result_reference.exit_code, 0);
+}
+
+TEST_F(RLM, merge_partial)
+{
+    // The scores merged from partial counts are the same as computed from the BAM file
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                         "-p", "pdr_scores.bed", "-e", "entropy_scores.bed");
+    cli_test_result result_partial = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap",
+                                                 "--emit_partial", "counts.rlmp");
+    cli_test_result result_merge = execute_app("RLM", "merge", "-i", "counts.rlmp", "-s", "all", "-c", "1", "-t", "2",
+                                               "-p", "pdr_merged.bed", "-e", "entropy_merged.bed");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result_partial.exit_code, 0);
+    EXPECT_EQ(result_merge.exit_code, 0);
+
+    for (auto [output_file, control_file] : {std::pair{"pdr_merged.bed", "pdr_scores.bed"}, std::pair{"entropy_merged.bed", "entropy_scores.bed"}})
+    {
+        std::ifstream output (output_file);
+        std::ifstream control (control_file);
+
+        std::string line;
+        std::vector<std::string> output_vec;
+        std::vector<std::string> control_vec;
+
+        while (std::getline(output, line))
+        {
+            output_vec.push_back(line);
+        }
+        output.close();
+
+        while (std::getline(control, line))
+        {
+            control_vec.push_back(line);
+        }
+        control.close();
+
+        EXPECT_GT(output_vec.size(), static_cast<size_t>(1));
+        EXPECT_RANGE_EQ(output_vec, control_vec);
+    }
+
+    // Without the 'pdr' or 'entropy' score there are no counts to write
+    cli_test_result result_single_read = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap",
+                                                     "--emit_partial", "single_read.rlmp");
+
+    EXPECT_NE(result_single_read.exit_code, 0);
+}
+
+TEST_F(RLM, checkpoint)
+{
+    // Without a checkpoint to resume from, the run starts from the beginning and gives the same output
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                         "-o", "single_reads.bed", "-p", "pdr_scores.bed", "-e", "entropy_scores.bed");
+    cli_test_result result_checkpoint = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                                    "-o", "single_reads_checkpoint.bed", "-p", "pdr_checkpoint.bed", "-e", "entropy_checkpoint.bed",
+                                                    "--checkpoint", "run.ckpt", "--checkpoint_interval", "0", "--resume");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result_checkpoint.exit_code, 0);
+
+    // The checkpoint is removed once the run is finished
+    EXPECT_FALSE(std::filesystem::exists("run.ckpt"));
+
+    for (auto [output_file, control_file] : {std::pair{"single_reads_checkpoint.bed", "single_reads.bed"},
+                                             std::pair{"pdr_checkpoint.bed", "pdr_scores.bed"},
+                                             std::pair{"entropy_checkpoint.bed", "entropy_scores.bed"}})
+    {
+        std::ifstream output (output_file);
+        std::ifstream control (control_file);
+
+        std::string line;
+        std::vector<std::string> output_vec;
+        std::vector<std::string> control_vec;
+
+        while (std::getline(output, line))
+        {
+            output_vec.push_back(line);
+        }
+        output.close();
+
+        while (std::getline(control, line))
+        {
+            control_vec.push_back(line);
+        }
+        control.close();
+
+        EXPECT_GT(output_vec.size(), static_cast<size_t>(1));
+        EXPECT_RANGE_EQ(output_vec, control_vec);
+    }
+
+    // Compressed outputs can not be continued
+    cli_test_result result_compressed = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap",
+                                                    "-o", "single_reads.bed.gz", "--checkpoint", "compressed.ckpt");
+    cli_test_result result_resume = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "single_read", "-a", "bsmap",
+                                                "--resume");
+
+    EXPECT_NE(result_compressed.exit_code, 0);
+    EXPECT_NE(result_resume.exit_code, 0);
+}
+
+TEST_F(RLM, checkpoint_resume)
+{
+    // A run interrupted in the middle of the file and resumed from its last checkpoint gives the same output as an
+    // uninterrupted run, with and without workers. Flush points every 1000 bp give several checkpoints on the test data.
+    for (std::string workers : {"0", "2"})
+    {
+        cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                             "-o", "single_reads.bed", "-p", "pdr_scores.bed", "-e", "entropy_scores.bed", "--workers", workers);
+        cli_test_result result_interrupted = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                                         "-o", "single_reads_resumed.bed", "-p", "pdr_resumed.bed", "-e", "entropy_resumed.bed", "--workers", workers,
+                                                         "--checkpoint", "run.ckpt", "--checkpoint_interval", "0", "--flush_interval", "1000",
+                                                         "--stop_after_checkpoints", "5");
+
+        EXPECT_EQ(result.exit_code, 0);
+        EXPECT_NE(result_interrupted.exit_code, 0);
+        EXPECT_TRUE(std::filesystem::exists("run.ckpt"));
+
+        // The interrupted run stopped before the end of the file
+        EXPECT_LT(std::filesystem::file_size("single_reads_resumed.bed"), std::filesystem::file_size("single_reads.bed"));
+
+        cli_test_result result_resumed = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                                     "-o", "single_reads_resumed.bed", "-p", "pdr_resumed.bed", "-e", "entropy_resumed.bed", "--workers", workers,
+                                                     "--checkpoint", "run.ckpt", "--checkpoint_interval", "0", "--flush_interval", "1000", "--resume");
+
+        EXPECT_EQ(result_resumed.exit_code, 0);
+        EXPECT_NE(result_resumed.out.find("Resuming from checkpoint at chr_test:"), std::string::npos);
+        EXPECT_FALSE(std::filesystem::exists("run.ckpt"));
+
+        for (auto const & [output_file, control_file] : {std::pair{"single_reads_resumed.bed", "single_reads.bed"},
+                                                         std::pair{"pdr_resumed.bed", "pdr_scores.bed"},
+                                                         std::pair{"entropy_resumed.bed", "entropy_scores.bed"}})
+        {
+            std::ifstream output (output_file);
+            std::ifstream control (control_file);
+            std::stringstream output_content;
+            std::stringstream control_content;
+            output_content << output.rdbuf();
+            control_content << control.rdbuf();
+
+            EXPECT_GT(control_content.str().size(), static_cast<size_t>(0));
+            EXPECT_EQ(output_content.str(), control_content.str());
+        }
+    }
+}
+
+TEST_F(RLM, batch)
+{
+    // Every sample of the sample sheet gives the same output as processing its BAM file alone
+    cli_test_result result = execute_app("RLM", "-b", data("test_single_reads.bam"), "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                         "-o", "single_reads.bed", "-p", "pdr_scores.bed", "-e", "entropy_scores.bed");
+
+    std::ofstream sheet ("samples.tsv");
+    sheet << data("test_single_reads.bam").string() << "\tsample1\n"
+          << data("test_single_reads_name_sorted.bam").string() << "\tsample2\n";
+    sheet.close();
+
+    cli_test_result result_batch = execute_app("RLM", "batch", "-i", "samples.tsv", "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "-a", "bsmap", "-c", "1",
+                                               "-j", "2", "-t", "2");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result_batch.exit_code, 0);
+
+    // Progress messages of the samples start with their output prefix
+    EXPECT_NE(result_batch.out.find("sample1: Finished BAM file processing"), std::string::npos);
+    EXPECT_NE(result_batch.out.find("sample2: Finished BAM file processing"), std::string::npos);
+
+    for (std::string sample : {"sample1", "sample2"})
+    {
+        for (auto [output_file, control_file] : {std::pair{sample + "_pdr.bed", "pdr_scores.bed"}, std::pair{sample + "_entropy.bed", "entropy_scores.bed"}})
+        {
+            std::ifstream output (output_file);
+            std::ifstream control (control_file);
+
+            std::string line;
+            std::vector<std::string> output_vec;
+            std::vector<std::string> control_vec;
+
+            while (std::getline(output, line))
+            {
+                output_vec.push_back(line);
+            }
+            output.close();
+
+            while (std::getline(control, line))
+            {
+                control_vec.push_back(line);
+            }
+            control.close();
+
+            EXPECT_GT(output_vec.size(), static_cast<size_t>(1));
+            EXPECT_RANGE_EQ(output_vec, control_vec);
+        }
+    }
+
+    // Samples whose BAM file does not exist are found before any sample is processed
+    std::ofstream missing_sheet ("missing_samples.tsv");
+    missing_sheet << "missing.bam\tmissing\n";
+    missing_sheet.close();
+
+    cli_test_result result_missing = execute_app("RLM", "batch", "-i", "missing_samples.tsv", "-r", data("test_ref.fa"), "-m", "SE", "-s", "all");
+
+    EXPECT_NE(result_missing.exit_code, 0);
+
+    // Samples processed at once share the threads, every one needs at least one and one more per worker
+    cli_test_result result_threads = execute_app("RLM", "batch", "-i", "samples.tsv", "-r", data("test_ref.fa"), "-m", "SE", "-s", "all",
+                                                 "-j", "2", "-t", "3", "--workers", "1");
+
+    EXPECT_NE(result_threads.exit_code, 0);
+
+    // Options of a single BAM file that write further files are not available
+    cli_test_result result_sharded = execute_app("RLM", "batch", "-i", "samples.tsv", "-r", data("test_ref.fa"), "-m", "SE", "-s", "all", "--sharded");
+    cli_test_result result_cache = execute_app("RLM", "batch", "-i", "samples.tsv", "-r", data("test_ref.fa"), "-m", "SE", "-s", "all",
+                                               "--cache", "batch.rlmc");
+
+    EXPECT_NE(result_sharded.exit_code, 0);
+    EXPECT_NE(result_cache.exit_code, 0);
+}
+
+TEST_F(RLM, orphaned_mates)
+{
+    // Reads of a position sorted file whose mate is missing are dropped while reading, not only at the end
+    std::ofstream fasta ("orphans.fa");
+    fasta << ">chr_orphans\n";
+    for (size_t i = 0; i < 10000; i++)
+        fasta << "ACGTTCGATCGGATCCGATTCGACCGTAACGTTCGATCGGATCCGATTCG\n";
+    fasta.close();
+
+    std::ofstream sam ("orphans.sam");
+    sam << "@HD\tVN:1.6\tSO:coordinate\n"
+        << "@SQ\tSN:chr_orphans\tLN:500000\n";
+    for (size_t i = 0; i < 50; i++)
+    {
+        size_t const position = 1001 + i * 10000;
+        sam << "orphan_" << i << "\t99\tchr_orphans\t" << position << "\t40\t50M\t=\t" << position + 200 << "\t250\t"
+            << "ATGTTTGATTGGATTTGATTTGATTGTAATGTTTGATTGGATTTGATTTG\t" << std::string(50, 'F') << "\tZS:Z:++\n";
+    }
+    sam.close();
+
+    cli_test_result result = execute_app("RLM", "-b", "orphans.sam", "-r", "orphans.fa", "-m", "PE", "-s", "single_read", "-a", "bsmap",
+                                         "-o", "orphans_single_read.bed");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_NE(result.out.find("Dropped 50 read(s) whose mate was not found"), std::string::npos);
+
+    size_t const peak_begin = result.out.find("At most ");
+    ASSERT_NE(peak_begin, std::string::npos);
+    EXPECT_LT(std::stoul(result.out.substr(peak_begin + 8)), 50u);
+}
+
+TEST_F(RLM, targets_one_mate)
+{
+    // A read whose mate is outside of the targets is processed on its own instead of waiting for the mate
+    std::string sequence;
+    for (size_t i = 0; i < 200; i++)
+        sequence += "ACGTTCGATCGGATCCGATTCGACCGTAACGTTCGATCGGATCCGATTCG";
+
+    std::ofstream fasta ("one_mate.fa");
+    fasta << ">chr_one_mate\n" << sequence << "\n";
+    fasta.close();
+
+    std::ofstream targets ("one_mate_targets.bed");
+    targets << "chr_one_mate\t900\t1200\n";
+    targets.close();
+
+    // Both mates of pair_inside overlap the target, only the first mate of pair_outside does
+    std::ofstream sam ("one_mate.sam");
+    sam << "@HD\tVN:1.6\tSO:coordinate\n"
+        << "@SQ\tSN:chr_one_mate\tLN:" << sequence.size() << "\n";
+    auto write_read = [&] (std::string const & id, size_t const flag, size_t const position, size_t const mate_position)
+    {
+        sam << id << "\t" << flag << "\tchr_one_mate\t" << position << "\t40\t50M\t=\t" << mate_position << "\t0\t"
+            << sequence.substr(position - 1, 50) << "\t" << std::string(50, 'F') << "\tZS:Z:" << (flag == 99 ? "++" : "+-") << "\n";
+    };
+    write_read("pair_outside", 99, 1001, 5001);
+    write_read("pair_inside", 99, 1021, 1051);
+    write_read("pair_inside", 147, 1051, 1021);
+    write_read("pair_outside", 147, 5001, 1001);
+    sam.close();
+
+    cli_test_result result = execute_app("RLM", "-b", "one_mate.sam", "-r", "one_mate.fa", "-m", "PE", "-s", "single_read", "-a", "bsmap",
+                                         "--targets", "one_mate_targets.bed", "-o", "one_mate_single_read.bed");
+
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_NE(result.out.find("Dropped 0 read(s) whose mate was not found"), std::string::npos);
+
+    std::ifstream output ("one_mate_single_read.bed");
+    std::string line;
+    std::vector<std::string> output_vec;
+    while (std::getline(output, line))
+    {
+        if (line[0] != '#')
+            output_vec.push_back(line);
+    }
+    output.close();
+
+    ASSERT_EQ(output_vec.size(), static_cast<size_t>(2));
+    EXPECT_EQ(output_vec[0].substr(0, output_vec[0].find('\t', 13)), "chr_one_mate\t1000");
+    EXPECT_EQ(output_vec[1].substr(0, output_vec[1].find('\t', 13)), "chr_one_mate\t1020");
+}
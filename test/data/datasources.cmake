@@ -73,3 +73,11 @@ declare_datasource (FILE test_bismark.bam
 declare_datasource (FILE test_gem.bam
                     URL ${CMAKE_SOURCE_DIR}/test/data/test_gem.bam
                     URL_HASH SHA256=41f1fcf96096db12361962c67e6caa1f998ef16efe6f110da92d700a613f7e4e)
+
+declare_datasource (FILE test_single_reads.bam.bai
+                    URL ${CMAKE_SOURCE_DIR}/test/data/test_single_reads.bam.bai
+                    URL_HASH SHA256=d6f977b7a212efac862196a7b71a7ae3e20e9ee043c1ed2cd31b2ba8646916c2)
+
+declare_datasource (FILE test_targets.bed
+                    URL ${CMAKE_SOURCE_DIR}/test/data/test_targets.bed
+                    URL_HASH SHA256=9c3a1c495c6c51920a8b12bfb861325634e7191dc062811965b6ede2d0c1eb2e)
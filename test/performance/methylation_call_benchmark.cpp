@@ -0,0 +1,133 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../../include/methylation_call.hpp"
+
+using seqan3::operator""_dna5;
+
+// Methylation call of one CpG after the other with branches on the strand and the bases
+bool call_methylation_branches(seqan3::dna5_vector const & sequence,
+                               std::vector<uint16_t> const & cpg_pos,
+                               bool const reverse,
+                               std::vector<uint16_t> & cpg_config)
+{
+    static constexpr std::array<uint16_t, 5> methyl_context = {0, 1, 1, 0, 0};
+
+    cpg_config.clear();
+    for (size_t i = 0; i < cpg_pos.size(); i++)
+    {
+        if (reverse)
+        {
+            if ((sequence[cpg_pos[i] + 1] == 'A'_dna5 || sequence[cpg_pos[i] + 1] == 'G'_dna5) && sequence[cpg_pos[i]] == 'C'_dna5)
+                cpg_config.push_back(methyl_context[sequence[cpg_pos[i] + 1].to_rank()]);
+            else
+                return false;
+        }
+        else
+        {
+            if ((sequence[cpg_pos[i]] == 'C'_dna5 || sequence[cpg_pos[i]] == 'T'_dna5) && sequence[cpg_pos[i] + 1] == 'G'_dna5)
+                cpg_config.push_back(methyl_context[sequence[cpg_pos[i]].to_rank()]);
+            else
+                return false;
+        }
+    }
+    return true;
+}
+
+struct read_t
+{
+    seqan3::dna5_vector sequence;
+    std::vector<uint16_t> cpg_pos;
+    bool reverse;
+};
+
+// Bisulfite converted reads with a CpG every 'spacing' bases on average
+std::vector<read_t> simulate_reads(size_t const read_length, size_t const spacing, size_t const num_reads)
+{
+    std::mt19937 generator{42};
+    std::vector<read_t> reads(num_reads);
+
+    for (size_t n = 0; n < num_reads; n++)
+    {
+        read_t & read = reads[n];
+        read.reverse = n % 2;
+        read.sequence.resize(read_length);
+
+        for (auto & base : read.sequence)
+            base = "ATGA"_dna5[generator() % 4];
+
+        for (size_t i = generator() % spacing; i + 1 < read_length; i += 2 + generator() % (2 * spacing - 3))
+        {
+            bool methylated = generator() % 2;
+            read.sequence[i] = read.reverse || methylated ? 'C'_dna5 : 'T'_dna5;
+            read.sequence[i + 1] = !read.reverse || methylated ? 'G'_dna5 : 'A'_dna5;
+            read.cpg_pos.push_back(i);
+        }
+    }
+
+    return reads;
+}
+
+template <typename call_t>
+double measure(std::vector<read_t> const & reads, size_t const rounds, call_t && call)
+{
+    size_t methylated = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t round = 0; round < rounds; round++)
+        for (read_t const & read : reads)
+            methylated += call(read);
+
+    std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+
+    // Keep the compiler from dropping the calls
+    if (methylated == 0)
+        std::cerr << "No methylated CpGs\n";
+
+    return time.count() / (rounds * reads.size());
+}
+
+// Compare the methylation call implementations on simulated reads of 150 bp and 250 bp in CpG poor and CpG rich regions
+int main()
+{
+    size_t const num_reads = 10000;
+    size_t const rounds = 100;
+
+    std::cout << "read_length\tcpg_spacing\tbranches_ns\tscalar_ns\tdispatched_ns\n";
+
+    for (size_t read_length : {150, 250})
+    {
+        for (size_t spacing : {4, 10, 25})
+        {
+            std::vector<read_t> reads = simulate_reads(read_length, spacing, num_reads);
+
+            std::vector<uint16_t> cpg_config;
+            double branches = measure(reads, rounds, [&] (read_t const & read)
+            {
+                call_methylation_branches(read.sequence, read.cpg_pos, read.reverse, cpg_config);
+                return cpg_config.empty() ? 0 : cpg_config[0];
+            });
+
+            std::vector<uint64_t> methylation;
+            double scalar = measure(reads, rounds, [&] (read_t const & read)
+            {
+                methylation.assign((read.cpg_pos.size() + 63) / 64, 0);
+                call_methylation_scalar(reinterpret_cast<uint8_t const *>(read.sequence.data()),
+                                        0, read.cpg_pos.data(), 0, read.cpg_pos.size(), read.reverse, methylation.data());
+                return methylation.empty() ? 0 : methylation[0] & 1;
+            });
+
+            double dispatched = measure(reads, rounds, [&] (read_t const & read)
+            {
+                call_methylation(read.sequence, read.cpg_pos, read.reverse, methylation);
+                return methylation.empty() ? 0 : methylation[0] & 1;
+            });
+
+            std::cout << read_length << "\t" << spacing << "\t" << branches << "\t" << scalar << "\t" << dispatched << "\n";
+        }
+    }
+
+    return 0;
+}